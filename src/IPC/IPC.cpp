@@ -33,21 +33,21 @@ ipc_module_t* IPC::factory(const std::string& name){
 }
 
 void action_quit(){
-	Log::message(Log_Verbose, "IPC: Quit\n");
+	log_verbose("IPC: Quit\n");
 	global_fubar_kernel->quit();
 }
 
 void action_reload(){
-	Log::message(Log_Verbose, "IPC: Reload browser\n");
+	log_verbose("IPC: Reload browser\n");
 	global_fubar_kernel->reload_browser();
 }
 
 void action_debug(){
-	Log::message(Log_Verbose, "IPC: Debug\n");
+	log_verbose("IPC: Debug\n");
 	global_fubar_kernel->debug_dumpqueue();
 }
 
 void action_set_queue(int id){
-	Log::message(Log_Verbose, "IPC: Changing queue to %d\n", id);
+	log_verbose("IPC: Changing queue to %d\n", id);
 	global_fubar_kernel->queue_set(id);
 }
@@ -55,6 +55,12 @@ struct ipc_module_t {
 	 * @param timeout Time in ms it can block, 0 means no blocking.
 	 */
 	void (*poll)(struct ipc_module_t* self, int timeout);
+
+	/**
+	 * If poll is set and this is a valid fd (not -1) poll is only called when
+	 * the fd is readable, otherwise it is called periodically.
+	 */
+	int fd;
 };
 
 #ifdef __cplusplus
@@ -16,6 +16,10 @@
  * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
 #include "IPC.hpp"
 #include "core/log.h"
 #include <dbus/dbus.h>
@@ -28,6 +32,9 @@ static DBusError error;
 
 static void poll(struct ipc_module_t* module, int timeout){
 	dbus_connection_read_write_dispatch(bus, timeout);
+
+	/* dispatch all messages already read as the fd won't wake the kernel for them */
+	while ( dbus_connection_dispatch(bus) == DBUS_DISPATCH_DATA_REMAINS );
 }
 
 static void handle_quit(DBusMessage* message){
@@ -48,7 +55,7 @@ static void handle_set_queue(DBusMessage* message){
 	                                             DBUS_TYPE_UINT32, &queue_id,
 	                                             DBUS_TYPE_INVALID);
 	if ( !args_ok ) {
-		log_message(Log_Verbose, "D-Bus: Malformed `ChangeQueue' command: %s\n", error.message);
+		log_verbose("D-Bus: Malformed `ChangeQueue' command: %s\n", error.message);
 		return;
 	}
 
@@ -86,7 +93,7 @@ static DBusHandlerResult signal_filter (DBusConnection* bus, DBusMessage* messag
 		current_command++;
 	}
 
-	log_message(Log_Verbose, "D-Bus: Unhandled command: %s\n", dbus_message_get_member(message));
+	log_verbose("D-Bus: Unhandled command: %s\n", dbus_message_get_member(message));
 	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 }
 
@@ -95,7 +102,7 @@ void* module_alloc(){
 }
 
 int module_init(struct ipc_module_t* module){
-	log_message(Log_Verbose, "D-Bus: Starting\n");
+	log_verbose("D-Bus: Starting\n");
 	module->poll = poll;
 
 	dbus_error_init (&error);
@@ -108,6 +115,11 @@ int module_init(struct ipc_module_t* module){
 
 	dbus_bus_add_match (bus, dbus_rule, &error);
 	dbus_connection_add_filter(bus, signal_filter, NULL, NULL);
+
+	if ( !dbus_connection_get_unix_fd(bus, &module->fd) ){
+		module->fd = -1;
+	}
+
 	return 0;
 }
 
@@ -45,6 +45,7 @@ void* module_alloc(){
 
 int module_init(struct ipc_module_t* module){
 	module->poll = NULL;
+	module->fd = -1;
 
 	signal(SIGINT, sighandler);
 	signal(SIGHUP, sighandler);
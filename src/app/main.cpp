@@ -66,11 +66,23 @@ int main( int argc, const char* argv[] ){
 			600,					// height
 			3.0f,					// transition_time;
 			5.0f,					// switch_time;
+			60.0f,					// refresh_rate
+			3,						// prefetch
+			2,						// decode threads
+			3,						// texture ring
+			64,						// image_cache
+			512,					// raster_cache_size
 			NULL,					// connection_string
 			NULL,					// transition_string
 			NULL,					// file log
 			NULL,					// named pipe log
 			NULL,					// unix domain socket log
+			NULL,					// binary log
+			NULL,					// log module levels
+			NULL,					// raster cache
+			NULL,					// shader cache
+			NULL,					// metrics socket
+			NULL,					// schedule
 
 			NULL,                   // Frontend URL.
 			NULL,                   // Instance name.
@@ -88,7 +100,7 @@ int main( int argc, const char* argv[] ){
 		Log::initialize();
 
 		/* only log to stdout if no other destination has been set */
-		if ( !(arguments.log_file || arguments.log_fifo || arguments.log_domain) ){
+		if ( !(arguments.log_file || arguments.log_fifo || arguments.log_domain || arguments.log_binary) ){
 			Log::add_destination(new FileDestination(stdout));
 		}
 
@@ -102,16 +114,23 @@ int main( int argc, const char* argv[] ){
 			Log::add_destination(new FIFODestination(arguments.log_fifo));
 		}
 
-		/* setup unix domain socket log */
-		if ( arguments.log_domain ){
-			UDSServer d(arguments.log_domain);
-			d.accept(NULL);
+		/* setup binary log (read using slideshow-logdecode) */
+		if ( arguments.log_binary ){
+			Log::add_destination(new BinaryDestination(arguments.log_binary));
 		}
 
+		/* the unix domain socket log (--uds-log) is served from the kernel
+		 * event loop, see Kernel::init_log_server */
+
 #ifdef HAVE_SYSLOG
 		Log::add_destination(new SyslogDestination());
 #endif /* HAVE_SYSLOG */
-		//Log::set_level( (Log::Severity)arguments.loglevel );
+
+		/* messages below the level is discarded before formatting */
+		Log::set_level(static_cast<Severity>(arguments.loglevel));
+		if ( arguments.log_modules && !Log::set_module_levels(arguments.log_modules) ){
+			Log::warning("Invalid --log-modules `%s', ignored\n", arguments.log_modules);
+		}
 
 		/* Kernel takes ownership of backend and will release memory when finished */
 		const char* backend_name = "sdl";
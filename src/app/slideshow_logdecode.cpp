@@ -0,0 +1,263 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2014 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "core/log_format.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <getopt.h>
+
+static const char* program_name;
+static int min_severity = Log_Debug;
+
+static bool read_exact(FILE* fp, void* dst, size_t size){
+	return size == 0 || fread(dst, size, 1, fp) == 1;
+}
+
+static bool read_magic(FILE* fp){
+	char magic[4];
+	return read_exact(fp, magic, sizeof(magic)) && memcmp(magic, LOG_BINARY_MAGIC, 4) == 0;
+}
+
+/**
+ * Skip to the next header (after a partial record left by a session which
+ * didn't end properly). The header type and magic is consumed.
+ * @return False if there is no more headers.
+ */
+static bool resync(FILE* fp){
+	static const char pattern[] = "H" LOG_BINARY_MAGIC;
+	size_t matched = 0;
+	int c;
+
+	while ( (c = fgetc(fp)) != EOF ){
+		if ( c == pattern[matched] ){
+			if ( ++matched == sizeof(pattern) - 1 ) return true;
+		} else {
+			matched = c == 'H' ? 1 : 0;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Decode a binary log and write it as text (same format as the text logs).
+ * @return 0 if successful.
+ */
+static int decode(FILE* fp, const char* filename){
+	std::vector<std::string> formats;
+	int64_t clock_offset = 0;
+	bool have_header = false;
+	bool synced = false;        /* header type and magic already read by resync */
+	int c;
+
+	while ( synced || (c = fgetc(fp)) != EOF ){
+		if ( synced ){
+			c = 'H';
+		}
+
+		switch ( c ){
+		case 0: /* padding */
+			break;
+
+		case 'H':
+		{
+			uint32_t version;
+			int64_t realtime, monotonic;
+			const bool magic = synced || read_magic(fp);
+			synced = false;
+			if ( !magic ||
+			     !read_exact(fp, &version, sizeof(version)) ||
+			     !read_exact(fp, &realtime, sizeof(realtime)) ||
+			     !read_exact(fp, &monotonic, sizeof(monotonic)) ){
+				if ( have_header ) goto corrupt;
+				fprintf(stderr, "%s: %s: not a slideshow binary log\n", program_name, filename);
+				return 1;
+			}
+
+			if ( version == 0 || version > LOG_BINARY_VERSION ){
+				fprintf(stderr, "%s: %s: unsupported version %u\n", program_name, filename, version);
+				return 1;
+			}
+
+			/* a new session, format ids starts over */
+			formats.clear();
+			clock_offset = realtime - monotonic;
+			have_header = true;
+			break;
+		}
+
+		case 'E':
+			if ( !read_magic(fp) ){
+				goto corrupt;
+			}
+			break;
+
+		case 'F':
+		{
+			uint32_t id;
+			uint16_t len;
+			if ( !read_exact(fp, &id, sizeof(id)) || !read_exact(fp, &len, sizeof(len)) ){
+				goto truncated;
+			}
+
+			std::string format(len, '\0');
+			if ( !read_exact(fp, &format[0], len) ){
+				goto truncated;
+			}
+
+			if ( id >= formats.size() ){
+				formats.resize(id + 1);
+			}
+			formats[id] = format;
+			break;
+		}
+
+		case 'M':
+		{
+			uint32_t id;
+			uint8_t severity;
+			int64_t timestamp;
+			uint16_t size;
+			char args[UINT16_MAX];
+			if ( !read_exact(fp, &id, sizeof(id)) ||
+			     !read_exact(fp, &severity, sizeof(severity)) ||
+			     !read_exact(fp, &timestamp, sizeof(timestamp)) ||
+			     !read_exact(fp, &size, sizeof(size)) ||
+			     !read_exact(fp, args, size) ){
+				goto truncated;
+			}
+
+			if ( severity < min_severity ){
+				continue;
+			}
+
+			if ( !have_header || id >= formats.size() ){
+				fprintf(stderr, "%s: %s: message references unknown format %u\n", program_name, filename, id);
+				continue;
+			}
+
+			char timestamp_buf[64];
+			const time_t t = static_cast<time_t>((timestamp + clock_offset) / 1000000000);
+			struct tm tm;
+			localtime_r(&t, &tm);
+			strftime(timestamp_buf, sizeof(timestamp_buf), "%Y-%m-%d %H:%M:%S", &tm);
+
+			static char content[2 * UINT16_MAX];
+			LogFormat::format(content, sizeof(content), formats[id].c_str(), args, size);
+			printf("(%s) [%s] %s", LogFormat::severity_string(static_cast<Severity>(severity)), timestamp_buf, content);
+			break;
+		}
+
+		default:
+			fprintf(stderr, "%s: %s: corrupt record (type 0x%02x)\n", program_name, filename, c);
+			goto corrupt;
+		}
+
+		continue;
+
+	  corrupt:
+		/* most likely a partial record followed by a new session */
+		fprintf(stderr, "%s: %s: skipping to the next session\n", program_name, filename);
+		if ( !(synced = resync(fp)) ){
+			return 1;
+		}
+	}
+
+	return 0;
+
+  truncated:
+	/* the last record might be partial if the player was killed */
+	fprintf(stderr, "%s: %s: truncated record\n", program_name, filename);
+	return 0;
+}
+
+static const char* shortopts = "s:h";
+static struct option longopts[] = {
+	{"severity",    required_argument, 0, 's'},
+	{"help",        no_argument,       0, 'h'},
+	{0, 0, 0, 0}, /* sentinel */
+};
+
+static void show_usage(void){
+	printf("%s-%s\n", program_name, VERSION);
+	printf("(c) 2014 David Sveningsson <ext@sidvind.com>\n\n");
+	printf("Decode binary slideshow logs (--binary-log) to text.\n");
+	printf("Usage: %s [OPTIONS] [FILE..]\n\n"
+	       "  -s, --severity=LEVEL       Only show messages with at least this severity (0-4)\n"
+	       "  -h, --help                 Show this text.\n\n"
+	       "Reads from stdin if no file is given.\n",
+	       program_name);
+}
+
+int main(int argc, char* argv[]){
+	/* extract program name from path. e.g. /path/to/foo -> foo */
+	const char* separator = strrchr(argv[0], '/');
+	if ( separator ){
+		program_name = separator + 1;
+	} else {
+		program_name = argv[0];
+	}
+
+	int option_index = 0;
+	int op;
+
+	/* parse arguments */
+	while ( (op=getopt_long(argc, argv, shortopts, longopts, &option_index)) != -1 ){
+		switch ( op ){
+		case 's': /* --severity */
+			min_severity = atoi(optarg);
+			break;
+
+		case 'h': /* --help */
+			show_usage();
+			return 0;
+
+		default:
+			return 1;
+		}
+	}
+
+	if ( optind == argc ){
+		return decode(stdin, "stdin");
+	}
+
+	int ret = 0;
+	for ( int i = optind; i < argc; i++ ){
+		FILE* fp = fopen(argv[i], "rb");
+		if ( !fp ){
+			fprintf(stderr, "%s: %s: %s\n", program_name, argv[i], strerror(errno));
+			ret = 1;
+			continue;
+		}
+
+		ret |= decode(fp, argv[i]);
+		fclose(fp);
+	}
+
+	return ret;
+}
@@ -85,7 +85,7 @@ static float clamp(float x, float lo, float hi){
 }
 
 static void init_common(){
-	graphics_init(width, height);
+	graphics_init(width, height, 2);
 	graphics_load_image("resources/transition_a.png", 1);
 	graphics_load_image("resources/transition_b.png", 1);
 
@@ -23,6 +23,7 @@
 
 #include "backend/SDLbackend.h"
 #include "core/exception.hpp"
+#include <SDL/SDL_syswm.h>
 
 #ifdef WIN32
 #	include "win32.h"
@@ -62,6 +63,9 @@ int SDLBackend::init(const Vector2ui &resolution, bool fullscreen){
 		throw exception("Unable to init SDL: %s", SDL_GetError());
 	}
 
+	/* transitions is paced by vsync */
+	SDL_GL_SetAttribute(SDL_GL_SWAP_CONTROL, 1);
+
 	if ( SDL_SetVideoMode(resolution.width, resolution.height, 0, flags) == NULL ){
 		throw exception("Unable to init SDL: %s", SDL_GetError());
 	}
@@ -113,6 +117,18 @@ void SDLBackend::poll(bool& running){
 	}
 }
 
+int SDLBackend::event_fd() const {
+#ifdef SDL_VIDEO_DRIVER_X11
+	SDL_SysWMinfo info;
+	SDL_VERSION(&info.version);
+	if ( SDL_GetWMInfo(&info) > 0 && info.subsystem == SDL_SYSWM_X11 ){
+		return ConnectionNumber(info.info.x11.display);
+	}
+#endif /* SDL_VIDEO_DRIVER_X11 */
+
+	return -1;
+}
+
 void SDLBackend::swap_buffers() const {
 	SDL_GL_SwapBuffers();
 }
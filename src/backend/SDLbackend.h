@@ -34,6 +34,7 @@ class SDLBackend:public PlatformBackend {
 		virtual void cleanup();
 
 		virtual void poll(bool& running);
+		virtual int event_fd() const;
 
 		virtual void swap_buffers() const;
 
@@ -50,6 +50,12 @@ class PlatformBackend {
 		 */
 		virtual void poll(bool& running) = 0;
 
+		/**
+		 * Get a fd which becomes readable when there is events to poll, or -1
+		 * if not available (the kernel will then poll periodically).
+		 */
+		virtual int event_fd() const { return -1; }
+
 		/**
 		 * Swap buffers.
 		 */
@@ -69,6 +69,37 @@ typedef int (*queue_dump_callback)(struct browser_module_t* data);
  */
 typedef int (*queue_set_callback)(struct browser_module_t* data, unsigned int id);
 
+/**
+ * Called when change_fd is readable. The browser must consume the event (so
+ * the fd is no longer readable) and tell if the queue has actually changed.
+ * It is called from the main thread while no other browser callback runs.
+ *
+ * @return Non-zero if the queue has changed and should be reloaded.
+ */
+typedef int (*queue_changed_callback)(struct browser_module_t* data);
+
+/**
+ * Called by queue_list for each slide, the strings is only valid during the
+ * call.
+ */
+typedef void (*slide_visitor)(void* user, const char* filename, const char* assembler);
+
+/**
+ * List the slides of the regular queue in order (a single lap, without
+ * intermediate slides) without changing the position of next_slide.
+ *
+ * @return Non-zero if the queue could not be read (e.g. server unreachable).
+ */
+typedef int (*queue_list_callback)(struct browser_module_t* data, slide_visitor visit, void* user);
+
+/**
+ * Get the next intermediate slide (shown once, e.g. an announcement) without
+ * advancing the regular queue.
+ *
+ * @return Same as next_slide_callback, filename is NULL if there is none.
+ */
+typedef slide_context_t (*next_intermediate_callback)(struct browser_module_t* data);
+
 struct browser_module_t {
 	struct module_t module;
 	browser_context_t context;
@@ -77,6 +108,21 @@ struct browser_module_t {
 	queue_reload_callback queue_reload; /* can be left "unset" */
 	queue_dump_callback queue_dump;     /* can be left "unset" */
 	queue_set_callback queue_set;       /* can be left "unset" */
+
+	/**
+	 * Change feed: a fd which becomes readable when the queue might have
+	 * changed (e.g. inotify or eventfd), -1 if the browser doesn't support
+	 * it. Must be set during init and stay the same until cleanup.
+	 */
+	int change_fd;
+	queue_changed_callback queue_changed;
+
+	/**
+	 * Used by the local scheduler (see Scheduler), slides is shown in browser
+	 * order if queue_list is left unset.
+	 */
+	queue_list_callback queue_list;               /* can be left NULL */
+	next_intermediate_callback next_intermediate; /* can be left NULL */
 };
 
 /* Default callbacks */
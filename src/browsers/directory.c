@@ -16,40 +16,600 @@
  * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/**
+ * Directory browser.
+ *
+ *   directory://PATH[?recursive&include=GLOB,..&exclude=GLOB,..]
+ *
+ * The directory is scanned once into a sorted index (natural order, i.e.
+ * "img2" before "img10") which is then kept up-to-date using inotify instead
+ * of rescanning the directory each time the queue wraps.
+ *
+ * Globs are matched against the basename. Excludes also applies to
+ * subdirectories (e.g. exclude=.*) while includes only applies to files.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
 #include "browser.h"
 #include "core/log.h"
 #include "core/asprintf.h"
+#include <ctype.h>
 #include <string.h>
+#include <stdlib.h>
 #include <dirent.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE)
+
+typedef struct {
+	int wd;
+	char* path;        /* relative to the root, "" for the root itself */
+} watch_t;
 
 typedef struct {
 	struct browser_module_t module;
-	struct dirent** namelist;
-	int current;
+
+	/* options */
+	char* root;
+	int recursive;
+	char** include;    /* NULL-terminated list of globs (NULL if unset) */
+	char** exclude;
+
+	/* sorted index of files, relative to root */
+	char** entries;
+	size_t size;
+	size_t capacity;
+	size_t current;    /* next entry to show */
+
+	/* inotify watches, sorted by wd */
+	int inotify_fd;
+	watch_t* watches;
+	size_t num_watches;
 } context_t;
 
 MODULE_INFO("Directory browser", BROWSER_MODULE, "David Sveningsson");
 
-static int filter(const struct dirent* d){
+#ifdef WIN32
+#	define SEPARATOR "\\"
+#else
+#	define SEPARATOR "/"
+#endif
+
+static char** split_globs(const char* value){
+	size_t n = 2;
+	for ( const char* c = value; *c; c++ ){
+		if ( *c == ',' ) n++;
+	}
+
+	char** list = malloc(sizeof(char*) * n);
+	char* tmp = strdup(value);
+	char* saveptr = NULL;
+	size_t i = 0;
+	for ( char* glob = strtok_r(tmp, ",", &saveptr); glob; glob = strtok_r(NULL, ",", &saveptr) ){
+		list[i++] = strdup(glob);
+	}
+	list[i] = NULL;
+	free(tmp);
+
+	return list;
+}
+
+static void free_globs(char** list){
+	if ( !list ) return;
+	for ( char** glob = list; *glob; glob++ ){
+		free(*glob);
+	}
+	free(list);
+}
+
+static int match_any(char* const* list, const char* name){
+	for ( char* const* glob = list; *glob; glob++ ){
+		if ( fnmatch(*glob, name, 0) == 0 ){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Parse "PATH?key[=value]&.." from the context name.
+ */
+static void parse_options(context_t* this){
+	const char* name = this->module.context.name ? this->module.context.name : ".";
+	const char* query = strchr(name, '?');
+
+	if ( !query ){
+		this->root = strdup(name);
+		return;
+	}
+
+	this->root = strndup(name, (size_t)(query - name));
+
+	char* tmp = strdup(query + 1);
+	char* saveptr = NULL;
+	for ( char* option = strtok_r(tmp, "&", &saveptr); option; option = strtok_r(NULL, "&", &saveptr) ){
+		char* value = strchr(option, '=');
+		if ( value ){
+			*value++ = 0;
+		}
+
+		if ( strcmp(option, "recursive") == 0 ){
+			this->recursive = !value || atoi(value) != 0;
+		} else if ( strcmp(option, "include") == 0 && value ){
+			free_globs(this->include);
+			this->include = split_globs(value);
+		} else if ( strcmp(option, "exclude") == 0 && value ){
+			free_globs(this->exclude);
+			this->exclude = split_globs(value);
+		} else {
+			log_message(Log_Warning, "directory: unknown option `%s'\n", option);
+		}
+	}
+	free(tmp);
+}
+
+static int accept_entry(const context_t* this, const char* name, int is_dir){
 	if (
-	    strcmp(d->d_name, ".") == 0 ||
-	    strcmp(d->d_name, "..") == 0 ||
-	    strcmp(d->d_name, "Thumbs.db") == 0 ){
+	    strcmp(name, ".") == 0 ||
+	    strcmp(name, "..") == 0 ||
+	    strcmp(name, "Thumbs.db") == 0 ){
 		return 0;
 	}
 
-	if ( d->d_type == DT_DIR ) return 0;
+	if ( this->exclude && match_any(this->exclude, name) ){
+		return 0;
+	}
+
+	if ( is_dir ){
+		return this->recursive;
+	}
+
+	return !this->include || match_any(this->include, name);
+}
+
+/**
+ * Natural order comparison: runs of digits are compared by value. Ties (e.g.
+ * "img01" and "img1") are broken by strcmp so the order is stable.
+ */
+static int natural_compare(const char* a, const char* b){
+	const char* s1 = a;
+	const char* s2 = b;
+
+	while ( *s1 && *s2 ){
+		if ( isdigit((unsigned char)*s1) && isdigit((unsigned char)*s2) ){
+			while ( *s1 == '0' ) s1++;
+			while ( *s2 == '0' ) s2++;
+
+			const size_t n1 = strspn(s1, "0123456789");
+			const size_t n2 = strspn(s2, "0123456789");
+			if ( n1 != n2 ){
+				return n1 < n2 ? -1 : 1;
+			}
+
+			const int ret = strncmp(s1, s2, n1);
+			if ( ret != 0 ){
+				return ret;
+			}
+
+			s1 += n1;
+			s2 += n2;
+			continue;
+		}
+
+		const int c1 = tolower((unsigned char)*s1);
+		const int c2 = tolower((unsigned char)*s2);
+		if ( c1 != c2 ){
+			return c1 - c2;
+		}
+
+		s1++;
+		s2++;
+	}
+
+	if ( *s1 || *s2 ){
+		return *s1 ? 1 : -1;
+	}
+
+	return strcmp(a, b);
+}
+
+static int entry_compare(const void* a, const void* b){
+	return natural_compare(*(char* const*)a, *(char* const*)b);
+}
+
+/**
+ * Find the position of path in the index.
+ * @return Position of the first entry not ordered before path.
+ */
+static size_t index_find(const context_t* this, const char* path, int* found){
+	size_t lo = 0;
+	size_t hi = this->size;
+
+	while ( lo < hi ){
+		const size_t mid = lo + (hi - lo) / 2;
+		if ( natural_compare(this->entries[mid], path) < 0 ){
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	*found = lo < this->size && strcmp(this->entries[lo], path) == 0;
+	return lo;
+}
+
+static void index_reserve(context_t* this, size_t size){
+	if ( size <= this->capacity ){
+		return;
+	}
+
+	this->capacity = this->capacity ? this->capacity * 2 : 64;
+	if ( this->capacity < size ){
+		this->capacity = size;
+	}
+	this->entries = realloc(this->entries, sizeof(char*) * this->capacity);
+}
+
+/**
+ * Insert a path (taking ownership) at its sorted position.
+ * @return Non-zero if the entry was added.
+ */
+static int index_insert(context_t* this, char* path){
+	int found;
+	const size_t pos = index_find(this, path, &found);
+	if ( found ){
+		free(path);
+		return 0;
+	}
+
+	index_reserve(this, this->size + 1);
+	memmove(&this->entries[pos + 1], &this->entries[pos], sizeof(char*) * (this->size - pos));
+	this->entries[pos] = path;
+	this->size++;
+
+	/* keep pointing at the same upcoming entry */
+	if ( pos < this->current ){
+		this->current++;
+	}
+
 	return 1;
 }
 
-#ifdef WIN32
-#	define SEPARATOR "\\"
-#else
-#	define SEPARATOR "/"
-#endif
+static void index_erase(context_t* this, size_t pos){
+	free(this->entries[pos]);
+	memmove(&this->entries[pos], &this->entries[pos + 1], sizeof(char*) * (this->size - pos - 1));
+	this->size--;
+
+	if ( pos < this->current ){
+		this->current--;
+	}
+}
+
+static int index_remove(context_t* this, const char* path){
+	int found;
+	const size_t pos = index_find(this, path, &found);
+	if ( !found ){
+		return 0;
+	}
+
+	index_erase(this, pos);
+	return 1;
+}
+
+/**
+ * Remove all entries below a directory.
+ */
+static int index_remove_tree(context_t* this, const char* path){
+	const size_t len = strlen(path);
+	size_t n = 0;
+
+	/* natural order doesn't keep a subtree contiguous so do a linear pass
+	 * (only happens when whole directories is removed) */
+	for ( size_t i = this->size; i-- > 0; ){
+		const char* entry = this->entries[i];
+		if ( strncmp(entry, path, len) == 0 && entry[len] == '/' ){
+			index_erase(this, i);
+			n++;
+		}
+	}
+
+	return n > 0;
+}
+
+static void index_clear(context_t* this){
+	for ( size_t i = 0; i < this->size; i++ ){
+		free(this->entries[i]);
+	}
+	this->size = 0;
+	this->current = 0;
+}
+
+static char* join(const char* dir, const char* name){
+	if ( dir[0] == 0 ){
+		return strdup(name);
+	}
+	return asprintf2("%s/%s", dir, name);
+}
+
+static watch_t* watch_find(context_t* this, int wd){
+	size_t lo = 0;
+	size_t hi = this->num_watches;
+
+	while ( lo < hi ){
+		const size_t mid = lo + (hi - lo) / 2;
+		if ( this->watches[mid].wd < wd ){
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo < this->num_watches && this->watches[lo].wd == wd ? &this->watches[lo] : NULL;
+}
+
+static void watch_add(context_t* this, const char* path){
+	if ( this->inotify_fd == -1 ){
+		return;
+	}
+
+	char* fullpath = path[0] ? asprintf2("%s/%s", this->root, path) : strdup(this->root);
+	const int wd = inotify_add_watch(this->inotify_fd, fullpath, WATCH_MASK);
+	free(fullpath);
+
+	if ( wd == -1 ){
+		log_message(Log_Warning, "directory: failed to watch `%s/%s' for changes\n", this->root, path);
+		return;
+	}
+
+	/* already watched (e.g. the directory was moved within the tree) */
+	watch_t* existing = watch_find(this, wd);
+	if ( existing ){
+		free(existing->path);
+		existing->path = strdup(path);
+		return;
+	}
+
+	/* wd is increasing so appending keeps the table sorted (except after
+	 * wrapping around which is handled by inserting at the right place) */
+	size_t pos = this->num_watches;
+	while ( pos > 0 && this->watches[pos - 1].wd > wd ){
+		pos--;
+	}
+
+	this->watches = realloc(this->watches, sizeof(watch_t) * (this->num_watches + 1));
+	memmove(&this->watches[pos + 1], &this->watches[pos], sizeof(watch_t) * (this->num_watches - pos));
+	this->watches[pos].wd = wd;
+	this->watches[pos].path = strdup(path);
+	this->num_watches++;
+}
+
+static void watch_erase(context_t* this, size_t pos){
+	free(this->watches[pos].path);
+	memmove(&this->watches[pos], &this->watches[pos + 1], sizeof(watch_t) * (this->num_watches - pos - 1));
+	this->num_watches--;
+}
+
+/**
+ * Stop watching a directory (and its subdirectories) which has been moved
+ * out of the tree.
+ */
+static void watch_remove_tree(context_t* this, const char* path){
+	const size_t len = strlen(path);
+
+	for ( size_t i = this->num_watches; i-- > 0; ){
+		const char* dir = this->watches[i].path;
+		if ( strncmp(dir, path, len) == 0 && (dir[len] == 0 || dir[len] == '/') ){
+			inotify_rm_watch(this->inotify_fd, this->watches[i].wd);
+			watch_erase(this, i);
+		}
+	}
+}
+
+static void watch_clear(context_t* this){
+	while ( this->num_watches > 0 ){
+		inotify_rm_watch(this->inotify_fd, this->watches[this->num_watches - 1].wd);
+		watch_erase(this, this->num_watches - 1);
+	}
+}
+
+/**
+ * Directories being scanned, used to detect symlinks looping back to a
+ * parent.
+ */
+typedef struct ancestor {
+	dev_t dev;
+	ino_t ino;
+	const struct ancestor* parent;
+} ancestor_t;
+
+static int scan_dir(context_t* this, const char* path, int bulk, const ancestor_t* parent){
+	char* fullpath = path[0] ? asprintf2("%s/%s", this->root, path) : strdup(this->root);
+	DIR* dir = opendir(fullpath);
+	int changed = 0;
+
+	if ( !dir ){
+		log_message(Log_Warning, "directory: failed to read `%s'\n", fullpath);
+		free(fullpath);
+		return 0;
+	}
+
+	struct stat st;
+	if ( fstat(dirfd(dir), &st) != 0 ){
+		log_message(Log_Warning, "directory: failed to read `%s'\n", fullpath);
+		closedir(dir);
+		free(fullpath);
+		return 0;
+	}
+
+	for ( const ancestor_t* it = parent; it; it = it->parent ){
+		if ( it->dev == st.st_dev && it->ino == st.st_ino ){
+			log_message(Log_Warning, "directory: `%s' loops back to a parent directory, ignored\n", fullpath);
+			closedir(dir);
+			free(fullpath);
+			return 0;
+		}
+	}
+
+	const ancestor_t self = {st.st_dev, st.st_ino, parent};
+	watch_add(this, path);
+
+	struct dirent* ent;
+	while ( (ent = readdir(dir)) != NULL ){
+		int is_dir = ent->d_type == DT_DIR;
+
+		if ( ent->d_type == DT_UNKNOWN || ent->d_type == DT_LNK ){
+			struct stat st;
+			char* tmp = asprintf2("%s/%s", fullpath, ent->d_name);
+			is_dir = stat(tmp, &st) == 0 && S_ISDIR(st.st_mode);
+			free(tmp);
+		}
+
+		if ( !accept_entry(this, ent->d_name, is_dir) ){
+			continue;
+		}
+
+		char* entry = join(path, ent->d_name);
+
+		if ( is_dir ){
+			changed |= scan_dir(this, entry, bulk, &self);
+			free(entry);
+		} else if ( bulk ){
+			index_reserve(this, this->size + 1);
+			this->entries[this->size++] = entry;
+			changed = 1;
+		} else {
+			changed |= index_insert(this, entry);
+		}
+	}
+
+	closedir(dir);
+	free(fullpath);
+	return changed;
+}
+
+/**
+ * Add all files in a directory (relative to root) to the index. Symlinked
+ * directories is followed unless they loop back to a directory being scanned.
+ *
+ * @param bulk If set entries are appended unsorted and the caller must sort
+ *             the index afterwards.
+ * @return Non-zero if any entries was added.
+ */
+static int scan(context_t* this, const char* path, int bulk){
+	return scan_dir(this, path, bulk, NULL);
+}
+
+/**
+ * Rebuild the index from scratch, trying to keep the position.
+ */
+static void rescan(context_t* this){
+	char* upcoming = this->current < this->size ? strdup(this->entries[this->current]) : NULL;
+
+	watch_clear(this);
+	index_clear(this);
+	scan(this, "", 1);
+	qsort(this->entries, this->size, sizeof(char*), entry_compare);
+
+	if ( upcoming ){
+		int found;
+		this->current = index_find(this, upcoming, &found);
+		free(upcoming);
+	}
+}
 
 static void queue_reload(context_t* this){
-	this->current = scandir(this->module.context.name, &this->namelist, filter, NULL);
+	/* without inotify the index cannot be trusted */
+	if ( this->inotify_fd == -1 ){
+		rescan(this);
+	}
+}
+
+static int handle_event(context_t* this, const struct inotify_event* event){
+	if ( event->mask & IN_Q_OVERFLOW ){
+		log_verbose("directory: inotify queue overflow, rescanning\n");
+		rescan(this);
+		return 1;
+	}
+
+	const watch_t* watch = watch_find(this, event->wd);
+	if ( !watch ){
+		return 0;
+	}
+
+	/* directory was removed */
+	if ( event->mask & IN_IGNORED ){
+		watch_erase(this, (size_t)(watch - this->watches));
+		return 0;
+	}
+
+	if ( event->len == 0 ){
+		return 0;
+	}
+
+	const int is_dir = (event->mask & IN_ISDIR) != 0;
+	if ( !accept_entry(this, event->name, is_dir) ){
+		return 0;
+	}
+
+	char* path = join(watch->path, event->name);
+	int changed = 0;
+
+	if ( is_dir ){
+		if ( event->mask & (IN_CREATE | IN_MOVED_TO) ){
+			changed = scan(this, path, 0);
+		} else if ( event->mask & (IN_DELETE | IN_MOVED_FROM) ){
+			watch_remove_tree(this, path);
+			changed = index_remove_tree(this, path);
+		}
+		free(path);
+		return changed;
+	}
+
+	/* new files is added when fully written (IN_CREATE is not used as the
+	 * file might still be incomplete) */
+	if ( event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO) ){
+		/* an existing file being rewritten is also a change as the cached
+		 * image is stale */
+		changed = index_insert(this, path) || (event->mask & IN_CLOSE_WRITE);
+		return changed;
+	}
+
+	if ( event->mask & (IN_DELETE | IN_MOVED_FROM) ){
+		changed = index_remove(this, path);
+	}
+
+	free(path);
+	return changed;
+}
+
+static int queue_changed(context_t* this){
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	int changed = 0;
+	ssize_t len;
+
+	while ( (len = read(this->inotify_fd, buf, sizeof(buf))) > 0 ){
+		const char* ptr = buf;
+		while ( ptr < buf + len ){
+			const struct inotify_event* event = (const struct inotify_event*)ptr;
+			changed |= handle_event(this, event);
+			ptr += sizeof(struct inotify_event) + event->len;
+		}
+	}
+
+	return changed;
+}
+
+static void queue_dump(context_t* this){
+	log_message(Log_Info, "directory: %s (%zu slides):\n", this->root, this->size);
+	for ( size_t i = 0; i < this->size; i++ ){
+		log_message(Log_Info, "  %c %s\n", i < this->current ? '*' : ' ', this->entries[i]);
+	}
 }
 
 static slide_context_t next_slide(context_t* this){
@@ -57,35 +617,38 @@ static slide_context_t next_slide(context_t* this){
 	slide.filename = NULL;
 	slide.assembler = NULL;
 
-	while ( 1 ) {
-		if ( this->current-- ){
-			slide.filename = asprintf2("%s" SEPARATOR "%s", this->module.context.name, this->namelist[this->current]->d_name);
-			slide.assembler = strdup("image");
-			free(this->namelist[this->current]);
+	if ( this->current >= this->size ){
+		/* without inotify changes is only picked up when wrapping */
+		if ( this->inotify_fd == -1 ){
+			rescan(this);
+		}
+
+		/* empty directory, don't repeat */
+		if ( this->size == 0 ){
 			return slide;
-		} else {
-			free(this->namelist);
-			queue_reload(this);
+		}
 
-			/* empty directory, don't repeat */
-			if ( !this->current ){
-				return slide;
-			}
+		log_debug("queue wrapping\n");
+		this->current = 0;
+	}
 
-			log_message(Log_Debug, "queue wrapping\n");
+	slide.filename = asprintf2("%s" SEPARATOR "%s", this->root, this->entries[this->current++]);
+	slide.assembler = strdup("image");
+	return slide;
+}
 
-			/* retry */
-			continue;
-		}
+static int queue_list(context_t* this, slide_visitor visit, void* user){
+	if ( this->inotify_fd == -1 ){
+		rescan(this);
 	}
-}
 
-static void queue_clear(context_t* this){
-	while ( this->current-- ){
-		free(this->namelist[this->current]);
+	for ( size_t i = 0; i < this->size; i++ ){
+		char* filename = asprintf2("%s" SEPARATOR "%s", this->root, this->entries[i]);
+		visit(user, filename, "image");
+		free(filename);
 	}
-	free(this->namelist);
-	this->namelist = NULL;
+
+	return 0;
 }
 
 void* module_alloc(){
@@ -95,8 +658,31 @@ void* module_alloc(){
 int EXPORT module_init(context_t* this){
 	this->module.next_slide   = (next_slide_callback)next_slide;
 	this->module.queue_reload = (queue_reload_callback)queue_reload;
-	this->namelist = NULL;
+	this->module.queue_dump   = (queue_dump_callback)queue_dump;
+	this->module.queue_changed = (queue_changed_callback)queue_changed;
+	this->module.queue_list   = (queue_list_callback)queue_list;
+	this->root = NULL;
+	this->recursive = 0;
+	this->include = NULL;
+	this->exclude = NULL;
+	this->entries = NULL;
+	this->size = 0;
+	this->capacity = 0;
 	this->current = 0;
+	this->watches = NULL;
+	this->num_watches = 0;
+
+	parse_options(this);
+
+	/* files added, removed or rewritten */
+	this->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if ( this->inotify_fd == -1 ){
+		log_message(Log_Warning, "directory: inotify unavailable, `%s' is rescanned when the queue wraps\n", this->root);
+	}
+	this->module.change_fd = this->inotify_fd;
+
+	rescan(this);
+	log_verbose("directory: %zu slides in `%s'\n", this->size, this->root);
 
 	return 0;
 }
@@ -106,6 +692,15 @@ int EXPORT module_cleanup(context_t* this){
 	 * pointer itself, so this is safe. */
 	free_context(&this->module.context);
 
-	queue_clear(this);
+	index_clear(this);
+	free(this->entries);
+	if ( this->inotify_fd != -1 ){
+		watch_clear(this);
+		close(this->inotify_fd);
+	}
+	free(this->watches);
+	free_globs(this->include);
+	free_globs(this->exclude);
+	free(this->root);
 	return 0;
 }
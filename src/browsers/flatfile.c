@@ -0,0 +1,392 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Flat-file playlist browser.
+ *
+ *   flatfile://PATH
+ *
+ * One slide per line as `FILENAME[<TAB>ASSEMBLER]`, the assembler defaults to
+ * "image". Empty lines and lines starting with '#' are ignored. Relative
+ * filenames are relative to the directory of the playlist.
+ *
+ * The playlist is read into memory with a single read and only an offset
+ * table is built, the strings are copied first when a slide is requested. It
+ * is not mapped as a file truncated or rewritten in-place while mapped would
+ * crash the player (SIGBUS). Whenever the mtime or inode of the file changes
+ * the playlist is loaded again and swapped in, writers should preferably
+ * write a new file and rename() it into place so a partially written
+ * playlist is never loaded.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "browser.h"
+#include "core/log.h"
+#include "core/asprintf.h"
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+typedef struct {
+	uint32_t filename;      /* offset into the data */
+	uint32_t filename_len;
+	uint32_t assembler;     /* assembler_len is 0 if unset */
+	uint32_t assembler_len;
+} record_t;
+
+typedef struct {
+	char* data;             /* file content, NULL if empty */
+	size_t size;
+	int loaded;
+	record_t* records;
+	size_t num_records;
+
+	/* identity of the loaded file */
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+} playlist_t;
+
+typedef struct {
+	struct browser_module_t module;
+
+	playlist_t playlist;
+	size_t current;              /* next record to show */
+
+	char* directory;             /* directory of the playlist */
+	const char* basename;        /* playlist filename (pointing into context) */
+	int inotify_fd;              /* watches the directory of the playlist */
+} context_t;
+
+MODULE_INFO("Flat-file playlist browser", BROWSER_MODULE, "David Sveningsson");
+
+static void playlist_free(playlist_t* playlist){
+	free(playlist->data);
+	free(playlist->records);
+
+	playlist->data = NULL;
+	playlist->size = 0;
+	playlist->records = NULL;
+	playlist->num_records = 0;
+	playlist->loaded = 0;
+}
+
+static int is_space(char c){
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+/**
+ * Build the offset table from the data.
+ */
+static void parse(playlist_t* playlist){
+	const char* data = playlist->data;
+	const char* end = data + playlist->size;
+	size_t capacity = 0;
+
+	for ( const char* line = data; line < end; ){
+		const char* eol = memchr(line, '\n', (size_t)(end - line));
+		const char* next = eol ? eol + 1 : end;
+		if ( !eol ) eol = end;
+
+		/* trim */
+		while ( line < eol && is_space(*line) ) line++;
+		while ( eol > line && is_space(eol[-1]) ) eol--;
+
+		if ( line == eol || *line == '#' ){
+			line = next;
+			continue;
+		}
+
+		if ( playlist->num_records == capacity ){
+			capacity = capacity ? capacity * 2 : 256;
+			playlist->records = realloc(playlist->records, sizeof(record_t) * capacity);
+		}
+
+		record_t* record = &playlist->records[playlist->num_records++];
+		const char* tab = memchr(line, '\t', (size_t)(eol - line));
+		const char* filename_end = tab ? tab : eol;
+
+		record->filename = (uint32_t)(line - data);
+		record->filename_len = (uint32_t)(filename_end - line);
+		record->assembler = 0;
+		record->assembler_len = 0;
+
+		if ( tab ){
+			const char* assembler = tab + 1;
+			while ( assembler < eol && is_space(*assembler) ) assembler++;
+			record->assembler = (uint32_t)(assembler - data);
+			record->assembler_len = (uint32_t)(eol - assembler);
+		}
+
+		line = next;
+	}
+}
+
+static int playlist_load(playlist_t* playlist, const char* filename){
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if ( fd == -1 ){
+		log_message(Log_Warning, "flatfile: failed to open `%s'\n", filename);
+		return -1;
+	}
+
+	struct stat st;
+	if ( fstat(fd, &st) != 0 || (uintmax_t)st.st_size > UINT32_MAX ){
+		log_message(Log_Warning, "flatfile: failed to read `%s'\n", filename);
+		close(fd);
+		return -1;
+	}
+
+	playlist->data = NULL;
+	playlist->size = (size_t)st.st_size;
+	playlist->records = NULL;
+	playlist->num_records = 0;
+	playlist->loaded = 1;
+	playlist->dev = st.st_dev;
+	playlist->ino = st.st_ino;
+	playlist->mtime = st.st_mtim;
+
+	if ( playlist->size > 0 ){
+		char* data = malloc(playlist->size);
+		size_t bytes = 0;
+		ssize_t n = 0;
+		while ( data && bytes < playlist->size && (n = read(fd, data + bytes, playlist->size - bytes)) > 0 ){
+			bytes += (size_t)n;
+		}
+
+		if ( !data || n < 0 ){
+			log_message(Log_Warning, "flatfile: failed to read `%s'\n", filename);
+			free(data);
+			close(fd);
+			return -1;
+		}
+
+		/* the file might have been truncated since stat, the change is picked
+		 * up by the next reload */
+		playlist->data = data;
+		playlist->size = bytes;
+	}
+
+	close(fd);
+
+	parse(playlist);
+	return 0;
+}
+
+/**
+ * Tell if the file has been replaced or modified since it was loaded.
+ */
+static int playlist_stale(const playlist_t* playlist, const char* filename){
+	struct stat st;
+	if ( stat(filename, &st) != 0 ){
+		return 0;
+	}
+
+	return
+		st.st_dev != playlist->dev ||
+		st.st_ino != playlist->ino ||
+		(size_t)st.st_size != playlist->size ||
+		st.st_mtim.tv_sec != playlist->mtime.tv_sec ||
+		st.st_mtim.tv_nsec != playlist->mtime.tv_nsec;
+}
+
+static void queue_reload(context_t* this){
+	const char* filename = this->module.context.name;
+
+	if ( this->playlist.loaded && !playlist_stale(&this->playlist, filename) ){
+		return;
+	}
+
+	/* the current playlist is kept if the new one cannot be loaded */
+	playlist_t playlist;
+	if ( playlist_load(&playlist, filename) != 0 ){
+		return;
+	}
+
+	playlist_free(&this->playlist);
+	this->playlist = playlist;
+
+	if ( this->current >= this->playlist.num_records ){
+		this->current = 0;
+	}
+
+	log_verbose("flatfile: loaded %zu slides from `%s'\n", this->playlist.num_records, filename);
+}
+
+static void watch(context_t* this){
+	const char* filename = this->module.context.name;
+	const char* slash = strrchr(filename, '/');
+	this->directory = slash ? strndup(filename, (size_t)(slash - filename) + 1) : strdup("./");
+	this->basename = slash ? slash + 1 : filename;
+
+	/* rename() into place shows up as IN_MOVED_TO */
+	this->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if ( this->inotify_fd == -1 || inotify_add_watch(this->inotify_fd, this->directory, IN_CLOSE_WRITE | IN_MOVED_TO) == -1 ){
+		log_message(Log_Warning, "flatfile: failed to watch `%s' for changes\n", this->directory);
+		if ( this->inotify_fd != -1 ){
+			close(this->inotify_fd);
+		}
+		this->inotify_fd = -1;
+	}
+
+	this->module.change_fd = this->inotify_fd;
+}
+
+static int queue_changed(context_t* this){
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	int touched = 0;
+	ssize_t bytes;
+
+	while ( (bytes = read(this->inotify_fd, buf, sizeof(buf))) > 0 ){
+		for ( char* ptr = buf; ptr < buf + bytes; ){
+			const struct inotify_event* event = (const struct inotify_event*)ptr;
+			if ( event->len > 0 && strcmp(event->name, this->basename) == 0 ){
+				touched = 1;
+			}
+			ptr += sizeof(struct inotify_event) + event->len;
+		}
+	}
+
+	return touched && playlist_stale(&this->playlist, this->module.context.name);
+}
+
+static void queue_dump(context_t* this){
+	const char* data = this->playlist.data;
+
+	log_message(Log_Info, "flatfile: %s (%zu slides):\n", this->module.context.name, this->playlist.num_records);
+	for ( size_t i = 0; i < this->playlist.num_records; i++ ){
+		const record_t* record = &this->playlist.records[i];
+		log_message(Log_Info, "  %c %.*s (%.*s)\n", i < this->current ? '*' : ' ',
+		            (int)record->filename_len, data + record->filename,
+		            (int)record->assembler_len, data + record->assembler);
+	}
+}
+
+/**
+ * Copy the filename (relative to the playlist) and assembler of a record.
+ */
+static slide_context_t record_slide(const context_t* this, const record_t* record){
+	const char* data = this->playlist.data;
+	slide_context_t slide;
+
+	if ( data[record->filename] == '/' ){
+		slide.filename = strndup(data + record->filename, record->filename_len);
+	} else {
+		slide.filename = asprintf2("%s%.*s", this->directory, (int)record->filename_len, data + record->filename);
+	}
+
+	if ( record->assembler_len > 0 ){
+		slide.assembler = strndup(data + record->assembler, record->assembler_len);
+	} else {
+		slide.assembler = strdup("image");
+	}
+
+	return slide;
+}
+
+static int queue_list(context_t* this, slide_visitor visit, void* user){
+	if ( this->inotify_fd == -1 ){
+		queue_reload(this);
+	}
+
+	for ( size_t i = 0; i < this->playlist.num_records; i++ ){
+		slide_context_t slide = record_slide(this, &this->playlist.records[i]);
+		visit(user, slide.filename, slide.assembler);
+		free(slide.filename);
+		free(slide.assembler);
+	}
+
+	return 0;
+}
+
+static slide_context_t next_slide(context_t* this){
+	slide_context_t slide;
+	slide.filename = NULL;
+	slide.assembler = NULL;
+
+	if ( this->current >= this->playlist.num_records ){
+		/* without inotify changes is only picked up when wrapping */
+		if ( this->inotify_fd == -1 ){
+			queue_reload(this);
+		}
+
+		/* empty playlist, don't repeat */
+		if ( this->playlist.num_records == 0 ){
+			return slide;
+		}
+
+		log_debug("queue wrapping\n");
+		this->current = 0;
+	}
+
+	return record_slide(this, &this->playlist.records[this->current++]);
+}
+
+void* module_alloc(){
+	return malloc(sizeof(context_t));
+}
+
+int EXPORT module_init(context_t* this){
+	this->playlist.data = NULL;
+	this->playlist.size = 0;
+	this->playlist.loaded = 0;
+	this->playlist.records = NULL;
+	this->playlist.num_records = 0;
+	this->current = 0;
+	this->directory = NULL;
+	this->basename = NULL;
+	this->inotify_fd = -1;
+
+	/* leaving next_slide unset disables the browser */
+	if ( !this->module.context.name ){
+		log_message(Log_Fatal, "flatfile: no playlist given\n");
+		return -1;
+	}
+
+	this->module.next_slide   = (next_slide_callback)next_slide;
+	this->module.queue_reload = (queue_reload_callback)queue_reload;
+	this->module.queue_dump   = (queue_dump_callback)queue_dump;
+	this->module.queue_changed = (queue_changed_callback)queue_changed;
+	this->module.queue_list   = (queue_list_callback)queue_list;
+
+	watch(this);
+	queue_reload(this);
+
+	return 0;
+}
+
+int EXPORT module_cleanup(context_t* this){
+	playlist_free(&this->playlist);
+
+	if ( this->inotify_fd != -1 ){
+		close(this->inotify_fd);
+	}
+	free(this->directory);
+
+	/* it looks weird, but free_context only releases the fields not the
+	 * pointer itself, so this is safe. */
+	free_context(&this->module.context);
+
+	return 0;
+}
@@ -16,81 +16,221 @@
  * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
 #include "browser.h"
 #include "core/asprintf.h"
-#include "core/curl_local.h"
+#include "core/http.h"
 #include "core/log.h"
 #include <json.h>
 #include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#define FRONTEND_API_VERSION "2"
+#define FRONTEND_WINDOW 8 /* number of slides requested at once (v2) */
 
-#define FRONTEND_API_VERSION "1"
+#define STRINGIFY_(x) #x
+#define STRINGIFY(x) STRINGIFY_(x)
+
+/**
+ * Protocol
+ *
+ * POST /instance/next/CONTEXT with the fields `name`, `version` (highest
+ * supported version) and `window` (number of slides wanted).
+ *
+ * v1 replies with a single slide:
+ *   { "version": 1, "assembler": "...", "slide-id": ID, "filename": "...", "context": CONTEXT }
+ *
+ * v2 replies with a window of upcoming slides, in order, together with the
+ * revision of the queue (incremented by the frontend each time the queue
+ * changes). `context` is the context to request the following window with:
+ *   { "version": 2, "revision": REV, "context": CONTEXT, "slides": [
+ *       { "assembler": "...", "slide-id": ID, "filename": "..." }, ...
+ *   ] }
+ * Requesting a context again (after a reload) must start from the same
+ * position in the (possibly changed) queue.
+ *
+ * An empty `slides` (or in v1 a missing assembler) means no slide could be
+ * fetched (e.g. empty queue).
+ *
+ * Queue listing (used by the local scheduler): POST /instance/list with the
+ * same fields, replies with all slides of the queue (without prefetching):
+ *   { "revision": REV, "slides": [ ... ] }
+ * A 404 means the frontend doesn't support it and slides is shown in the
+ * order given by the frontend.
+ *
+ * Change notification (long-poll): POST /instance/wait/REV with the same
+ * fields. The frontend replies when the queue revision differs from REV (or
+ * after a timeout) with:
+ *   { "revision": REV }
+ * A 404 means the frontend doesn't support it and it is not tried again.
+ */
 
 typedef struct {
 	struct browser_module_t module;
-	void* handle;
 	struct curl_httppost* formpost;
 	int id;
+
+	/* slides received but not yet returned by next_slide (v2) */
+	slide_context_t window[FRONTEND_WINDOW];
+	unsigned int window_begin;
+	unsigned int window_end;
+	int window_context;         /* context the window was requested with */
+	unsigned int window_skip;   /* slides at the start of the next window already returned (see queue_reload) */
+	int revision;
+
+	/* change feed */
+	int change_fd;              /* eventfd signaled when the long-poll finishes */
+	http_request_t* watch;      /* pending long-poll request */
+	int watch_supported;
 } frontend_context_t;
 
 MODULE_INFO("Frontend Browser", BROWSER_MODULE, "David Sveningsson");
 
-static int next_slide_v1(frontend_context_t* this, slide_context_t* slide, struct json_object* data){
+/**
+ * Fill a slide from a json slide object.
+ * @return Non-zero if the object isn't a valid slide.
+ */
+static int parse_slide(frontend_context_t* this, slide_context_t* slide, struct json_object* data, int prefetch){
 	struct json_object* assembler = NULL;
 	struct json_object* slide_id  = NULL;
 	struct json_object* filename  = NULL;
+
+	if ( !json_object_object_get_ex(data, "assembler", &assembler) ){
+		return 1;
+	}
+
+	slide->assembler = strdup(json_object_get_string(assembler));
+
+	if ( strcmp(slide->assembler, "video") != 0 ){
+		if ( !json_object_object_get_ex(data, "slide-id", &slide_id) ){
+			free(slide->assembler);
+			slide->assembler = NULL;
+			return 1;
+		}
+
+		slide->filename = asprintf2("%s/slides/show/%d", this->module.context.host, json_object_get_int(slide_id));
+
+		/* start fetching the image right away, it is picked up when the
+		 * slide is loaded */
+		if ( prefetch ){
+			http_prefetch(slide->filename);
+		}
+	} else {
+		if ( !json_object_object_get_ex(data, "filename", &filename) ){
+			free(slide->assembler);
+			slide->assembler = NULL;
+			return 1;
+		}
+
+		slide->filename = strdup(json_object_get_string(filename));
+	}
+
+	return 0;
+}
+
+static int next_slide_v1(frontend_context_t* this, slide_context_t* slide, struct json_object* data){
 	struct json_object* context   = NULL;
 
 	/* is assembler isn't set, no field can be assumed to be. It means no slide could be fetched (e.g. empty queue). */
-	if ( json_object_object_get_ex(data, "assembler", &assembler) ){
-		slide->assembler = strdup(json_object_get_string(assembler));
-
-		/** @todo add error checking */
-		json_object_object_get_ex(data, "slide-id", &slide_id);
-		json_object_object_get_ex(data, "filename", &filename);
-		json_object_object_get_ex(data, "context", &context);
-
-		if ( strcmp(slide->assembler, "video") != 0 ){
-			slide->filename = asprintf2("%s/slides/show/%d", this->module.context.host, json_object_get_int(slide_id));
-		} else {
-			slide->filename = strdup(json_object_get_string(filename));
+	if ( parse_slide(this, slide, data, 1) == 0 ){
+		if ( json_object_object_get_ex(data, "context", &context) ){
+			this->id = json_object_get_int(context);
 		}
+	}
+
+	return 0;
+}
 
+static int next_slide_v2(frontend_context_t* this, struct json_object* data, int requested){
+	struct json_object* revision = NULL;
+	struct json_object* context  = NULL;
+	struct json_object* slides   = NULL;
+
+	if ( !json_object_object_get_ex(data, "slides", &slides) || !json_object_is_type(slides, json_type_array) ){
+		return 1;
+	}
+
+	if ( json_object_object_get_ex(data, "revision", &revision) ){
+		const int rev = json_object_get_int(revision);
+		if ( rev != this->revision ){
+			log_verbose("frontend: queue revision %d\n", rev);
+			this->revision = rev;
+		}
+	}
+
+	if ( json_object_object_get_ex(data, "context", &context) ){
 		this->id = json_object_get_int(context);
 	}
 
+	this->window_begin = 0;
+	this->window_end = 0;
+	this->window_context = requested;
+
+	/* after a reload the window is requested again from the same context,
+	 * skip the slides already returned */
+	const int skip = (int)this->window_skip;
+	this->window_skip = 0;
+
+	const int n = (int)json_object_array_length(slides);
+	for ( int i = skip; i < n && this->window_end < FRONTEND_WINDOW; i++ ){
+		slide_context_t* slide = &this->window[this->window_end];
+		slide->filename = NULL;
+		slide->assembler = NULL;
+
+		if ( parse_slide(this, slide, json_object_array_get_idx(slides, i), 1) != 0 ){
+			log_message(Log_Warning, "frontend: ignoring invalid slide at index %d\n", i);
+			continue;
+		}
+
+		this->window_end++;
+	}
+
 	return 0;
 }
 
-static slide_context_t next_slide(frontend_context_t* this){
-	slide_context_t slide;
-	slide.filename = NULL;
-	slide.assembler = NULL;
-
-	struct MemoryStruct chunk;
-	long response;
+/**
+ * Release all slides left in the window.
+ */
+static void window_clear(frontend_context_t* this){
+	for ( unsigned int i = this->window_begin; i < this->window_end; i++ ){
+		free(this->window[i].filename);
+		free(this->window[i].assembler);
+	}
 
-	chunk.memory = (char*)malloc(1);  /* will be grown as needed by the realloc above */
-	chunk.size = 0;    /* no data at this point */
+	this->window_begin = 0;
+	this->window_end = 0;
+}
 
-	char* url = asprintf2("%s/instance/next/%d", this->module.context.host, this->id);
-	curl_easy_setopt(this->handle, CURLOPT_URL, url);
+/**
+ * Request the next slide (v1) or window of slides (v2) from the frontend.
+ */
+static void request(frontend_context_t* this, slide_context_t* slide){
+	char* body = NULL;
+	const int context = this->id;
+	char* url = asprintf2("%s/instance/next/%d", this->module.context.host, context);
+	http_request_t* request = http_fetch(url, this->formpost);
+	const long response = request ? http_wait(request, &body, NULL) : -1;
 	free(url);
 
-	curl_easy_setopt(this->handle, CURLOPT_WRITEDATA, (void *)&chunk);
-	curl_easy_perform(this->handle);
-	curl_easy_getinfo(this->handle, CURLINFO_RESPONSE_CODE, &response);
-
 	if ( response != 200 ){ /* HTTP OK */
 		log_message(Log_Warning, "Server replied with code %ld\n", response);
-		return slide;
+		free(body);
+		return;
 	}
 
 	/* parse */
-	json_object* data = json_tokener_parse(chunk.memory);
+	json_object* data = json_tokener_parse(body);
 	if ( !data ){
-		log_message(Log_Warning, "Failed to parse server reply: %s\n", json_object_to_json_string(data));
-		return slide;
+		log_message(Log_Warning, "Failed to parse server reply: %s\n", body);
+		free(body);
+		return;
 	}
+	free(body);
 
 	int version = -1;
 	struct json_object* tmp;
@@ -98,35 +238,172 @@ static slide_context_t next_slide(frontend_context_t* this){
 		version = json_object_get_int(tmp);
 	}
 
-	int ret;
+	int ret = 0;
 	switch ( version ){
 	case 1:
-		ret = next_slide_v1(this, &slide, data);
+		ret = next_slide_v1(this, slide, data);
+		break;
+	case 2:
+		ret = next_slide_v2(this, data, context);
 		break;
 	case -1:
 		log_message(Log_Warning, "frontend did not reply with a version %d\n", version);
-		return slide;
+		break;
 	default:
 		log_message(Log_Warning, "frontend replied with unsuppored version %d\n", version);
-		return slide;
+		break;
 	}
 
 	if ( ret != 0 ){
 		log_message(Log_Warning, "frontend failed to parse reply (ret %d)\n", ret);
 	}
 
+	json_object_put(data);
+}
+
+static int queue_list(frontend_context_t* this, slide_visitor visit, void* user){
+	char* body = NULL;
+	char* url = asprintf2("%s/instance/list", this->module.context.host);
+	http_request_t* request = http_fetch(url, this->formpost);
+	const long response = request ? http_wait(request, &body, NULL) : -1;
+	free(url);
+
+	if ( response == 404 ){
+		log_message(Log_Warning, "frontend does not support listing the queue\n");
+		this->module.queue_list = NULL;
+		free(body);
+		return 1;
+	}
+
+	if ( response != 200 ){ /* HTTP OK */
+		log_message(Log_Warning, "Server replied with code %ld\n", response);
+		free(body);
+		return 1;
+	}
+
+	json_object* data = json_tokener_parse(body);
+	struct json_object* slides = NULL;
+	if ( !data || !json_object_object_get_ex(data, "slides", &slides) || !json_object_is_type(slides, json_type_array) ){
+		log_message(Log_Warning, "Failed to parse server reply: %s\n", body);
+		json_object_put(data);
+		free(body);
+		return 1;
+	}
+	free(body);
+
+	const int n = (int)json_object_array_length(slides);
+	for ( int i = 0; i < n; i++ ){
+		slide_context_t slide = {NULL, NULL};
+		if ( parse_slide(this, &slide, json_object_array_get_idx(slides, i), 0) != 0 ){
+			log_message(Log_Warning, "frontend: ignoring invalid slide at index %d\n", i);
+			continue;
+		}
+
+		visit(user, slide.filename, slide.assembler);
+		free(slide.filename);
+		free(slide.assembler);
+	}
+
+	json_object_put(data);
+	return 0;
+}
+
+/**
+ * Start a long-poll request for queue changes (unless one is already pending).
+ */
+static void watch_start(frontend_context_t* this){
+	if ( this->watch || this->change_fd == -1 || !this->watch_supported ){
+		return;
+	}
+
+	char* url = asprintf2("%s/instance/wait/%d", this->module.context.host, this->revision);
+	this->watch = http_fetch_notify(url, this->formpost, this->change_fd);
+	free(url);
+}
+
+static int queue_changed(frontend_context_t* this){
+	uint64_t value;
+	if ( read(this->change_fd, &value, sizeof(value)) != sizeof(value) ){
+		return 0;
+	}
+
+	if ( !this->watch || !http_done(this->watch) ){
+		return 0;
+	}
+
+	char* body = NULL;
+	const long response = http_wait(this->watch, &body, NULL);
+	this->watch = NULL;
+
+	if ( response == 404 ){
+		log_verbose("frontend does not support change notification\n");
+		this->watch_supported = 0;
+		free(body);
+		return 0;
+	}
+
+	if ( response != 200 ){
+		/* retried by next_slide */
+		free(body);
+		return 0;
+	}
+
+	int changed = 0;
+	json_object* data = json_tokener_parse(body);
+	struct json_object* revision;
+	if ( data && json_object_object_get_ex(data, "revision", &revision) ){
+		const int rev = json_object_get_int(revision);
+		changed = this->revision != -1 && rev != this->revision;
+		this->revision = rev;
+	}
+
+	json_object_put(data);
+	free(body);
+
+	watch_start(this);
+	return changed;
+}
+
+static slide_context_t next_slide(frontend_context_t* this){
+	slide_context_t slide;
+	slide.filename = NULL;
+	slide.assembler = NULL;
+
+	/* only ask the frontend when the window is exhausted */
+	if ( this->window_begin == this->window_end ){
+		request(this, &slide);
+	}
+
+	if ( this->window_begin < this->window_end ){
+		slide = this->window[this->window_begin++];
+	}
+
+	watch_start(this);
 	return slide;
 }
 
 static void queue_reload(frontend_context_t* this){
+	/* the window might be stale, request it again from where it started
+	 * (skipping the slides already returned) so the remaining slides isn't
+	 * lost */
+	if ( this->window_begin < this->window_end ){
+		this->id = this->window_context;
+		this->window_skip = this->window_begin;
+	}
 
+	window_clear(this);
 }
 
 static void queue_dump(frontend_context_t* this){
-
+	log_message(Log_Info, "frontend: queue revision %d, %u slide(s) buffered:\n", this->revision, this->window_end - this->window_begin);
+	for ( unsigned int i = this->window_begin; i < this->window_end; i++ ){
+		log_message(Log_Info, "  %s (%s)\n", this->window[i].filename, this->window[i].assembler);
+	}
 }
 
 static int queue_set(frontend_context_t* this, unsigned int id){
+	window_clear(this);
+	this->window_skip = 0;
 	return 0;
 }
 
@@ -141,17 +418,26 @@ int EXPORT module_init(frontend_context_t* this){
 	this->module.queue_reload = (queue_reload_callback)queue_reload;
 	this->module.queue_dump   = (queue_dump_callback)queue_dump;
 	this->module.queue_set    = (queue_set_callback)queue_set;
+	this->module.queue_changed = (queue_changed_callback)queue_changed;
+	this->module.queue_list   = (queue_list_callback)queue_list;
 
 	/* initialize variables */
-	this->handle = curl_easy_init();
 	this->formpost = 0;
 	this->id = -1;
+	this->window_begin = 0;
+	this->window_end = 0;
+	this->window_context = -1;
+	this->window_skip = 0;
+	this->revision = -1;
+	this->change_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	this->watch = NULL;
+	this->watch_supported = 1;
+	this->module.change_fd = this->change_fd;
 
 	struct curl_httppost *lastptr = 0;
 	curl_formadd(&this->formpost, &lastptr, CURLFORM_COPYNAME, "name", CURLFORM_COPYCONTENTS, this->module.context.name, CURLFORM_END);
 	curl_formadd(&this->formpost, &lastptr, CURLFORM_COPYNAME, "version", CURLFORM_COPYCONTENTS, FRONTEND_API_VERSION, CURLFORM_END);
-	curl_easy_setopt(this->handle, CURLOPT_HTTPPOST, this->formpost);
-	curl_easy_setopt(this->handle, CURLOPT_WRITEFUNCTION, curl_local_resize);
+	curl_formadd(&this->formpost, &lastptr, CURLFORM_COPYNAME, "window", CURLFORM_COPYCONTENTS, STRINGIFY(FRONTEND_WINDOW), CURLFORM_END);
 
 	return 0;
 }
@@ -160,8 +446,13 @@ int EXPORT module_cleanup(frontend_context_t* this){
 	/* it looks weird, but free_context only releases the fields not the
 	 * pointer itself, so this is safe. */
 	free_context(&this->module.context);
+	window_clear(this);
+
+	http_cancel(this->watch);
+	if ( this->change_fd != -1 ){
+		close(this->change_fd);
+	}
 
-	curl_easy_cleanup(this->handle);
 	curl_formfree(this->formpost);
 
 	return 0;
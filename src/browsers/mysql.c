@@ -16,10 +16,28 @@
  * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
 #include "browser.h"
 #include "core/log.h"
 #include <string.h>
+#include <time.h>
 #include <mysql/mysql.h>
+#include <mysql/errmsg.h>
+
+#define BACKOFF_MIN 1.0   /* seconds */
+#define BACKOFF_MAX 60.0
+#define CONNECT_TIMEOUT 5 /* seconds, a blackholed host must not stall the loader */
+#define IO_TIMEOUT 10
+
+typedef struct {
+	int id;
+	int sortorder;
+	char* path;
+	char* assembler;
+} cached_slide_t;
 
 typedef struct {
 	struct browser_module_t module;
@@ -29,17 +47,99 @@ typedef struct {
 	int prev_slide_id;
 
 	MYSQL* conn;
+	int connected;
+	double next_attempt;      /* when to try reconnecting (monotonic seconds) */
+	double backoff;           /* current reconnect delay */
 
 	MYSQL_STMT* stmt_slide;
 	MYSQL_STMT* stmt_looping;
 	MYSQL_STMT* stmt_pop;
+	MYSQL_STMT* stmt_queue;
+
+	/* parameter and result buffers, bound once when the statements is
+	 * prepared and reused for each execution */
+	int pop_id;
+	int row_id;
+	char row_path[4096];
+	int row_sortorder;
+	int row_queue_id;
+	char row_assembler[128];
+	MYSQL_BIND slide_param[2];
+	MYSQL_BIND slide_result[5];
+	MYSQL_BIND looping_param[1];
+	MYSQL_BIND looping_result[1];
+	MYSQL_BIND pop_param[1];
+	MYSQL_BIND queue_param[1];
+	MYSQL_BIND queue_result[4];
+
+	/* copy of the last good queue, served while the database is unreachable */
+	cached_slide_t* cache;
+	size_t cache_size;
 } my;
 
 MODULE_INFO("MySQL Browser", BROWSER_MODULE, "David Sveningsson");
 
 static int pop_intermediate(my* this, int id);
+static int load_looping(my* this);
+static int load_cache(my* this);
 
-static MYSQL_STMT* prepare(MYSQL* conn, const char* query){
+static double monotonic(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void bind_long(MYSQL_BIND* bind, void* buffer, int is_unsigned){
+	bind->buffer_type = MYSQL_TYPE_LONG;
+	bind->buffer      = buffer;
+	bind->is_unsigned = is_unsigned != 0;
+}
+
+static void bind_string(MYSQL_BIND* bind, char* buffer, size_t size){
+	/* the last byte is never written so truncated values (MYSQL_DATA_TRUNCATED)
+	 * is still terminated */
+	bind->buffer_type   = MYSQL_TYPE_STRING;
+	bind->buffer        = buffer;
+	bind->buffer_length = size - 1;
+	buffer[size - 1] = 0;
+}
+
+/**
+ * Setup the bind arrays, only pointers to fields in this is stored so it is
+ * only needed once.
+ */
+static void setup_binds(my* this){
+	memset(this->slide_param, 0, sizeof(this->slide_param));
+	bind_long(&this->slide_param[0], &this->queue_id, 1);
+	bind_long(&this->slide_param[1], &this->prev_slide_id, 0);
+
+	memset(this->slide_result, 0, sizeof(this->slide_result));
+	bind_long  (&this->slide_result[0], &this->row_id, 0);
+	bind_string(&this->slide_result[1], this->row_path, sizeof(this->row_path));
+	bind_long  (&this->slide_result[2], &this->row_sortorder, 0);
+	bind_long  (&this->slide_result[3], &this->row_queue_id, 0);
+	bind_string(&this->slide_result[4], this->row_assembler, sizeof(this->row_assembler));
+
+	memset(this->looping_param, 0, sizeof(this->looping_param));
+	bind_long(&this->looping_param[0], &this->queue_id, 1);
+
+	memset(this->looping_result, 0, sizeof(this->looping_result));
+	bind_long(&this->looping_result[0], &this->loop_queue, 0);
+
+	memset(this->pop_param, 0, sizeof(this->pop_param));
+	bind_long(&this->pop_param[0], &this->pop_id, 1);
+
+	memset(this->queue_param, 0, sizeof(this->queue_param));
+	bind_long(&this->queue_param[0], &this->queue_id, 1);
+
+	memset(this->queue_result, 0, sizeof(this->queue_result));
+	bind_long  (&this->queue_result[0], &this->row_id, 0);
+	bind_string(&this->queue_result[1], this->row_path, sizeof(this->row_path));
+	bind_long  (&this->queue_result[2], &this->row_sortorder, 0);
+	bind_string(&this->queue_result[3], this->row_assembler, sizeof(this->row_assembler));
+}
+
+static MYSQL_STMT* prepare(MYSQL* conn, const char* query, MYSQL_BIND* param, MYSQL_BIND* result){
 	MYSQL_STMT* stmt = mysql_stmt_init(conn);
 	if ( !stmt ){
 		log_message(Log_Fatal, "mysql_stmt_init failed (out of memory?)\n");
@@ -52,15 +152,49 @@ static MYSQL_STMT* prepare(MYSQL* conn, const char* query){
 		return NULL;
 	}
 
+	if ( (param && mysql_stmt_bind_param(stmt, param) != 0) || (result && mysql_stmt_bind_result(stmt, result) != 0) ){
+		log_message(Log_Fatal, "mysql_stmt_bind failed: %s\n", mysql_stmt_error(stmt));
+		mysql_stmt_close(stmt);
+		return NULL;
+	}
+
 	return stmt;
 }
 
-static int connect(my* this){
+static void disconnect(my* this){
+	if ( this->stmt_queue ) mysql_stmt_close(this->stmt_queue);
+	if ( this->stmt_pop ) mysql_stmt_close(this->stmt_pop);
+	if ( this->stmt_looping ) mysql_stmt_close(this->stmt_looping);
+	if ( this->stmt_slide ) mysql_stmt_close(this->stmt_slide);
+	if ( this->conn ) mysql_close(this->conn);
+
+	this->stmt_queue = NULL;
+	this->stmt_pop = NULL;
+	this->stmt_looping = NULL;
+	this->stmt_slide = NULL;
+	this->conn = NULL;
+	this->connected = 0;
+}
+
+/**
+ * @param retry Set when reconnecting, failures is expected and only warned
+ *              about.
+ */
+static int connect(my* this, int retry){
 	this->conn = mysql_init(NULL);
 
+	/* connecting is done from next_slide (with the browser lock held) so it
+	 * must fail fast on flaky links */
+	const unsigned int connect_timeout = CONNECT_TIMEOUT;
+	const unsigned int io_timeout = IO_TIMEOUT;
+	mysql_options(this->conn, MYSQL_OPT_CONNECT_TIMEOUT, &connect_timeout);
+	mysql_options(this->conn, MYSQL_OPT_READ_TIMEOUT, &io_timeout);
+	mysql_options(this->conn, MYSQL_OPT_WRITE_TIMEOUT, &io_timeout);
+
 	const browser_context_t* ctx = &this->module.context;
 	if (!mysql_real_connect(this->conn, ctx->host, ctx->user, ctx->pass, ctx->name, 0, NULL, 0)) {
-		log_message(Log_Fatal, "mysql_real_connect could not connect to database: %s\n", mysql_error(this->conn));
+		log_message(retry ? Log_Warning : Log_Fatal, "mysql_real_connect could not connect to database: %s\n", mysql_error(this->conn));
+		disconnect(this);
 		return 1;
 	}
 
@@ -91,92 +225,210 @@ static int connect(my* this){
 		        "ORDER BY"
 		        "	queue_id, "
 		        "	sortorder "
-		        "LIMIT 1");
+		        "LIMIT 1", this->slide_param, this->slide_result);
 
-	this->stmt_looping = prepare(this->conn, "SELECT `loop` FROM `queue` WHERE `id` = ? LIMIT 1");
-	this->stmt_pop = prepare(this->conn, "UPDATE `slide` SET `queue_id` = 0 WHERE `id` = ?");
-	if ( !(this->stmt_slide && this->stmt_looping && this->stmt_pop) ){
+	this->stmt_looping = prepare(this->conn, "SELECT `loop` FROM `queue` WHERE `id` = ? LIMIT 1", this->looping_param, this->looping_result);
+	this->stmt_pop = prepare(this->conn, "UPDATE `slide` SET `queue_id` = 0 WHERE `id` = ?", this->pop_param, NULL);
+	this->stmt_queue = prepare(this->conn, "SELECT `id`, `path`, `sortorder`, `assembler` FROM `slide` WHERE `queue_id` = ? ORDER BY `sortorder`", this->queue_param, this->queue_result);
+	if ( !(this->stmt_slide && this->stmt_looping && this->stmt_pop && this->stmt_queue) ){
+		disconnect(this);
 		return 1;
 	}
 
+	this->connected = 1;
+	this->backoff = BACKOFF_MIN;
 	return 0;
 }
 
-static slide_context_t next_slide(my* this){
+/**
+ * Check if an error means the connection is gone.
+ */
+static int connection_lost(MYSQL_STMT* stmt){
+	switch ( mysql_stmt_errno(stmt) ){
+	case CR_SERVER_GONE_ERROR:
+	case CR_SERVER_LOST:
+	case CR_CONNECTION_ERROR:
+	case CR_CONN_HOST_ERROR:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Log a failed statement and drop the connection if it was lost.
+ */
+static void stmt_error(my* this, MYSQL_STMT* stmt, const char* func){
+	log_message(Log_Warning, "%s failed: %s\n", func, mysql_stmt_error(stmt));
+
+	if ( connection_lost(stmt) ){
+		log_message(Log_Warning, "Connection to database lost, serving cached queue\n");
+		disconnect(this);
+		this->next_attempt = monotonic() + this->backoff;
+	}
+}
+
+/**
+ * Make sure there is a connection, reconnecting (and preparing the statements
+ * again) with exponential backoff.
+ *
+ * @return Non-zero if connected.
+ */
+static int ensure_connected(my* this){
+	if ( this->connected ){
+		return 1;
+	}
+
+	const double now = monotonic();
+	if ( now < this->next_attempt ){
+		return 0;
+	}
+
+	if ( connect(this, 1) != 0 ){
+		this->next_attempt = now + this->backoff;
+		log_message(Log_Info, "Reconnecting to database in %.0fs\n", this->backoff);
+		this->backoff = this->backoff * 2.0 < BACKOFF_MAX ? this->backoff * 2.0 : BACKOFF_MAX;
+		return 0;
+	}
+
+	log_message(Log_Info, "Reconnected to database\n");
+	load_looping(this);
+	load_cache(this);
+	return this->connected;
+}
+
+static void free_cache(my* this){
+	for ( size_t i = 0; i < this->cache_size; i++ ){
+		free(this->cache[i].path);
+		free(this->cache[i].assembler);
+	}
+	free(this->cache);
+	this->cache = NULL;
+	this->cache_size = 0;
+}
+
+/**
+ * Copy the regular queue to the cache.
+ */
+static int load_cache(my* this){
+	if ( mysql_stmt_execute(this->stmt_queue) != 0 ){
+		stmt_error(this, this->stmt_queue, "mysql_stmt_execute");
+		return 1;
+	}
+
+	/* buffer all rows so the size is known */
+	if ( mysql_stmt_store_result(this->stmt_queue) != 0 ){
+		stmt_error(this, this->stmt_queue, "mysql_stmt_store_result");
+		return 1;
+	}
+
+	const size_t rows = (size_t)mysql_stmt_num_rows(this->stmt_queue);
+	cached_slide_t* cache = malloc((rows > 0 ? rows : 1) * sizeof(cached_slide_t));
+	size_t n = 0;
+	if ( !cache ){
+		mysql_stmt_free_result(this->stmt_queue);
+		return 1;
+	}
+
+	int ret;
+	while ( n < rows && ((ret = mysql_stmt_fetch(this->stmt_queue)) == 0 || ret == MYSQL_DATA_TRUNCATED) ){
+		if ( ret == MYSQL_DATA_TRUNCATED ){
+			log_message(Log_Warning, "slide %d: path or assembler too long, not cached\n", this->row_id);
+			continue;
+		}
+
+		cache[n].id        = this->row_id;
+		cache[n].sortorder = this->row_sortorder;
+		cache[n].path      = strdup(this->row_path);
+		cache[n].assembler = strdup(this->row_assembler);
+		n++;
+	}
+
+	mysql_stmt_free_result(this->stmt_queue);
+
+	free_cache(this);
+	this->cache = cache;
+	this->cache_size = n;
+
+	log_debug("cached %zu slide(s) of queue %u\n", n, this->queue_id);
+	return 0;
+}
+
+/**
+ * Serve the next slide from the cache (used when the database is unreachable).
+ */
+static slide_context_t next_cached(my* this){
 	slide_context_t slide;
 	slide.filename = NULL;
 	slide.assembler = NULL;
 
-	MYSQL_BIND param[2];
-	memset(param, 0, sizeof(param));
-	param[0].buffer_type    = MYSQL_TYPE_LONG;
-	param[0].buffer         = (void *)&this->queue_id;
-	param[0].is_unsigned    = 1;
-	param[0].is_null        = 0;
-	param[0].length         = 0;
-	param[1].buffer_type    = MYSQL_TYPE_LONG;
-	param[1].buffer         = (void *)&this->prev_slide_id;
-	param[1].is_unsigned    = 0;
-	param[1].is_null        = 0;
-	param[1].length         = 0;
-
-	if ( mysql_stmt_bind_param(this->stmt_slide, param) != 0 ){
-		log_message(Log_Warning, "mysql_stmt_bind_param failed: %s\n", mysql_stmt_error(this->stmt_slide));
-		return slide;
+	const cached_slide_t* entry = NULL;
+	for ( size_t i = 0; i < this->cache_size; i++ ){
+		if ( this->cache[i].sortorder > this->prev_slide_id ){
+			entry = &this->cache[i];
+			break;
+		}
 	}
 
-	if ( mysql_stmt_execute(this->stmt_slide) != 0 ){
-		log_message(Log_Warning, "mysql_stmt_execute failed: %s\n", mysql_stmt_error(this->stmt_slide));
-		return slide;
+	if ( !entry && this->loop_queue && this->cache_size > 0 ){
+		entry = &this->cache[0];
 	}
 
-	int id;
-	char path[4096] = {0,};
-	int sort_order;
-	int queue_id;
-	char assembler[128] = {0,};
-
-	MYSQL_BIND result[5];
-	memset(result, 0, sizeof(result));
-	result[0].buffer_type    = MYSQL_TYPE_LONG;
-	result[0].buffer         = (void *)&id;
-	result[1].buffer_type    = MYSQL_TYPE_STRING;
-	result[1].buffer         = (void *)path;
-	result[1].buffer_length  = sizeof(path);
-	result[2].buffer_type    = MYSQL_TYPE_LONG;
-	result[2].buffer         = (void *)&sort_order;
-	result[3].buffer_type    = MYSQL_TYPE_LONG;
-	result[3].buffer         = (void *)&queue_id;
-	result[4].buffer_type    = MYSQL_TYPE_STRING;
-	result[4].buffer         = (void *)assembler;
-	result[4].buffer_length  = sizeof(assembler);
-
-	if ( mysql_stmt_bind_result(this->stmt_slide, result) != 0 ){
-		log_message(Log_Warning, "mysql_stmt_bind_result failed: %s\n", mysql_stmt_error(this->stmt_slide));
+	if ( !entry ){
 		return slide;
 	}
 
+	this->prev_slide_id = entry->sortorder;
+	slide.filename = strdup(entry->path);
+	slide.assembler = strdup(entry->assembler);
+
+	log_message(Log_Info, "slide: %s (cached)\n", slide.filename);
+	return slide;
+}
+
+static slide_context_t next_slide(my* this){
+	slide_context_t slide;
+	slide.filename = NULL;
+	slide.assembler = NULL;
+
+	if ( !ensure_connected(this) ){
+		return next_cached(this);
+	}
+
+	this->row_path[0] = 0;
+	this->row_assembler[0] = 0;
+
+	if ( mysql_stmt_execute(this->stmt_slide) != 0 ){
+		stmt_error(this, this->stmt_slide, "mysql_stmt_execute");
+		return this->connected ? slide : next_cached(this);
+	}
+
 	int ret;
 	switch ( (ret=mysql_stmt_fetch(this->stmt_slide)) ){
 	case 0: /* row */
+	case MYSQL_DATA_TRUNCATED:
 		mysql_stmt_free_result(this->stmt_slide);
 
-		slide.filename = strdup(path);
-		slide.assembler = strdup(assembler);
+		if ( ret == MYSQL_DATA_TRUNCATED ){
+			log_message(Log_Warning, "slide %d: path or assembler too long, truncated\n", this->row_id);
+		}
+
+		slide.filename = strdup(this->row_path);
+		slide.assembler = strdup(this->row_assembler);
 
 		log_message(Log_Info, "slide: %s\n", slide.filename);
-		log_message(Log_Debug, "\tid: %d\n", id);
-		log_message(Log_Debug, "\tsort_order: %d\n", sort_order);
-		log_message(Log_Debug, "\tqueue_id: %d\n", queue_id);
-		log_message(Log_Debug, "\tassembler: %s\n", slide.assembler);
+		log_debug("\tid: %d\n", this->row_id);
+		log_debug("\tsort_order: %d\n", this->row_sortorder);
+		log_debug("\tqueue_id: %d\n", this->row_queue_id);
+		log_debug("\tassembler: %s\n", slide.assembler);
 
 		/* only update id if it comes from a regular queue, i.e., not from intermediate queue. */
-		if ( queue_id > 0 ){
-			this->prev_slide_id = sort_order;
+		if ( this->row_queue_id > 0 ){
+			this->prev_slide_id = this->row_sortorder;
 		} else {
 			/* pop intermediate slides back to unsorted */
-			log_message(Log_Debug, "popping intermediate slide\n");
-			pop_intermediate(this, id);
+			log_debug("popping intermediate slide\n");
+			pop_intermediate(this, this->row_id);
 		}
 
 		return slide;
@@ -186,46 +438,83 @@ static slide_context_t next_slide(my* this){
 
 		/* empty queue */
 		if ( this->prev_slide_id == -1 ){
-			log_message(Log_Debug, "queue empty and prev_id is -1\n");
-			log_message(Log_Debug, "\tqueue_id: %d\n", this->queue_id);
+			log_debug("queue empty and prev_id is -1\n");
+			log_debug("\tqueue_id: %d\n", this->queue_id);
 			return slide;
 		}
 
 		if ( !this->loop_queue ){
 			log_message(Log_Info, "Queue finished and looping is diabled\n");
-			log_message(Log_Debug, "\tqueue_id: %d\n", this->queue_id);
+			log_debug("\tqueue_id: %d\n", this->queue_id);
 			return slide;
 		}
 
-		log_message(Log_Debug, "queue wrapping\n");
+		log_debug("queue wrapping\n");
 		this->prev_slide_id = -1;
 
 		return next_slide(this);
 
 	case 1: /* error */
 	default:
-		log_message(Log_Warning, "mysql_stmt_fetch failed: %s\n", mysql_stmt_error(this->stmt_slide));
-		log_message(Log_Debug, "\tqueue_id: %d\n", this->queue_id);
-		log_message(Log_Debug, "\told_id: %d\n", this->prev_slide_id);
+		log_debug("\tqueue_id: %d\n", this->queue_id);
+		log_debug("\told_id: %d\n", this->prev_slide_id);
 		mysql_stmt_free_result(this->stmt_slide);
+		stmt_error(this, this->stmt_slide, "mysql_stmt_fetch");
+		return this->connected ? slide : next_cached(this);
+	}
+}
+
+static slide_context_t next_intermediate(my* this){
+	slide_context_t slide;
+	slide.filename = NULL;
+	slide.assembler = NULL;
+
+	if ( !ensure_connected(this) ){
 		return slide;
 	}
+
+	if ( mysql_stmt_execute(this->stmt_slide) != 0 ){
+		stmt_error(this, this->stmt_slide, "mysql_stmt_execute");
+		return slide;
+	}
+
+	/* intermediate slides is sorted first, a regular slide means there is none */
+	const int ret = mysql_stmt_fetch(this->stmt_slide);
+	mysql_stmt_free_result(this->stmt_slide);
+	if ( (ret != 0 && ret != MYSQL_DATA_TRUNCATED) || this->row_queue_id > 0 ){
+		return slide;
+	}
+
+	slide.filename = strdup(this->row_path);
+	slide.assembler = strdup(this->row_assembler);
+
+	log_message(Log_Info, "slide: %s (intermediate)\n", slide.filename);
+	pop_intermediate(this, this->row_id);
+	return slide;
 }
 
-static int pop_intermediate(my* this, int id){
-	MYSQL_BIND param[1];
-	memset(param, 0, sizeof(param));
-	param[0].buffer_type    = MYSQL_TYPE_LONG;
-	param[0].buffer         = (void *)&id;
-	param[0].is_unsigned    = 1;
-
-	if ( mysql_stmt_bind_param(this->stmt_pop, param) != 0 ){
-		log_message(Log_Warning, "mysql_stmt_bind_param failed: %s\n", mysql_stmt_error(this->stmt_pop));
+static int queue_list(my* this, slide_visitor visit, void* user){
+	/* the cached copy is used when the database is unreachable */
+	if ( ensure_connected(this) ){
+		load_cache(this);
+	}
+
+	if ( !this->connected && this->cache_size == 0 ){
 		return 1;
 	}
 
+	for ( size_t i = 0; i < this->cache_size; i++ ){
+		visit(user, this->cache[i].path, this->cache[i].assembler);
+	}
+
+	return 0;
+}
+
+static int pop_intermediate(my* this, int id){
+	this->pop_id = id;
+
 	if ( mysql_stmt_execute(this->stmt_pop) != 0 ){
-		log_message(Log_Warning, "mysql_stmt_execute failed: %s\n", mysql_stmt_error(this->stmt_pop));
+		stmt_error(this, this->stmt_pop, "mysql_stmt_execute");
 		return 1;
 	}
 
@@ -233,52 +522,51 @@ static int pop_intermediate(my* this, int id){
 }
 
 static int queue_reload(my* this){
+	if ( !ensure_connected(this) ){
+		return 1;
+	}
+
+	return load_cache(this);
+}
+
+/**
+ * Query whenever the current queue is looping.
+ */
+static int load_looping(my* this){
+	if ( mysql_stmt_execute(this->stmt_looping) != 0 ){
+		stmt_error(this, this->stmt_looping, "mysql_stmt_execute");
+		return 1;
+	}
+
+	if ( mysql_stmt_fetch(this->stmt_looping) != 0 ){
+		log_message(Log_Warning, "mysql_stmt_fetch failed: %s\n", mysql_stmt_error(this->stmt_looping));
+	}
+
+	mysql_stmt_free_result(this->stmt_looping);
+	log_debug("queue %d is%s looping\n", this->queue_id, this->loop_queue ? "" : " not");
 	return 0;
 }
 
 static int queue_set(my* this, unsigned int id){
-	log_message(Log_Debug, "queue_set(%d)\n", id);
+	log_debug("queue_set(%d)\n", id);
 
 	/* if we change queue we reset the position back to the start */
 	if ( this->queue_id != id ){
 		this->prev_slide_id = -1;
+		free_cache(this);
 	}
 
 	this->queue_id = id;
 
-	MYSQL_BIND param[1];
-	memset(param, 0, sizeof(param));
-	param[0].buffer_type    = MYSQL_TYPE_LONG;
-	param[0].buffer         = (void *)&this->queue_id;
-	param[0].is_unsigned    = 1;
-
-	if ( mysql_stmt_bind_param(this->stmt_looping, param) != 0 ){
-		log_message(Log_Warning, "mysql_stmt_bind_param failed: %s\n", mysql_stmt_error(this->stmt_looping));
+	if ( !ensure_connected(this) ){
 		return 1;
 	}
 
-	if ( mysql_stmt_execute(this->stmt_looping) != 0 ){
-		log_message(Log_Warning, "mysql_stmt_execute failed: %s\n", mysql_stmt_error(this->stmt_looping));
+	if ( load_looping(this) != 0 ){
 		return 1;
 	}
 
-	MYSQL_BIND result[1];
-	memset(result, 0, sizeof(result));
-	result[0].buffer_type    = MYSQL_TYPE_LONG;
-	result[0].buffer         = (void *)&this->loop_queue;
-
-	if ( mysql_stmt_bind_result(this->stmt_looping, result) != 0 ){
-		log_message(Log_Warning, "mysql_stmt_bind_result failed: %s\n", mysql_stmt_error(this->stmt_looping));
-		return 1;
-	}
-
-	if ( mysql_stmt_fetch(this->stmt_looping) != 0 ){
-		log_message(Log_Warning, "mysql_stmt_fetch failed: %s\n", mysql_stmt_error(this->stmt_looping));
-	}
-
-	mysql_stmt_free_result(this->stmt_looping);
-	log_message(Log_Debug, "queue %d is%s looping\n", this->queue_id, this->loop_queue ? "" : " not");
-	return 0;
+	return load_cache(this);
 }
 
 void* module_alloc(){
@@ -292,17 +580,26 @@ int EXPORT module_init(my* this){
 	this->module.queue_reload = (queue_reload_callback)queue_reload;
 	//this->module.queue_dump   = (queue_dump_callback)queue_dump;
 	this->module.queue_set    = (queue_set_callback)queue_set;
+	this->module.queue_list   = (queue_list_callback)queue_list;
+	this->module.next_intermediate = (next_intermediate_callback)next_intermediate;
 
 	/* initialize variables */
 	this->loop_queue = 1;
 	this->queue_id = 0;
 	this->prev_slide_id = -1;
 	this->conn = 0;
+	this->connected = 0;
+	this->next_attempt = 0.0;
+	this->backoff = BACKOFF_MIN;
 	this->stmt_slide  = 0;
 	this->stmt_looping  = 0;
 	this->stmt_pop = 0;
+	this->stmt_queue = 0;
+	this->cache = NULL;
+	this->cache_size = 0;
+	setup_binds(this);
 
-	return connect(this);
+	return connect(this, 0);
 }
 
 int EXPORT module_cleanup(my* this){
@@ -311,5 +608,7 @@ int EXPORT module_cleanup(my* this){
 	free_context(&this->module.context);
 
 	/* "disconnect" database */
-	return 0;//disconnect(this);
+	disconnect(this);
+	free_cache(this);
+	return 0;
 }
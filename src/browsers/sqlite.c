@@ -16,10 +16,33 @@
  * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
 #include "browser.h"
 #include "core/log.h"
 #include <sqlite3.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+typedef struct {
+	int id;
+	int sortorder;
+	int queue_id;
+	char* path;
+	char* assembler;
+} slide_entry_t;
+
+/**
+ * In-memory copy of a set of slides.
+ */
+typedef struct {
+	slide_entry_t* slides;
+	size_t size;
+	size_t capacity;
+} snapshot_t;
 
 typedef struct {
 	struct browser_module_t module;
@@ -28,10 +51,22 @@ typedef struct {
 	unsigned int queue_id;
 	int prev_slide_id;
 
+	/* the regular queue and intermediate slides is read into memory and only
+	 * read again when the database has been changed by another connection */
+	snapshot_t queue;
+	snapshot_t intermediate;
+	size_t intermediate_pos;     /* next intermediate slide to show */
+	int data_version;            /* -1 if the snapshot is invalid */
+
+	int inotify_fd;              /* watches the directory of the database */
+	const char* basename;        /* database filename (pointing into context) */
+
 	sqlite3* conn;
-	sqlite3_stmt* query_slide;
+	sqlite3_stmt* query_queue;
+	sqlite3_stmt* query_intermediate;
 	sqlite3_stmt* query_looping;
 	sqlite3_stmt* query_pop_intermediate;
+	sqlite3_stmt* query_data_version;
 } sqlite3_context_t;
 
 MODULE_INFO("SQLite3 Browser", BROWSER_MODULE, "David Sveningsson");
@@ -44,34 +79,38 @@ static int connect(sqlite3_context_t* this){
 	}
 
 	const char* q =
-		"	SELECT" /* select from intermediate queue */
-		"		id, "
-		"		path, "
-		"		sortorder, "
-		"		queue_id, "
-		"		assembler "
-		"	FROM"
-		"		slide "
-		"	WHERE"
-		"		queue_id = -1 " /* -1 is intermediate queue */
-		"UNION "
-		"	SELECT" /* select next slide from regular queue */
-		"		id, "
-		"		path, "
-		"		sortorder, "
-		"		queue_id, "
-		"		assembler "
-		"	FROM"
-		"		slide "
-		"	WHERE"
-		"		queue_id = ? AND "
-		"		sortorder > ? "
-		"ORDER BY"
+		"SELECT "
+		"	id, "
+		"	sortorder, "
 		"	queue_id, "
-		"	sortorder "
-		"LIMIT 1";
-	if ( (ret = sqlite3_prepare_v2(this->conn, q, (int)(strlen(q)+1), &this->query_slide, NULL)) != SQLITE_OK ){
-		log_message(Log_Fatal, "query_slide::sqlite3_prepare_v2 failed: %s\n", sqlite3_errmsg(this->conn));
+		"	path, "
+		"	assembler "
+		"FROM "
+		"	slide "
+		"WHERE "
+		"	queue_id = ? "
+		"ORDER BY "
+		"	sortorder";
+	if ( (ret = sqlite3_prepare_v2(this->conn, q, (int)(strlen(q)+1), &this->query_queue, NULL)) != SQLITE_OK ){
+		log_message(Log_Fatal, "query_queue::sqlite3_prepare_v2 failed: %s\n", sqlite3_errmsg(this->conn));
+		return ret;
+	}
+
+	q =
+		"SELECT "
+		"	id, "
+		"	sortorder, "
+		"	queue_id, "
+		"	path, "
+		"	assembler "
+		"FROM "
+		"	slide "
+		"WHERE "
+		"	queue_id = -1 " /* -1 is intermediate queue */
+		"ORDER BY "
+		"	sortorder";
+	if ( (ret = sqlite3_prepare_v2(this->conn, q, (int)(strlen(q)+1), &this->query_intermediate, NULL)) != SQLITE_OK ){
+		log_message(Log_Fatal, "query_intermediate::sqlite3_prepare_v2 failed: %s\n", sqlite3_errmsg(this->conn));
 		return ret;
 	}
 
@@ -100,13 +139,162 @@ static int connect(sqlite3_context_t* this){
 		return ret;
 	}
 
+	/* changes whenever another connection commits (but not our own) */
+	q = "PRAGMA data_version";
+	if ( (ret = sqlite3_prepare_v2(this->conn, q, (int)(strlen(q)+1), &this->query_data_version, NULL)) != SQLITE_OK ){
+		log_message(Log_Fatal, "data_version::sqlite3_prepare_v2 failed: %s\n", sqlite3_errmsg(this->conn));
+		return ret;
+	}
+
+	return 0;
+}
+
+static void snapshot_clear(snapshot_t* snapshot){
+	for ( size_t i = 0; i < snapshot->size; i++ ){
+		free(snapshot->slides[i].path);
+		free(snapshot->slides[i].assembler);
+	}
+	snapshot->size = 0;
+}
+
+static void snapshot_free(snapshot_t* snapshot){
+	snapshot_clear(snapshot);
+	free(snapshot->slides);
+	snapshot->slides = NULL;
+	snapshot->capacity = 0;
+}
+
+/**
+ * Replace the snapshot with the rows of a slide query.
+ */
+static int snapshot_load(sqlite3_context_t* this, snapshot_t* snapshot, sqlite3_stmt* stmt){
+	snapshot_clear(snapshot);
+
+	int ret;
+	while ( (ret = sqlite3_step(stmt)) == SQLITE_ROW ){
+		if ( snapshot->size == snapshot->capacity ){
+			const size_t capacity = snapshot->capacity > 0 ? snapshot->capacity * 2 : 64;
+			slide_entry_t* tmp = realloc(snapshot->slides, capacity * sizeof(slide_entry_t));
+			if ( !tmp ){
+				ret = SQLITE_NOMEM;
+				break;
+			}
+			snapshot->slides = tmp;
+			snapshot->capacity = capacity;
+		}
+
+		slide_entry_t* entry = &snapshot->slides[snapshot->size++];
+		entry->id        =                     sqlite3_column_int (stmt, 0);
+		entry->sortorder =                     sqlite3_column_int (stmt, 1);
+		entry->queue_id  =                     sqlite3_column_int (stmt, 2);
+		entry->path      = strdup((const char*)sqlite3_column_text(stmt, 3));
+		entry->assembler = strdup((const char*)sqlite3_column_text(stmt, 4));
+	}
+
+	sqlite3_reset(stmt);
+
+	if ( ret != SQLITE_DONE ){
+		log_message(Log_Info, "snapshot::sqlite3_step failed: %s\n", sqlite3_errmsg(this->conn));
+		return ret;
+	}
+
+	return 0;
+}
+
+static int data_version(sqlite3_context_t* this){
+	int version = -1;
+	if ( sqlite3_step(this->query_data_version) == SQLITE_ROW ){
+		version = sqlite3_column_int(this->query_data_version, 0);
+	}
+	sqlite3_reset(this->query_data_version);
+	return version;
+}
+
+/**
+ * Read the queue and intermediate slides again if the database has changed
+ * since the snapshot was taken.
+ */
+static int refresh(sqlite3_context_t* this){
+	const int version = data_version(this);
+	if ( version != -1 && version == this->data_version ){
+		return 0;
+	}
+
+	int ret;
+	sqlite3_bind_int(this->query_queue, 1, (int)this->queue_id);
+	if ( (ret = snapshot_load(this, &this->queue, this->query_queue)) != 0 ){
+		this->data_version = -1;
+		return ret;
+	}
+
+	if ( (ret = snapshot_load(this, &this->intermediate, this->query_intermediate)) != 0 ){
+		this->data_version = -1;
+		return ret;
+	}
+
+	this->intermediate_pos = 0;
+	this->data_version = version;
+
+	log_debug("sqlite: loaded %zu slide(s) and %zu intermediate slide(s)\n", this->queue.size, this->intermediate.size);
 	return 0;
 }
 
+/**
+ * Watch the database directory so changes by other processes (to the
+ * database, journal or WAL) is noticed without querying.
+ */
+static void watch(sqlite3_context_t* this){
+	const char* filename = this->module.context.name;
+	const char* slash = strrchr(filename, '/');
+	char* directory = slash ? strndup(filename, (size_t)(slash - filename) + 1) : strdup(".");
+	this->basename = slash ? slash + 1 : filename;
+
+	this->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if ( this->inotify_fd == -1 || inotify_add_watch(this->inotify_fd, directory, IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) == -1 ){
+		log_message(Log_Warning, "sqlite: failed to watch `%s' for changes\n", directory);
+		if ( this->inotify_fd != -1 ){
+			close(this->inotify_fd);
+		}
+		this->inotify_fd = -1;
+	}
+
+	free(directory);
+	this->module.change_fd = this->inotify_fd;
+}
+
+static int queue_changed(sqlite3_context_t* this){
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	const size_t n = strlen(this->basename);
+	int touched = 0;
+	ssize_t bytes;
+
+	while ( (bytes = read(this->inotify_fd, buf, sizeof(buf))) > 0 ){
+		for ( char* ptr = buf; ptr < buf + bytes; ){
+			const struct inotify_event* event = (const struct inotify_event*)ptr;
+			if ( event->len > 0 && strncmp(event->name, this->basename, n) == 0 ){
+				touched = 1;
+			}
+			ptr += sizeof(struct inotify_event) + event->len;
+		}
+	}
+
+	/* only changes committed by others changes data_version, so writes by
+	 * this browser (e.g. popping intermediate slides) is ignored */
+	return touched && this->data_version != -1 && data_version(this) != this->data_version;
+}
+
 static int disconnect(sqlite3_context_t* this){
+	if ( this->inotify_fd != -1 ){
+		close(this->inotify_fd);
+	}
+
+	snapshot_free(&this->intermediate);
+	snapshot_free(&this->queue);
+	sqlite3_finalize(this->query_data_version);
 	sqlite3_finalize(this->query_pop_intermediate);
 	sqlite3_finalize(this->query_looping);
-	sqlite3_finalize(this->query_slide);
+	sqlite3_finalize(this->query_intermediate);
+	sqlite3_finalize(this->query_queue);
 	sqlite3_close(this->conn);
 	return 0;
 }
@@ -128,90 +316,127 @@ static int pop_intermediate(sqlite3_context_t* this, int id){
 	return ret;
 }
 
+/**
+ * Find the first slide in the queue with a sortorder greater than prev.
+ */
+static const slide_entry_t* find_next(const snapshot_t* queue, int prev){
+	size_t lo = 0;
+	size_t hi = queue->size;
+	while ( lo < hi ){
+		const size_t mid = lo + (hi - lo) / 2;
+		if ( queue->slides[mid].sortorder <= prev ){
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo < queue->size ? &queue->slides[lo] : NULL;
+}
+
 static slide_context_t next_slide(sqlite3_context_t* this){
 	slide_context_t slide;
 	slide.filename = NULL;
 	slide.assembler = NULL;
 
-	sqlite3_bind_int(this->query_slide, 1, (int)this->queue_id);
-	sqlite3_bind_int(this->query_slide, 2, this->prev_slide_id);
+	if ( refresh(this) != 0 ){
+		return slide;
+	}
 
-	int ret = sqlite3_step(this->query_slide);
-	if ( ret == SQLITE_DONE ){
-		sqlite3_reset(this->query_slide);
+	const slide_entry_t* entry = NULL;
 
+	if ( this->intermediate_pos < this->intermediate.size ){
+		entry = &this->intermediate.slides[this->intermediate_pos++];
+	} else if ( !(entry = find_next(&this->queue, this->prev_slide_id)) ){
 		if ( !this->loop_queue ){
-			log_message(Log_Debug, "queue finished\n");
+			log_debug("queue finished\n");
 			return slide;
 		}
 
-		log_message(Log_Debug, "queue wrapping\n");
+		log_debug("queue wrapping\n");
 		this->prev_slide_id = -1;
-		sqlite3_bind_int(this->query_slide, 1, (int)this->queue_id);
-		sqlite3_bind_int(this->query_slide, 2, this->prev_slide_id);
 
-		ret = sqlite3_step(this->query_slide);
-		if ( ret == SQLITE_DONE ){
-			sqlite3_reset(this->query_slide);
+		if ( !(entry = find_next(&this->queue, this->prev_slide_id)) ){
 			return slide;
 		}
 	}
 
-	int id = -1;
-	int sort_order = -1;
-	int queue_id = -1;
+	slide.filename  = strdup(entry->path);
+	slide.assembler = strdup(entry->assembler);
+
+	log_message(Log_Info, "slide: %s\n", slide.filename);
+	log_debug("\tid: %d\n", entry->id);
+	log_debug("\tsort_order: %d\n", entry->sortorder);
+	log_debug("\tqueue_id: %d\n", entry->queue_id);
+
+	/* only update id if it comes from a regular queue, i.e., not from intermediate queue. */
+	if ( entry->queue_id > 0 ){
+		this->prev_slide_id = entry->sortorder;
+	} else {
+		/* pop intermediate slides back to unsorted (our own writes doesn't
+		 * change data_version so the snapshot stays valid) */
+		log_debug("popping intermediate slide\n");
+		pop_intermediate(this, entry->id);
+	}
 
-	switch ( ret ){
-		case SQLITE_ROW:
-			/* read columns */
-			id              =                     sqlite3_column_int (this->query_slide, 0);
-			slide.filename  = strdup((const char*)sqlite3_column_text(this->query_slide, 1));
-			sort_order      =                     sqlite3_column_int (this->query_slide, 2);
-			queue_id        =                     sqlite3_column_int (this->query_slide, 3);
-			slide.assembler = strdup((const char*)sqlite3_column_text(this->query_slide, 4));
-
-			log_message(Log_Info, "slide: %s\n", slide.filename);
-			log_message(Log_Debug, "\tid: %d\n", id);
-			log_message(Log_Debug, "\tsort_order: %d\n", sort_order);
-			log_message(Log_Debug, "\tqueue_id: %d\n", queue_id);
-
-			/* only update id if it comes from a regular queue, i.e., not from intermediate queue. */
-			if ( queue_id > 0 ){
-				this->prev_slide_id = sort_order;
-			} else {
-				/* pop intermediate slides back to unsorted */
-				log_message(Log_Debug, "popping intermediate slide\n");
-				pop_intermediate(this, id);
-			}
+	return slide;
+}
 
-			break;
-		case SQLITE_MISUSE:
-			log_message(Log_Info, "query_slide::sqlite3_step failed: %s\n", sqlite3_errmsg(this->conn));
-			log_message(Log_Debug, "\tqueue_id: %d\n", this->queue_id);
-			log_message(Log_Debug, "\told_id: %d\n", this->prev_slide_id);
-			break;
-		default:
-			log_message(Log_Info, "query_slide::sqlite3_step failed: %s\n", sqlite3_errmsg(this->conn));
-			break;
+static slide_context_t next_intermediate(sqlite3_context_t* this){
+	slide_context_t slide;
+	slide.filename = NULL;
+	slide.assembler = NULL;
+
+	if ( refresh(this) != 0 || this->intermediate_pos >= this->intermediate.size ){
+		return slide;
 	}
 
-	sqlite3_reset(this->query_slide);
+	const slide_entry_t* entry = &this->intermediate.slides[this->intermediate_pos++];
+	slide.filename  = strdup(entry->path);
+	slide.assembler = strdup(entry->assembler);
 
+	log_message(Log_Info, "slide: %s (intermediate)\n", slide.filename);
+	pop_intermediate(this, entry->id);
 	return slide;
 }
 
-static void queue_reload(sqlite3_context_t* this){
+static int queue_list(sqlite3_context_t* this, slide_visitor visit, void* user){
+	if ( refresh(this) != 0 ){
+		return 1;
+	}
 
+	for ( size_t i = 0; i < this->queue.size; i++ ){
+		visit(user, this->queue.slides[i].path, this->queue.slides[i].assembler);
+	}
+
+	return 0;
+}
+
+static void queue_reload(sqlite3_context_t* this){
+	this->data_version = -1;
 }
 
 static void queue_dump(sqlite3_context_t* this){
+	if ( refresh(this) != 0 ){
+		return;
+	}
 
+	log_message(Log_Info, "sqlite: queue %u (%zu slides, %zu intermediate):\n", this->queue_id, this->queue.size, this->intermediate.size - this->intermediate_pos);
+	for ( size_t i = this->intermediate_pos; i < this->intermediate.size; i++ ){
+		const slide_entry_t* entry = &this->intermediate.slides[i];
+		log_message(Log_Info, "  [intermediate] %d: %s (%s)\n", entry->id, entry->path, entry->assembler);
+	}
+	for ( size_t i = 0; i < this->queue.size; i++ ){
+		const slide_entry_t* entry = &this->queue.slides[i];
+		log_message(Log_Info, "  %c %d: %s (%s)\n", entry->sortorder > this->prev_slide_id ? ' ' : '*', entry->id, entry->path, entry->assembler);
+	}
 }
 
 static int queue_set(sqlite3_context_t* this, unsigned int id){
 	/* if we change queue we reset the position back to the start */
 	if ( this->queue_id != id ){
 		this->prev_slide_id = -1;
+		this->data_version = -1;
 	}
 
 	this->queue_id = id;
@@ -248,17 +473,38 @@ int EXPORT module_init(sqlite3_context_t* this){
 	this->module.queue_reload = (queue_reload_callback)queue_reload;
 	this->module.queue_dump   = (queue_dump_callback)queue_dump;
 	this->module.queue_set    = (queue_set_callback)queue_set;
+	this->module.queue_changed = (queue_changed_callback)queue_changed;
+	this->module.queue_list = (queue_list_callback)queue_list;
+	this->module.next_intermediate = (next_intermediate_callback)next_intermediate;
 
 	/* initialize variables */
 	this->loop_queue = 1;
 	this->queue_id = 0;
 	this->prev_slide_id = -1;
+	this->queue.slides = NULL;
+	this->queue.size = 0;
+	this->queue.capacity = 0;
+	this->intermediate.slides = NULL;
+	this->intermediate.size = 0;
+	this->intermediate.capacity = 0;
+	this->intermediate_pos = 0;
+	this->data_version = -1;
 	this->conn = 0;
-	this->query_slide  = 0;
+	this->query_queue  = 0;
+	this->query_intermediate  = 0;
 	this->query_looping  = 0;
 	this->query_pop_intermediate  = 0;
+	this->query_data_version  = 0;
+	this->inotify_fd = -1;
+	this->basename = NULL;
 
-	return connect(this);
+	int ret;
+	if ( (ret = connect(this)) != 0 ){
+		return ret;
+	}
+
+	watch(this);
+	return 0;
 }
 
 int EXPORT module_cleanup(sqlite3_context_t* this){
@@ -0,0 +1,143 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2012 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "core/buffer_pool.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <mutex>
+#include <vector>
+
+#define POOL_MAX_BYTES (8*1024*1024)  /* total capacity of free buffers kept (a couple of encoded screen-sized images) */
+#define MIN_CAPACITY (64*1024)
+
+static std::mutex lock;
+static std::vector<Buffer*> pool;
+static size_t pool_bytes = 0;           /* total capacity of pooled buffers */
+
+Buffer::Buffer()
+	: _data(NULL)
+	, _size(0)
+	, _capacity(0){
+
+}
+
+Buffer::~Buffer(){
+	free(_data);
+}
+
+void Buffer::reserve(size_t bytes){
+	if ( !try_reserve(bytes) ){
+		throw std::bad_alloc();
+	}
+}
+
+bool Buffer::try_reserve(size_t bytes){
+	if ( bytes <= _capacity ){
+		return true;
+	}
+
+	unsigned char* tmp = static_cast<unsigned char*>(realloc(_data, bytes));
+	if ( !tmp ){
+		return false;
+	}
+
+	_data = tmp;
+	_capacity = bytes;
+	return true;
+}
+
+void Buffer::resize(size_t bytes){
+	reserve(bytes);
+	_size = bytes;
+}
+
+void Buffer::append(const void* src, size_t bytes){
+	if ( _size + bytes > _capacity ){
+		reserve(std::max(std::max(_size + bytes, _capacity * 2), static_cast<size_t>(MIN_CAPACITY)));
+	}
+
+	memcpy(_data + _size, src, bytes);
+	_size += bytes;
+}
+
+namespace BufferPool {
+
+	void release::operator()(Buffer* buffer) const {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if ( pool_bytes + buffer->capacity() <= POOL_MAX_BYTES ){
+				buffer->clear();
+				pool.push_back(buffer);
+				pool_bytes += buffer->capacity();
+				return;
+			}
+		}
+
+		delete buffer;
+	}
+
+	buffer_ptr acquire(size_t size_hint){
+		Buffer* buffer = NULL;
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if ( !pool.empty() ){
+				/* prefer the smallest buffer which fits, otherwise the largest */
+				size_t best = 0;
+				for ( size_t i = 1; i < pool.size(); i++ ){
+					const size_t a = pool[i]->capacity();
+					const size_t b = pool[best]->capacity();
+					const bool a_fits = a >= size_hint;
+					const bool b_fits = b >= size_hint;
+					if ( (a_fits && (!b_fits || a < b)) || (!a_fits && !b_fits && a > b) ){
+						best = i;
+					}
+				}
+
+				buffer = pool[best];
+				pool.erase(pool.begin() + static_cast<std::ptrdiff_t>(best));
+				pool_bytes -= buffer->capacity();
+			}
+		}
+
+		if ( !buffer ){
+			buffer = new Buffer;
+		}
+
+		/* the hint may come from a server, never trust it */
+		buffer_ptr ptr(buffer);
+		ptr->try_reserve(std::min(size_hint, static_cast<size_t>(BUFFER_MAX_SIZE)));
+		return ptr;
+	}
+
+	void clear(){
+		std::lock_guard<std::mutex> guard(lock);
+		for ( Buffer* buffer: pool ){
+			delete buffer;
+		}
+		pool.clear();
+		pool_bytes = 0;
+	}
+
+}
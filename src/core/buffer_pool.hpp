@@ -0,0 +1,85 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2012 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SLIDESHOW_BUFFER_POOL_HPP
+#define SLIDESHOW_BUFFER_POOL_HPP
+
+#include <cstddef>
+#include <memory>
+
+#define BUFFER_MAX_SIZE (64*1024*1024)  /* largest encoded image accepted */
+
+/**
+ * Growable byte buffer used for encoded image data (downloads and files).
+ * Growth is geometric so appending chunks is amortized O(1).
+ */
+class Buffer {
+public:
+	Buffer();
+	~Buffer();
+
+	unsigned char* data() const { return _data; }
+	size_t size() const { return _size; }
+	size_t capacity() const { return _capacity; }
+
+	/**
+	 * Make room for at least bytes without changing the size.
+	 */
+	void reserve(size_t bytes);
+
+	/**
+	 * Same as reserve but never throws.
+	 * @return False if the memory could not be allocated.
+	 */
+	bool try_reserve(size_t bytes);
+	void resize(size_t bytes);
+	void append(const void* src, size_t bytes);
+	void clear(){ _size = 0; }
+
+private:
+	Buffer(const Buffer&);
+	Buffer& operator=(const Buffer&);
+
+	unsigned char* _data;
+	size_t _size;
+	size_t _capacity;
+};
+
+namespace BufferPool {
+
+	struct release {
+		void operator()(Buffer* buffer) const;
+	};
+
+	/**
+	 * Get an empty buffer, reusing a released one if possible.
+	 * @param size_hint Expected size if known (e.g. Content-Length), 0 if not.
+	 *                  Only a hint, the buffer is smaller if the hint is
+	 *                  larger than BUFFER_MAX_SIZE or cannot be allocated.
+	 */
+	std::unique_ptr<Buffer, release> acquire(size_t size_hint = 0);
+
+	/**
+	 * Free all pooled buffers.
+	 */
+	void clear();
+}
+
+typedef std::unique_ptr<Buffer, BufferPool::release> buffer_ptr;
+
+#endif /* SLIDESHOW_BUFFER_POOL_HPP */
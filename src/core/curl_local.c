@@ -1,15 +0,0 @@
-#include "curl_local.h"
-#include <string.h>
-
-size_t curl_local_resize(void *ptr, size_t size, size_t nmemb, void *data) {
-	size_t realsize = size * nmemb;
-	struct MemoryStruct *mem = (struct MemoryStruct *)data;
-
-	mem->memory = (char*)realloc(mem->memory, mem->size + realsize + 1);
-
-	memcpy(&(mem->memory[mem->size]), ptr, realsize);
-	mem->size += realsize;
-	mem->memory[mem->size] = 0;
-
-	return realsize;
-}
@@ -0,0 +1,255 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2014 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "core/decoder.hpp"
+#include "core/letterbox.h"
+#include "core/log.hpp"
+#include <cstdio>
+#include <cstring>
+
+#ifdef HAVE_JPEG
+#	include <csetjmp>
+#	include <jpeglib.h>
+#endif
+
+#ifdef HAVE_PNG
+#	include <png.h>
+#endif
+
+#ifdef HAVE_WEBP
+#	include <webp/decode.h>
+#endif
+
+#if defined(HAVE_JPEG) || defined(HAVE_WEBP)
+/**
+ * Get the smallest size the image can be decoded at without losing any detail
+ * after letterboxing. Returns the original size if no target is given.
+ */
+static void target_size(int src_width, int src_height, int width, int height, int* dst_width, int* dst_height){
+	if ( width <= 0 || height <= 0 ){
+		*dst_width = src_width;
+		*dst_height = src_height;
+		return;
+	}
+
+	letterbox_size(src_width, src_height, width, height, dst_width, dst_height);
+
+	/* never upscale while decoding */
+	if ( *dst_width > src_width || *dst_height > src_height ){
+		*dst_width = src_width;
+		*dst_height = src_height;
+	}
+}
+#endif
+
+#ifdef HAVE_JPEG
+struct jpeg_error_t {
+	struct jpeg_error_mgr base;
+	jmp_buf jmp;
+};
+
+static void jpeg_error_exit(j_common_ptr cinfo){
+	jpeg_error_t* err = reinterpret_cast<jpeg_error_t*>(cinfo->err);
+	char buf[JMSG_LENGTH_MAX];
+	(*cinfo->err->format_message)(cinfo, buf);
+	Log::warning("Decoder: libjpeg: %s\n", buf);
+	longjmp(err->jmp, 1);
+}
+
+static void jpeg_output_message(j_common_ptr cinfo){
+	char buf[JMSG_LENGTH_MAX];
+	(*cinfo->err->format_message)(cinfo, buf);
+	log_debug("Decoder: libjpeg: %s\n", buf);
+}
+
+static image_ptr decode_jpeg(const unsigned char* data, size_t size, int width, int height){
+	/* no objects with destructors may live in this scope as libjpeg errors longjmp */
+	struct jpeg_decompress_struct cinfo;
+	struct jpeg_error_t err;
+	Image* volatile image = NULL;
+
+	cinfo.err = jpeg_std_error(&err.base);
+	err.base.error_exit = jpeg_error_exit;
+	err.base.output_message = jpeg_output_message;
+
+	if ( setjmp(err.jmp) ){
+		jpeg_destroy_decompress(&cinfo);
+		delete image;
+		return image_ptr();
+	}
+
+	jpeg_create_decompress(&cinfo);
+	jpeg_mem_src(&cinfo, const_cast<unsigned char*>(data), static_cast<unsigned long>(size));
+	jpeg_read_header(&cinfo, TRUE);
+
+	/* libjpeg cannot convert CMYK to RGB, let DevIL handle it */
+	if ( cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK ){
+		jpeg_destroy_decompress(&cinfo);
+		return image_ptr();
+	}
+
+	cinfo.out_color_space = JCS_RGB;
+
+	/* find the smallest DCT scaling (N/8) still at or above the target size */
+	int target_width, target_height;
+	target_size(static_cast<int>(cinfo.image_width), static_cast<int>(cinfo.image_height), width, height, &target_width, &target_height);
+	cinfo.scale_denom = 8;
+	for ( unsigned int num = 1; num <= 8; num++ ){
+		cinfo.scale_num = num;
+		jpeg_calc_output_dimensions(&cinfo);
+		if ( cinfo.output_width >= static_cast<JDIMENSION>(target_width) && cinfo.output_height >= static_cast<JDIMENSION>(target_height) ){
+			break;
+		}
+	}
+
+	jpeg_start_decompress(&cinfo);
+	log_debug("Decoder: JPEG %dx%d decoded at %dx%d (scale %d/8)\n",
+	          cinfo.image_width, cinfo.image_height, cinfo.output_width, cinfo.output_height, cinfo.scale_num);
+
+	image = new Image(static_cast<int>(cinfo.output_width), static_cast<int>(cinfo.output_height), GL_RGB, 3);
+	if ( !image->pixels ){
+		jpeg_destroy_decompress(&cinfo);
+		delete image;
+		return image_ptr();
+	}
+
+	const size_t stride = static_cast<size_t>(image->width) * 3;
+	while ( cinfo.output_scanline < cinfo.output_height ){
+		JSAMPROW row = image->pixels + cinfo.output_scanline * stride;
+		jpeg_read_scanlines(&cinfo, &row, 1);
+	}
+
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+	return image_ptr(image);
+}
+#endif /* HAVE_JPEG */
+
+#ifdef HAVE_PNG
+static image_ptr decode_png(const unsigned char* data, size_t size){
+	png_image png;
+	memset(&png, 0, sizeof(png));
+	png.version = PNG_IMAGE_VERSION;
+
+	if ( !png_image_begin_read_from_memory(&png, data, size) ){
+		Log::warning("Decoder: libpng: %s\n", png.message);
+		return image_ptr();
+	}
+
+	const bool alpha = (png.format & PNG_FORMAT_FLAG_ALPHA) != 0;
+	png.format = alpha ? PNG_FORMAT_RGBA : PNG_FORMAT_RGB;
+
+	image_ptr image(new Image(static_cast<int>(png.width), static_cast<int>(png.height), alpha ? GL_RGBA : GL_RGB, alpha ? 4 : 3));
+	if ( !image->pixels ){
+		png_image_free(&png);
+		return image_ptr();
+	}
+
+	if ( !png_image_finish_read(&png, NULL, image->pixels, 0, NULL) ){
+		Log::warning("Decoder: libpng: %s\n", png.message);
+		png_image_free(&png);
+		return image_ptr();
+	}
+
+	return image;
+}
+#endif /* HAVE_PNG */
+
+#ifdef HAVE_WEBP
+static image_ptr decode_webp(const unsigned char* data, size_t size, int width, int height){
+	WebPDecoderConfig config;
+	if ( !WebPInitDecoderConfig(&config) || WebPGetFeatures(data, size, &config.input) != VP8_STATUS_OK ){
+		return image_ptr();
+	}
+
+	const bool alpha = config.input.has_alpha != 0;
+	const unsigned int bpp = alpha ? 4 : 3;
+
+	/* libwebp can scale while decoding too, though not in the DCT domain */
+	int target_width, target_height;
+	target_size(config.input.width, config.input.height, width, height, &target_width, &target_height);
+	if ( target_width != config.input.width || target_height != config.input.height ){
+		config.options.use_scaling = 1;
+		config.options.scaled_width = target_width;
+		config.options.scaled_height = target_height;
+	}
+
+	image_ptr image(new Image(target_width, target_height, alpha ? GL_RGBA : GL_RGB, bpp));
+	if ( !image->pixels ){
+		return image_ptr();
+	}
+
+	config.output.colorspace = alpha ? MODE_RGBA : MODE_RGB;
+	config.output.is_external_memory = 1;
+	config.output.u.RGBA.rgba = image->pixels;
+	config.output.u.RGBA.stride = target_width * static_cast<int>(bpp);
+	config.output.u.RGBA.size = image->size;
+
+	const VP8StatusCode status = WebPDecode(data, size, &config);
+	WebPFreeDecBuffer(&config.output);
+
+	if ( status != VP8_STATUS_OK ){
+		Log::warning("Decoder: libwebp failed with status %d\n", static_cast<int>(status));
+		return image_ptr();
+	}
+
+	return image;
+}
+#endif /* HAVE_WEBP */
+
+namespace Decoder {
+
+	image_ptr decode(const unsigned char* data, size_t size, int width, int height){
+		static const unsigned char jpeg_magic[] = {0xFF, 0xD8, 0xFF};
+		static const unsigned char png_magic[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+		if ( !data ){
+			return image_ptr();
+		}
+
+#ifdef HAVE_JPEG
+		if ( size >= sizeof(jpeg_magic) && memcmp(data, jpeg_magic, sizeof(jpeg_magic)) == 0 ){
+			return decode_jpeg(data, size, width, height);
+		}
+#endif
+
+#ifdef HAVE_PNG
+		if ( size >= sizeof(png_magic) && memcmp(data, png_magic, sizeof(png_magic)) == 0 ){
+			return decode_png(data, size);
+		}
+#endif
+
+#ifdef HAVE_WEBP
+		if ( size >= 12 && memcmp(data, "RIFF", 4) == 0 && memcmp(data + 8, "WEBP", 4) == 0 ){
+			return decode_webp(data, size, width, height);
+		}
+#endif
+
+		/* silence unused warnings when no decoder is available */
+		(void)jpeg_magic;
+		(void)png_magic;
+		(void)width;
+		(void)height;
+		return image_ptr();
+	}
+
+}
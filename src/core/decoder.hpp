@@ -0,0 +1,48 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2014 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SLIDESHOW_DECODER_HPP
+#define SLIDESHOW_DECODER_HPP
+
+#include "core/image.hpp"
+
+/**
+ * Native decoders for the common formats (JPEG, PNG and WebP). Unlike DevIL
+ * these are reentrant so images can be decoded on multiple threads at once,
+ * and JPEG can be downscaled in the DCT domain while decoding.
+ *
+ * Support for each format depends on which libraries was available at
+ * configure time.
+ */
+namespace Decoder {
+
+	/**
+	 * Decode an image from memory. If width and height are non-zero the image
+	 * may be decoded at a reduced size, but never smaller than what is needed
+	 * to letterbox it to width x height.
+	 *
+	 * Output is 8-bit RGB or RGBA, first row at the top.
+	 *
+	 * @return NULL if the format isn't supported (or is corrupt), in which case
+	 *         the caller should fall back to DevIL.
+	 */
+	image_ptr decode(const unsigned char* data, size_t size, int width, int height);
+
+}
+
+#endif /* SLIDESHOW_DECODER_HPP */
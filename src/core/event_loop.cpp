@@ -0,0 +1,160 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2014 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "core/event_loop.hpp"
+#include "core/log.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 16
+
+static int epoll_fd = -1;
+static int timer_fd = -1;
+static int wakeup_fd = -1;
+static std::map<int, EventLoop::callback> callbacks;
+
+/**
+ * Consume a eventfd/timerfd counter.
+ */
+static void drain(int fd){
+	uint64_t value;
+	while ( read(fd, &value, sizeof(value)) == -1 && errno == EINTR );
+}
+
+namespace EventLoop {
+
+	int init(){
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+		if ( epoll_fd == -1 || timer_fd == -1 || wakeup_fd == -1 ){
+			Log::fatal("EventLoop: failed to initialize: %s\n", strerror(errno));
+			cleanup();
+			return -1;
+		}
+
+		add(timer_fd, []{ drain(timer_fd); });
+		add(wakeup_fd, []{ drain(wakeup_fd); });
+		return 0;
+	}
+
+	void cleanup(){
+		if ( wakeup_fd != -1 ) close(wakeup_fd);
+		if ( timer_fd != -1 ) close(timer_fd);
+		if ( epoll_fd != -1 ) close(epoll_fd);
+
+		wakeup_fd = -1;
+		timer_fd = -1;
+		epoll_fd = -1;
+		callbacks.clear();
+	}
+
+	int add(int fd, callback func){
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.fd = fd;
+
+		if ( epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0 ){
+			Log::warning("EventLoop: failed to watch fd %d: %s\n", fd, strerror(errno));
+			return -1;
+		}
+
+		callbacks[fd] = func;
+		return 0;
+	}
+
+	void remove(int fd){
+		if ( callbacks.erase(fd) == 0 ){
+			return;
+		}
+
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	}
+
+	void wait(double timeout){
+		/* fallback if initialization failed, so the kernel doesn't spin */
+		if ( epoll_fd == -1 ){
+			if ( timeout > 0.0 ){
+				usleep(static_cast<useconds_t>(std::min(timeout, 0.1) * 1e6));
+			}
+			return;
+		}
+
+		/* the timer is always rearmed (or disarmed) so a previous deadline
+		 * doesn't cause a spurious wakeup */
+		const bool block = timeout < 0.0 || timeout > 0.0;
+		struct itimerspec spec;
+		memset(&spec, 0, sizeof(spec));
+		if ( timeout > 0.0 ){
+			double seconds;
+			const double fraction = modf(timeout, &seconds);
+			spec.it_value.tv_sec = static_cast<time_t>(seconds);
+			spec.it_value.tv_nsec = static_cast<long>(fraction * 1e9);
+			if ( spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0 ){
+				spec.it_value.tv_nsec = 1;
+			}
+		}
+		timerfd_settime(timer_fd, 0, &spec, NULL);
+
+		struct epoll_event events[MAX_EVENTS];
+		const int n = epoll_wait(epoll_fd, events, MAX_EVENTS, block ? -1 : 0);
+
+		if ( n == -1 ){
+			/* signals (e.g. SIGTERM) interrupts the wait which is expected */
+			if ( errno != EINTR ){
+				Log::warning("EventLoop: epoll_wait failed: %s\n", strerror(errno));
+			}
+			return;
+		}
+
+		for ( int i = 0; i < n; i++ ){
+			auto it = callbacks.find(events[i].data.fd);
+			if ( it != callbacks.end() && it->second ){
+				/* copy as the callback might remove itself */
+				callback func = it->second;
+				func();
+			}
+		}
+	}
+
+	void wakeup(){
+		if ( wakeup_fd == -1 ){
+			return;
+		}
+
+		const uint64_t value = 1;
+		if ( write(wakeup_fd, &value, sizeof(value)) == -1 && errno != EAGAIN ){
+			Log::warning("EventLoop: failed to wake: %s\n", strerror(errno));
+		}
+	}
+
+}
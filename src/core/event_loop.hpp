@@ -0,0 +1,60 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2014 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SLIDESHOW_EVENT_LOOP_HPP
+#define SLIDESHOW_EVENT_LOOP_HPP
+
+#include <functional>
+
+/**
+ * Blocks the main loop until something happens (epoll) instead of polling:
+ * a watched fd becomes readable, the timeout expires (timerfd, so it is not
+ * rounded to milliseconds) or another thread calls wakeup().
+ */
+namespace EventLoop {
+
+	typedef std::function<void()> callback;
+
+	int init();
+	void cleanup();
+
+	/**
+	 * Watch a fd for reading. The callback is called from wait() whenever the
+	 * fd is readable and must consume the data (or the loop will not block).
+	 *
+	 * @return Non-zero on errors.
+	 */
+	int add(int fd, callback func);
+	void remove(int fd);
+
+	/**
+	 * Block until a fd is readable, wakeup() is called or the timeout has
+	 * passed. Callbacks for readable fds is dispatched before returning.
+	 *
+	 * @param timeout Timeout in seconds, 0 returns immediately and negative
+	 *                blocks indefinitely.
+	 */
+	void wait(double timeout);
+
+	/**
+	 * Make the current (or next) wait() return. Safe to call from any thread.
+	 */
+	void wakeup();
+}
+
+#endif /* SLIDESHOW_EVENT_LOOP_HPP */
@@ -0,0 +1,147 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2014 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "core/frame_scheduler.hpp"
+#include "core/log.hpp"
+#include "core/metrics.hpp"
+#include <algorithm>
+#include <cmath>
+#include <time.h>
+
+static double refresh = 1.0 / 60.0;   /* refresh interval estimate */
+static double last_present = 0.0;     /* 0 if there is no previous frame in this transition */
+static double target = 0.0;           /* predicted present of the frame being rendered */
+static double frame_start = 0.0;      /* when the frame being rendered was started */
+static double render = 0.0;           /* estimated time from starting a frame until it is presented */
+static bool active = false;           /* set between begin and end */
+static FrameScheduler::stats_t current = {0, 0, 0};
+static FrameScheduler::stats_t total = {0, 0, 0};
+
+namespace FrameScheduler {
+
+	void init(double refresh_rate){
+		refresh = refresh_rate > 0.0 ? 1.0 / refresh_rate : 1.0 / 60.0;
+		render = refresh * 0.25;
+		log_verbose("FrameScheduler: Assuming %.2fHz refresh rate\n", 1.0 / refresh);
+	}
+
+	double now(){
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) / 1e9;
+	}
+
+	void begin(){
+		current.rendered = 0;
+		current.late = 0;
+		current.dropped = 0;
+		last_present = 0.0;
+		target = 0.0;
+		active = true;
+	}
+
+	void end(){
+		log_debug("FrameScheduler: %u frames rendered, %u late, %u dropped (%.2fHz)\n",
+		          current.rendered, current.late, current.dropped, 1.0 / refresh);
+
+		total.rendered += current.rendered;
+		total.late += current.late;
+		total.dropped += current.dropped;
+		active = false;
+	}
+
+	double predict(){
+		const double t = now();
+		frame_start = t;
+
+		/* first frame: assume it makes the next refresh */
+		if ( last_present <= 0.0 ){
+			target = t + refresh;
+			return target;
+		}
+
+		/* next refresh after now, counted from the last present */
+		const double elapsed = t - last_present;
+		target = last_present + (floor(elapsed / refresh) + 1.0) * refresh;
+		return target;
+	}
+
+	void presented(){
+		const double t = now();
+		current.rendered++;
+
+		if ( frame_start > 0.0 ){
+			render += (t - frame_start - render) * 0.1;
+			frame_start = 0.0;
+		}
+
+		if ( last_present > 0.0 ){
+			const double delta = t - last_present;
+
+			if ( active ){
+				Metrics::observe(Metrics::Frame, delta);
+			}
+
+			/* refine the interval estimate (e.g. 50Hz panels or 59.94Hz) but
+			 * only using presents on consecutive refreshes */
+			if ( delta > refresh * 0.75 && delta < refresh * 1.25 ){
+				refresh += (delta - refresh) * 0.05;
+			}
+
+			/* presented a refresh (or more) after the prediction */
+			if ( target > 0.0 && t > target + refresh * 0.5 ){
+				current.late++;
+				current.dropped += static_cast<unsigned int>(floor((t - target) / refresh + 0.5));
+			}
+		}
+
+		last_present = t;
+	}
+
+	double until_next_frame(){
+		if ( last_present <= 0.0 ){
+			return 0.0;
+		}
+
+		/* wake just early enough to render the frame in time for the next
+		 * refresh, so it is never presented before a full interval has passed
+		 * even if the swap doesn't block. With vsync the measured time
+		 * includes waiting in the swap, so the margin is capped to keep from
+		 * rendering two frames per refresh. */
+		const double margin = std::min(render, refresh * 0.5);
+		const double left = last_present + refresh - margin - now();
+		return left > 0.0 ? left : 0.0;
+	}
+
+	double interval(){
+		return refresh;
+	}
+
+	stats_t stats(){
+		return current;
+	}
+
+	stats_t totals(){
+		return total;
+	}
+
+}
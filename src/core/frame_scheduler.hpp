@@ -0,0 +1,96 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2014 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SLIDESHOW_FRAME_SCHEDULER_HPP
+#define SLIDESHOW_FRAME_SCHEDULER_HPP
+
+/**
+ * Paces transition frames to the display refresh.
+ *
+ * The time a frame will be presented is predicted from the previous present
+ * (i.e. when the last buffer swap returned) and the refresh interval, so
+ * animations can be evaluated at the time the frame is actually shown instead
+ * of when it was rendered. Comparing the prediction to the actual present time
+ * detects late frames and how many refreshes was missed (dropped).
+ *
+ * All times is seconds from CLOCK_MONOTONIC.
+ */
+namespace FrameScheduler {
+
+	struct stats_t {
+		unsigned int rendered;  /* frames presented */
+		unsigned int late;      /* frames presented after their predicted refresh */
+		unsigned int dropped;   /* refreshes where no new frame was presented */
+	};
+
+	/**
+	 * @param refresh_rate Display refresh rate in Hz, used as initial
+	 *                     estimate (it is refined by measuring presents).
+	 */
+	void init(double refresh_rate);
+
+	/**
+	 * Monotonic time, unaffected by changes to the wall clock.
+	 */
+	double now();
+
+	/**
+	 * Reset the per-transition counters.
+	 */
+	void begin();
+
+	/**
+	 * Log and accumulate the counters for the finished transition.
+	 */
+	void end();
+
+	/**
+	 * Predict when the frame about to be rendered will be presented.
+	 */
+	double predict();
+
+	/**
+	 * Must be called after the buffers has been swapped.
+	 */
+	void presented();
+
+	/**
+	 * Time until the next frame should be rendered, i.e. the next refresh
+	 * minus the (measured) render time. Normally the buffer swap blocks on
+	 * vsync, this keeps the frame rate at the refresh rate when it doesn't
+	 * (e.g. software rendering).
+	 */
+	double until_next_frame();
+
+	/**
+	 * Current refresh interval estimate in seconds.
+	 */
+	double interval();
+
+	/**
+	 * Counters for the current (or last) transition.
+	 */
+	stats_t stats();
+
+	/**
+	 * Counters accumulated over all transitions.
+	 */
+	stats_t totals();
+}
+
+#endif /* SLIDESHOW_FRAME_SCHEDULER_HPP */
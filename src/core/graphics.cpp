@@ -21,13 +21,18 @@
 #endif
 
 #include "core/graphics.h"
+#include "core/decoder.hpp"
+#include "core/image_cache.hpp"
+#include "core/letterbox.h"
+#include "core/raster_cache.hpp"
+#include "core/shader_cache.hpp"
 #include "core/exception.hpp"
 #include "core/module_loader.h"
 #include "core/log.hpp"
+#include "core/metrics.hpp"
 #include "transitions/transition.h"
 #include "path.h"
-#include <curl/curl.h>
-#include "curl_local.h"
+#include "core/http.h"
 
 #include <cstdlib>
 #include <cstring>
@@ -35,14 +40,28 @@
 #include <cassert>
 #include <cerrno>
 #include <cstdlib>
+#include <mutex>
+#include <string>
+#include <algorithm>
+#include <vector>
+#include <sys/stat.h>
 
 #include <datapack.h>
 #include <IL/il.h>
 #include <IL/ilu.h>
 
-static CURL* curl = NULL;
+#define PBO_RING 3
+
+static std::mutex devil_lock; /* DevIL is not thread-safe */
 static transition_module_t transition = NULL;
-static unsigned int texture[2] = {0,0};
+static const char* loading_transition = NULL;  /* name while the plugin initializes, part of the shader cache key */
+static std::vector<GLuint> ring;             /* slide textures */
+static unsigned int current = 0;             /* ring slot of the current slide, the previous slide is in the slot before */
+static unsigned int staged = 0;              /* number of slides uploaded ahead of current */
+static GLuint pbo[PBO_RING] = {0,};          /* uploads rotate through the PBOs */
+static GLsync pbo_fence[PBO_RING] = {0,};    /* signaled when the PBO can be reused */
+static unsigned int pbo_index = 0;
+static bool use_pbo = false;
 static int width;
 static int height;
 static unsigned int counter = 0;
@@ -59,12 +78,20 @@ struct free_delete {
 	void operator()(void* x) { free(x); }
 };
 
-int graphics_init(int w, int h){
+/**
+ * Get the texture of the ring slot at offset from the current slide.
+ */
+static GLuint ring_slot(int offset){
+	const int n = static_cast<int>(ring.size());
+	return ring[static_cast<size_t>(((static_cast<int>(current) + offset) % n + n) % n)];
+}
+
+int graphics_init(int w, int h, unsigned int ring_size){
 	width = w;
 	height = h;
 	gl_setup();
 
-	Log::verbose("Graphics: Using resoultion %dx%d\n", width, height);
+	log_verbose("Graphics: Using resoultion %dx%d\n", width, height);
 
 	/* Initialize GLEW */
 	GLenum err = glewInit();
@@ -88,22 +115,40 @@ int graphics_init(int w, int h){
 	}
 	iluInit();
 
-	/* init curl */
-	curl = curl_easy_init();
-	if ( !curl ){
-		Log::fatal("Failed to initialize curl\n");
-		return EINVAL;
-	}
-
-	/* initialize textures */
-	glGenTextures(2, texture);
-	for ( unsigned int i = 0; i < 2; i++ ){
-		glBindTexture(GL_TEXTURE_2D, texture[i]);
+	/* initialize textures, all slides is uploaded at screen resolution so the
+	 * storage is only allocated once */
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	ring.resize(std::max(ring_size, 2U));
+	current = 0;
+	staged = 0;
+	glGenTextures(static_cast<GLsizei>(ring.size()), ring.data());
+	for ( unsigned int i = 0; i < ring.size(); i++ ){
+		glBindTexture(GL_TEXTURE_2D, ring[i]);
 
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		if ( GLEW_ARB_texture_storage ){
+			glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGB8, width, height);
+		} else {
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+		}
+	}
+
+	/* initialize upload PBOs (large enough for RGBA) */
+	use_pbo = GLEW_ARB_pixel_buffer_object && GLEW_ARB_map_buffer_range && GLEW_ARB_sync;
+	if ( use_pbo ){
+		const GLsizeiptr size = static_cast<GLsizeiptr>(width) * height * 4;
+		glGenBuffers(PBO_RING, pbo);
+		for ( unsigned int i = 0; i < PBO_RING; i++ ){
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[i]);
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	} else {
+		Log::warning("Graphics card does not support pixel buffer objects, texture uploads will block\n");
 	}
 
 	/* initialize fsquad VBO */
@@ -116,8 +161,17 @@ int graphics_init(int w, int h){
 }
 
 int graphics_cleanup(){
-	glDeleteTextures(2, texture);
-	curl_easy_cleanup(curl);
+	for ( unsigned int i = 0; i < PBO_RING; i++ ){
+		if ( pbo_fence[i] ){
+			glDeleteSync(pbo_fence[i]);
+			pbo_fence[i] = 0;
+		}
+	}
+	if ( use_pbo ){
+		glDeleteBuffers(PBO_RING, pbo);
+	}
+	glDeleteTextures(static_cast<GLsizei>(ring.size()), ring.data());
+	ring.clear();
 	module_close(&transition->base);
 	return 0;
 }
@@ -126,9 +180,12 @@ void graphics_render(float state){
 	if ( !transition ) return;
 
 	struct transition_context context = {
-		/* .texture = */  {texture[0], texture[1]},
+		/* .texture = */  {ring_slot(0), ring_slot(-1)},
 		/* .state = */    state,
 		/* .counter = */  counter,
+		/* .previous = */ ring_slot(-1),
+		/* .current = */  ring_slot(0),
+		/* .next = */     staged > 0 ? ring_slot(1) : 0,
 	};
 
 	transition->render(transition, &context);
@@ -199,198 +256,513 @@ static bool __attribute__((pure)) __attribute__((nonnull)) is_url(const char* na
 	return strncmp(name, prefix, strlen(prefix)) == 0;
 }
 
-static int load_file(const char* filename, unsigned int dst){
-	assert(filename);
-
-	Log::debug("Loading '%s' as local file.\n", filename);
-
+/**
+ * Get the real path to the file which should be read for a local image. For
+ * slides it is the raster for the current resolution.
+ */
+static char* local_path(const char* filename){
 	std::unique_ptr<char, free_delete> real_name(strdup(filename));
 	if ( is_slide(filename) ){
 		real_name.reset(asprintf2("%s/raster/%dx%d.png", filename, width, height));
 	}
 
-#ifdef UNICODE
-	char* tmp = real_path(real_name.get());
-	std::unique_ptr<wchar_t, free_delete> path(to_tchar(tmp));
-	free(tmp);
-#else /* UNICODE */
-	std::unique_ptr<char, free_delete> path(real_path(real_name.get()));
-#endif /* UNICODE */
+	return real_path(real_name.get());
+}
 
-	ilBindImage(dst);
-	ilLoadImage(path.get());
-	ILuint devilError = ilGetError();
+/**
+ * Get a tag which changes whenever the local file changes, used as part of
+ * the cache key (remote images uses the HTTP validator).
+ *
+ * @return false if the source cannot be identified (and shouldn't be cached).
+ */
+static bool source_tag(const char* name, std::string& tag){
+	std::unique_ptr<char, free_delete> path(local_path(name));
+	struct stat st;
+	if ( stat(path.get(), &st) != 0 ){
+		return false;
+	}
 
-	if( devilError != IL_NO_ERROR ){
-#ifdef UNICODE
-		const wchar_t* asdf = iluErrorString (devilError);
-		const char* error = from_tchar(asdf);
-#else /* UNICODE */
-		const char* error = iluErrorString (devilError);
-#endif /* UNICODE */
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%lld:%lld", (long long)st.st_mtime, (long long)st.st_size);
+	tag = buf;
+	return true;
+}
+
+/**
+ * Read the encoded image data of a local file.
+ */
+static int read_file(const char* filename, buffer_ptr& data){
+	assert(filename);
+
+	log_debug("Loading '%s' as local file.\n", filename);
+
+	std::unique_ptr<char, free_delete> path(local_path(filename));
+	FILE* fp = fopen(path.get(), "rb");
+	if ( !fp ){
+		Log::warning("Failed to load image '%s' (%s)\n", path.get(), strerror(errno));
+		return -1;
+	}
+
+	struct stat st;
+	if ( fstat(fileno(fp), &st) != 0 ){
+		Log::warning("Failed to load image '%s' (%s)\n", path.get(), strerror(errno));
+		fclose(fp);
+		return -1;
+	}
+
+	const size_t size = static_cast<size_t>(st.st_size);
+	data = BufferPool::acquire(size);
+	if ( size > BUFFER_MAX_SIZE || !data->try_reserve(size) ){
+		Log::warning("Failed to load image '%s' (too large)\n", path.get());
+		fclose(fp);
+		return -1;
+	}
+	data->resize(size);
+	const size_t bytes = fread(data->data(), 1, data->size(), fp);
+	fclose(fp);
 
-		Log::warning("Failed to load image '%s' (ilLoadImage: %s)\n", path.get(), error);
+	if ( bytes != data->size() ){
+		Log::warning("Failed to load image '%s' (short read)\n", path.get());
 		return -1;
 	}
 
 	return 0;
 }
 
-static int load_url(const char* url, unsigned int dst){
+/**
+ * Fetch the encoded image data of a remote image.
+ *
+ * @param validator Validator of the copy the caller has (or NULL), the data
+ *                  is only fetched if the copy is no longer valid.
+ * @param new_validator Validator of the fetched data (NULL if none).
+ * @return 1 if the copy is still valid.
+ */
+static int read_url(const char* url, const char* validator, buffer_ptr& data, std::unique_ptr<char, free_delete>& new_validator){
 	assert(url);
-	assert(dst >= 1);
-	Log::debug("Loading '%s' as remote image.\n", url);
+	log_debug("Loading '%s' as remote image.\n", url);
 
-	struct MemoryStruct chunk = {
-		(char*)malloc(1), 0
-	};
-	long response = -1;
+	char* tag;
+	const long response = http_get_conditional(url, validator, data, &tag);
+	new_validator.reset(tag);
 
-	/* get image data */
-	curl_easy_setopt(curl, CURLOPT_URL, url);
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_local_resize);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-	curl_easy_perform(curl);
-	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response);
+	if ( response == HTTP_NOT_MODIFIED ){
+		log_debug("  Not modified\n");
+		return 1;
+	}
 
 	if ( response != 200 ){ /* HTTP OK */
 		throw exception("Failed to load url, server replied with code %ld\n", response);
-		return -1;
 	}
 
-	char* content_type;
-	double content_length;
-	curl_easy_getinfo(curl, CURLINFO_CONTENT_TYPE, &content_type);
-	curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &content_length);
+	log_debug("  Content-length: %zu bytes\n", data->size());
+	return 0;
+}
+
+static const char* devil_error(ILuint error){
+#ifdef UNICODE
+	const wchar_t* asdf = iluErrorString (error);
+	return from_tchar(asdf);
+#else /* UNICODE */
+	return iluErrorString (error);
+#endif /* UNICODE */
+}
 
-	Log::debug("  Content-type: %s\n", content_type);
-	Log::debug("  Content-length: %d bytes (chunk size %zd)\n", static_cast<int>(content_length), chunk.size);
+/**
+ * Decode using DevIL, used for formats without a native decoder. The data
+ * already read is passed to DevIL, for local files the extension is used as a
+ * hint as some formats (e.g. TGA) cannot be detected from the content.
+ */
+static image_ptr devil_decode(const char* name, const Buffer& data){
+	std::lock_guard<std::mutex> lock(devil_lock);
 
-	ilBindImage(dst);
-	ilLoadL(IL_TYPE_UNKNOWN, chunk.memory, static_cast<ILuint>(chunk.size));
-	ILuint devilError = ilGetError();
+	ILuint image;
+	ilGenImages(1, &image);
+	ilBindImage(image);
 
-	if( devilError != IL_NO_ERROR ){
+	ILenum hint = IL_TYPE_UNKNOWN;
+	if ( !is_url(name) ){
 #ifdef UNICODE
-		const wchar_t* asdf = iluErrorString (devilError);
-		const char* error = from_tchar(asdf);
+		char* tmp = local_path(name);
+		std::unique_ptr<wchar_t, free_delete> path(to_tchar(tmp));
+		free(tmp);
 #else /* UNICODE */
-		const char* error = iluErrorString (devilError);
+		std::unique_ptr<char, free_delete> path(local_path(name));
 #endif /* UNICODE */
-		throw exception("Failed to load image '%s' (ilLoadImage: %s)", url, error);
-		return -1;
+		hint = ilTypeFromExt(path.get());
 	}
 
-	return 0;
-}
+	ilLoadL(hint, data.data(), static_cast<ILuint>(data.size()));
 
-static int load_blank(){
-	Log::debug("Loading blank image.\n");
+	ILuint devilError = ilGetError();
+	if( devilError != IL_NO_ERROR ){
+		Log::warning("Failed to load image '%s' (ilLoadL: %s)\n", name, devil_error(devilError));
+		ilDeleteImages(1, &image);
+		return image_ptr();
+	}
 
-	static const unsigned char black[] = {
-		0, 0, 0
-	};
+	/* only 8-bit RGB(A)/BGR(A) is passed on, first row at the top */
+	const ILenum type = ilGetInteger(IL_IMAGE_TYPE);
+	const ILenum format = ilGetInteger(IL_IMAGE_FORMAT);
+	if ( type != IL_UNSIGNED_BYTE || !(format == IL_RGB || format == IL_RGBA || format == IL_BGR || format == IL_BGRA) ){
+		ilConvertImage(IL_RGB, IL_UNSIGNED_BYTE);
+	}
+	if ( ilGetInteger(IL_IMAGE_ORIGIN) == IL_ORIGIN_LOWER_LEFT ){
+		iluFlipImage();
+	}
 
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_BGR_EXT, GL_UNSIGNED_BYTE, black);
-	return 0;
+	/* copy data from the bound image */
+	const int width  = ilGetInteger(IL_IMAGE_WIDTH);
+	const int height = ilGetInteger(IL_IMAGE_HEIGHT);
+	const GLenum gl_format = ilGetInteger(IL_IMAGE_FORMAT);
+	const unsigned int bpp = ilGetInteger(IL_IMAGE_BPP);
+	image_ptr dst(new Image(width, height, gl_format, bpp));
+
+	if ( dst->pixels ){
+		memcpy(dst->pixels, ilGetData(), dst->size);
+	} else {
+		Log::warning("Failed to allocate %zu bytes for '%s'\n", dst->size, name);
+		dst.reset();
+	}
+
+	/* free buffer */
+	ilDeleteImages(1, &image);
+
+	return dst;
 }
 
 /**
- * Add a {letter,pillar}box if necessary.
- * Leaves the new image bound.
+ * Letterbox src into dst (screen resolution, RGB).
  */
-static void apply_letterbox(unsigned int src, unsigned int dst){
-	ilBindImage(src);
+static int letterbox_image(const Image& src, unsigned char* dst){
+	enum letterbox_format fmt = LETTERBOX_RGB;
+	switch ( src.format ){
+	case GL_RGBA: fmt = LETTERBOX_RGBA; break;
+	case GL_BGR:  fmt = LETTERBOX_BGR;  break;
+	case GL_BGRA: fmt = LETTERBOX_BGRA; break;
+	}
 
-	/* skip if the size is already correct (slides from frontend is already rendered correct) */
-	if ( ilGetInteger(IL_IMAGE_WIDTH) == width && ilGetInteger(IL_IMAGE_HEIGHT) == height ){
-		return;
+	Metrics::Timer timer(Metrics::Letterbox);
+	const size_t stride = static_cast<size_t>(src.width) * src.bpp;
+	return letterbox(src.pixels, src.width, src.height, stride, fmt, dst, width, height, 0);
+}
+
+/**
+ * Add a {letter,pillar}box to fit the screen resolution.
+ */
+static image_ptr apply_letterbox(const char* name, const Image& src){
+	int new_width, new_height;
+	letterbox_size(src.width, src.height, width, height, &new_width, &new_height);
+	log_debug("  Letterboxed resolution: %dx%d\n", new_width, new_height);
+
+	image_ptr dst(new Image(width, height, GL_RGB, 3));
+	if ( !dst->pixels ){
+		Log::warning("Failed to allocate %zu bytes for '%s'\n", dst->size, name);
+		return image_ptr();
 	}
 
-	const float old_width  = static_cast<float>(ilGetInteger(IL_IMAGE_WIDTH));
-	const float old_height = static_cast<float>(ilGetInteger(IL_IMAGE_HEIGHT));
-	const ILuint depth = ilGetInteger(IL_IMAGE_DEPTH);
-	const ILubyte bpp = static_cast<ILubyte>(ilGetInteger(IL_IMAGE_BPP));
-	const ILenum format = ilGetInteger(IL_IMAGE_FORMAT);
-	const ILenum type = ilGetInteger(IL_IMAGE_TYPE);
-	const float old_aspect = old_width / old_height;
+	if ( letterbox_image(src, dst->pixels) != 0 ){
+		Log::warning("Failed to letterbox '%s'\n", name);
+		return image_ptr();
+	}
 
-	float new_width  = static_cast<float>(width);
-	float new_height = static_cast<float>(height);
-	const float new_aspect = new_width / new_height;
+	return dst;
+}
 
-	if ( old_aspect > new_aspect ){
-		new_height = new_width * (old_height / old_width);
-	} else {
-		new_width = new_height * (old_width / old_height);
+void graphics_swap_textures(){
+	current = (current + 1) % static_cast<unsigned int>(ring.size());
+	if ( staged > 0 ) staged--;
+	counter++;
+}
+
+unsigned int graphics_staged(){
+	return staged;
+}
+
+unsigned int graphics_stage_capacity(){
+	/* current and previous slide cannot be overwritten */
+	return static_cast<unsigned int>(ring.size()) - 2;
+}
+
+void graphics_discard_staged(){
+	staged = 0;
+}
+
+static image_ptr decode(const char* name, const Buffer& data, int letterbox){
+	/* native decoders may reduce the size already while decoding */
+	image_ptr image;
+	{
+		Metrics::Timer timer(Metrics::Decode);
+		image = Decoder::decode(data.data(), data.size(), letterbox ? width : 0, letterbox ? height : 0);
+		if ( !image ){
+			image = devil_decode(name, data);
+		}
 	}
 
-	Log::debug("  Letterboxed resolution: %dx%d\n", (int)new_width, (int)new_height);
+	/* skip letterboxing if the size is already correct (slides from frontend is already rendered correct) */
+	if ( image && letterbox && !(image->width == width && image->height == height) ){
+		image = apply_letterbox(name, *image);
+	}
 
-	iluImageParameter(ILU_FILTER, ILU_BILINEAR);
-	iluScale(static_cast<ILuint>(new_width), static_cast<ILuint>(new_height), depth);
+	return image;
+}
 
-	const int offset_x = (width  - static_cast<int>(new_width )) / 2;
-	const int offset_y = (height - static_cast<int>(new_height)) / 2;
-	ilBindImage(dst);
-	ilTexImage(width, height, depth, bpp, format, type, NULL);
+/**
+ * Get a decoded image from the memory cache or, if persistent, the raster
+ * cache.
+ */
+static image_ptr cache_get(const char* name, const std::string& key, bool persistent, unsigned int generation){
+	image_ptr cached = ImageCache::get(key);
+	if ( cached ){
+		log_debug("Loading '%s' from cache.\n", name);
+		return cached;
+	}
 
-	/* clear image */
-	unsigned char black[width*4];
-	memset(black, 0, width*4);
-	for ( int i = 0; i < height; i++ ){
-		ilSetPixels(0, i, 0, width, 1, 0, format, type, black);
+	if ( persistent && (cached = RasterCache::load(key)) ){
+		log_debug("Loading '%s' from raster cache.\n", name);
+		ImageCache::put(key, cached, generation);
+		return cached;
 	}
 
-	/* render image centered */
-	ilOverlayImage(src, offset_x, offset_y, 0);
-	iluFlipImage();
+	return image_ptr();
 }
 
-void graphics_swap_textures(){
-	const unsigned int tmp = texture[0];
-	texture[0] = texture[1];
-	texture[1] = tmp;
-	counter++;
+static void cache_put(const std::string& key, image_ptr image, bool persistent, unsigned int generation){
+	ImageCache::put(key, image, generation);
+	if ( persistent ){
+		RasterCache::store(key, *image);
+	}
 }
 
-int graphics_load_image(const char* name, int letterbox){
-	graphics_swap_textures();
-	glBindTexture(GL_TEXTURE_2D, texture[0]);
+static image_ptr load_file(const char* name, int letterbox, unsigned int generation){
+	/* only sources with a tag is cached as there is no way to tell if the
+	 * cached copy is still valid otherwise */
+	std::string tag;
+	std::string key;
+	if ( source_tag(name, tag) ){
+		key = ImageCache::key(name, tag.c_str(), width, height, letterbox);
+		image_ptr cached = cache_get(name, key, true, generation);
+		if ( cached ){
+			return cached;
+		}
+	}
 
-	/* null is passed when the screen should go blank (e.g. queue is empty) */
-	if ( !name ){
-		return load_blank();
+	buffer_ptr data;
+	{
+		Metrics::Timer timer(Metrics::Fetch);
+		if ( read_file(name, data) == -1 ){
+			return image_ptr();
+		}
+	}
+
+	image_ptr image = decode(name, *data, letterbox);
+	if ( image && !key.empty() ){
+		cache_put(key, image, true, generation);
 	}
 
-	ILuint image[2];
-	ilGenImages(2, image);
+	return image;
+}
+
+/**
+ * Remote images is cached by the HTTP validator (ETag or Last-Modified) so a
+ * cached copy is revalidated with a conditional request instead of being
+ * downloaded and decoded again.
+ */
+static image_ptr load_url(const char* name, int letterbox, unsigned int generation){
+	std::unique_ptr<char, free_delete> known(http_validator(name));
+	image_ptr cached;
+
+	if ( known ){
+		cached = cache_get(name, ImageCache::key(name, known.get(), width, height, letterbox), true, generation);
+	} else if ( (cached = ImageCache::get(ImageCache::key(name, "", width, height, letterbox))) ){
+		/* the server sent no validator, assume the image doesn't change
+		 * until the cache is cleared (i.e. the queue is reloaded) */
+		log_debug("Loading '%s' from cache.\n", name);
+		http_discard(name);
+		return cached;
+	}
 
+	buffer_ptr data;
+	std::unique_ptr<char, free_delete> validator;
 	int ret;
-	if ( is_url(name) ) {
-		ret = load_url(name, image[0]);
+	try {
+		Metrics::Timer timer(Metrics::Fetch);
+		ret = read_url(name, cached ? known.get() : NULL, data, validator);
+	} catch ( exception& e ){
+		/* this might run on the loader thread so the exception cannot be passed on */
+		Log::warning("%s\n", e.what());
+		return image_ptr();
+	}
+
+	if ( ret == 1 ){
+		return cached;
+	}
+
+	/* the image might still be in the raster cache from a previous run */
+	const std::string key = ImageCache::key(name, validator ? validator.get() : "", width, height, letterbox);
+	if ( validator && (cached = cache_get(name, key, true, generation)) ){
+		return cached;
+	}
+
+	image_ptr image = decode(name, *data, letterbox);
+	if ( image ){
+		cache_put(key, image, !!validator, generation);
+	}
+
+	return image;
+}
+
+std::string graphics_source_tag(const char* name){
+	std::string tag;
+	if ( is_url(name) ){
+		std::unique_ptr<char, free_delete> validator(http_validator(name));
+		if ( validator ){
+			tag = validator.get();
+		}
 	} else {
-		ret = load_file(name, image[0]);
+		source_tag(name, tag);
 	}
-	if ( ret == -1 ) return ret;
+	return tag;
+}
+
+image_ptr graphics_decode_image(const char* name, int letterbox){
+	assert(name);
+
+	/* read generation before decoding so a cache clear during decoding is detected */
+	const unsigned int generation = ImageCache::generation();
 
-	if ( letterbox ){
-		apply_letterbox(image[0], image[1]);
+	if ( is_url(name) ){
+		return load_url(name, letterbox, generation);
+	} else {
+		return load_file(name, letterbox, generation);
 	}
+}
 
-	/* copy data to texture */
-	const ILubyte* pixels = ilGetData();
-	const ILuint width  = ilGetInteger(IL_IMAGE_WIDTH);
-	const ILuint height = ilGetInteger(IL_IMAGE_HEIGHT);
-	const ILuint format = ilGetInteger(IL_IMAGE_FORMAT);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, format, GL_UNSIGNED_BYTE, pixels);
+/**
+ * Write the pixels to upload into dst, which must have room for a screen sized
+ * image in the source format. Images of other sizes is letterboxed (to RGB).
+ *
+ * @param format Set to the format of the written pixels.
+ */
+static int fill_pixels(const Image* image, unsigned char* dst, GLenum* format){
+	*format = GL_RGB;
 
-	/* free buffer */
-	ilDeleteImages(2, image);
+	/* null is passed when the screen should go blank (e.g. queue is empty) */
+	if ( !image ){
+		log_debug("Loading blank image.\n");
+		memset(dst, 0, static_cast<size_t>(width) * height * 3);
+		return 0;
+	}
+
+	if ( image->width == width && image->height == height ){
+		memcpy(dst, image->pixels, image->size);
+		*format = image->format;
+		return 0;
+	}
+
+	return letterbox_image(*image, dst);
+}
+
+/**
+ * Upload through a PBO so the copy to the texture happens asynchronously.
+ */
+static int upload_pbo(const Image* image){
+	const unsigned int i = pbo_index;
+	pbo_index = (pbo_index + 1) % PBO_RING;
+
+	/* wait until the previous transfer from this buffer has finished (it
+	 * normally has, it was several slides ago) */
+	if ( pbo_fence[i] ){
+		while ( glClientWaitSync(pbo_fence[i], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED ){
+			log_debug("Waiting for PBO %d to be released.\n", i);
+		}
+		glDeleteSync(pbo_fence[i]);
+		pbo_fence[i] = 0;
+	}
+
+	const GLsizeiptr size = static_cast<GLsizeiptr>(width) * height * 4;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[i]);
+	unsigned char* dst = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+
+	if ( !dst ){
+		Log::warning("Failed to map PBO (glMapBufferRange: 0x%x)\n", glGetError());
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return -1;
+	}
+
+	GLenum format;
+	const int ret = fill_pixels(image, dst, &format);
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	if ( ret == 0 ){
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, GL_UNSIGNED_BYTE, NULL);
+		pbo_fence[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
 
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	return ret == 0 ? 0 : -1;
+}
+
+/**
+ * Upload directly from system memory, blocks until the driver has copied it.
+ */
+static int upload_direct(const Image* image){
+	if ( image && image->width == width && image->height == height ){
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, image->format, GL_UNSIGNED_BYTE, image->pixels);
+		return 0;
+	}
+
+	std::unique_ptr<unsigned char, free_delete> tmp(static_cast<unsigned char*>(malloc(static_cast<size_t>(width) * height * 3)));
+	if ( !tmp ){
+		return -1;
+	}
+
+	GLenum format;
+	if ( fill_pixels(image, tmp.get(), &format) != 0 ){
+		return -1;
+	}
+
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, GL_UNSIGNED_BYTE, tmp.get());
 	return 0;
 }
 
+static int upload(const Image* image, GLuint texture){
+	Metrics::Timer timer(Metrics::Upload);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	return use_pbo ? upload_pbo(image) : upload_direct(image);
+}
+
+int graphics_upload_image(const Image* image){
+	graphics_discard_staged();
+	graphics_swap_textures();
+	return upload(image, ring_slot(0));
+}
+
+int graphics_stage_image(const Image* image){
+	if ( staged >= graphics_stage_capacity() ){
+		return -1;
+	}
+
+	const int ret = upload(image, ring_slot(static_cast<int>(staged) + 1));
+	if ( ret == 0 ){
+		staged++;
+	}
+	return ret;
+}
+
+int graphics_load_image(const char* name, int letterbox){
+	if ( !name ){
+		return graphics_upload_image(NULL);
+	}
+
+	image_ptr image = graphics_decode_image(name, letterbox);
+	if ( !image ){
+		return -1;
+	}
+
+	return graphics_upload_image(image.get());
+}
+
 static void default_render(transition_module_t transition, transition_context_t context){
 	glUseProgram(transition->shader);
 
@@ -415,7 +787,9 @@ int graphics_set_transition(const char* name, transition_module_t* mod){
 	}
 
 	/* load new */
+	loading_transition = name;
 	transition = (transition_module_t)module_open(name, TRANSITION_MODULE, 0);
+	loading_transition = NULL;
 	if ( !transition ){
 		Log::fatal("Failed to load transition plugin `%s'.\n", name);
 		return EINVAL;
@@ -453,71 +827,115 @@ static void check_log(GLuint target, const char* filename){
 	}
 }
 
-static int attach_shader(GLint sp, GLenum type, struct datapack_entry* src){
-	/* because sometimes c aliasing/const qualifier rules sucks */
-	union {
-		GLchar* rw;
-		const GLchar* ro;
-	} source;
-
-	unpack(src, &source.rw);
-	GLint shader = glCreateShader(type);
-	glShaderSource(shader, 1, &source.ro, 0);
+static GLuint compile_shader(GLenum type, const std::string& source, const char* filename){
+	const GLchar* ptr = source.c_str();
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &ptr, 0);
 	glCompileShader(shader);
-	free(source.rw);
 
 	GLint r;
-	check_log(shader, src->filename);
+	check_log(shader, filename);
 	glGetShaderiv(shader, GL_COMPILE_STATUS, &r);
 	if ( r == GL_FALSE ){
 		log_message(Log_Fatal, "Failed to compile shader\n");
-		return 1;
+		glDeleteShader(shader);
+		return 0;
 	}
 
-	glAttachShader(sp, shader);
-	return 0;
+	return shader;
 }
 
-GLuint graphics_load_shader(enum shader_spec_t spec, ...){
-	va_list ap;
-	va_start(ap, spec);
+struct shader_source_t {
+	GLenum type;
+	const char* filename;
+	std::string source;
+};
 
+static GLuint link_program(const std::vector<shader_source_t>& sources){
 	GLuint sp = glCreateProgram();
 	if ( !sp ) return 0;
 
-	while ( spec != SHADER_NONE ){
-		auto ptr = va_arg(ap, struct datapack_entry*);
-		int  ret = 0;
-
-		switch ( spec ){
-		case SHADER_VERTEX:
-			ret = attach_shader(sp, GL_VERTEX_SHADER, ptr);
-			break;
+	ShaderCache::prepare(sp);
 
-		case SHADER_FRAGMENT:
-			ret = attach_shader(sp, GL_FRAGMENT_SHADER, ptr);
-			break;
-
-		case SHADER_NONE:
+	std::vector<GLuint> shaders;
+	bool ok = true;
+	for ( const shader_source_t& it: sources ){
+		const GLuint shader = compile_shader(it.type, it.source, it.filename);
+		if ( !shader ){
+			ok = false;
 			break;
 		}
+		glAttachShader(sp, shader);
+		shaders.push_back(shader);
+	}
 
-		if ( ret != 0 ){
-			return 0;
+	/* link program */
+	if ( ok ){
+		GLint r;
+		glLinkProgram(sp);
+		check_log(sp, "during linkage");
+		glGetProgramiv(sp, GL_LINK_STATUS, &r);
+		if ( r == GL_FALSE ){
+			log_message(Log_Fatal, "Failed to link program\n");
+			ok = false;
 		}
+	}
 
-		spec = (enum shader_spec_t)va_arg(ap, int);
+	/* shader objects isn't needed once linked */
+	for ( const GLuint shader: shaders ){
+		glDetachShader(sp, shader);
+		glDeleteShader(shader);
 	}
 
-	/* link program */
-	GLint r;
-	glLinkProgram(sp);
-	check_log(sp, "during linkage");
-	glGetProgramiv(sp, GL_LINK_STATUS, &r);
-	if ( r == GL_FALSE ){
-		log_message(Log_Fatal, "Failed to link program\n");
+	if ( !ok ){
+		glDeleteProgram(sp);
 		return 0;
 	}
+
+	return sp;
+}
+
+GLuint graphics_load_shader(enum shader_spec_t spec, ...){
+	std::vector<shader_source_t> sources;
+	va_list ap;
+	va_start(ap, spec);
+
+	while ( spec != SHADER_NONE ){
+		auto ptr = va_arg(ap, struct datapack_entry*);
+		char* source;
+		unpack(ptr, &source);
+
+		shader_source_t it;
+		it.type = spec == SHADER_VERTEX ? GL_VERTEX_SHADER : GL_FRAGMENT_SHADER;
+		it.filename = ptr->filename;
+		it.source = source;
+		sources.push_back(it);
+		free(source);
+
+		spec = (enum shader_spec_t)va_arg(ap, int);
+	}
+	va_end(ap);
+
+	/* programs is cached by transition, driver and sources so switching
+	 * transitions (or restarting) doesn't run the compiler again */
+	std::string key = loading_transition ? loading_transition : "";
+	key += '\n';
+	key += reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+	key += '\n';
+	key += reinterpret_cast<const char*>(glGetString(GL_VERSION));
+	for ( const shader_source_t& it: sources ){
+		char buf[32];
+		snprintf(buf, sizeof(buf), "\n%x %zu\n", it.type, it.source.size());
+		key += buf;
+		key += it.source;
+	}
+
+	GLuint sp = ShaderCache::load(key);
+	if ( !sp ){
+		sp = link_program(sources);
+		if ( !sp ) return 0;
+		ShaderCache::store(key, sp);
+	}
 	glUseProgram(sp);
 
 	/* setup texture units */
@@ -33,10 +33,34 @@ enum shader_spec_t {
 	SHADER_FRAGMENT,
 };
 
-int graphics_init(int width, int height);
+/**
+ * @param ring_size Number of slide textures (at least 2). Slides beyond the
+ *                  current and previous can be uploaded ahead of time.
+ */
+int graphics_init(int width, int height, unsigned int ring_size);
 int graphics_cleanup();
 void graphics_render(float state);
+
+/**
+ * Advance the texture ring one slide, making the first staged slide (if any)
+ * current.
+ */
 void graphics_swap_textures();
+
+/**
+ * Number of slides uploaded ahead of the current slide.
+ */
+unsigned int graphics_staged();
+
+/**
+ * Maximum number of slides which can be staged (ring size - 2).
+ */
+unsigned int graphics_stage_capacity();
+
+/**
+ * Forget all staged slides, e.g. when the queue has changed.
+ */
+void graphics_discard_staged();
 int graphics_load_image(const char* filename, int letterbox);
 int graphics_set_transition(const char* name, transition_module_t* mod);
 
@@ -45,6 +69,7 @@ int graphics_set_transition(const char* name, transition_module_t* mod);
  *   GLuint sp = graphics_load_shader(SHADER_VERTEX, &datapack_handle, SHADER_FRAGMENT, &datapack_handle, SHADER_NONE);
  *
  * The shader will stay loaded, manually call glUseProgram(..) to unload/change.
+ * Programs is cached (see ShaderCache) and shared, don't delete it.
  *
  * @return Non-zero if successful, 0 on errors (which is written to log).
  */
@@ -60,4 +85,45 @@ void graphics_render_fsquad();
 }
 #endif
 
+#ifdef __cplusplus
+#include "core/image.hpp"
+#include <string>
+
+/**
+ * Load an image into system memory, optionally applying letterboxing. No GL
+ * calls are made so it is safe to call from a worker thread.
+ *
+ * @return NULL on errors (which is written to log).
+ */
+image_ptr graphics_decode_image(const char* filename, int letterbox);
+
+/**
+ * Tag of the current version of a source: mtime and size for local files and
+ * the HTTP validator for remote images. Compare with a tag read before
+ * decoding to tell if a decoded image is still valid.
+ *
+ * @return Empty if unknown, i.e. the source must be assumed to have changed.
+ */
+std::string graphics_source_tag(const char* filename);
+
+/**
+ * Advance the texture ring and upload an image decoded by
+ * graphics_decode_image, discarding any staged slides. Pass NULL to upload a
+ * blank image. Images not matching the screen resolution is
+ * letterboxed as the textures have fixed size.
+ *
+ * When PBOs are available the upload is asynchronous: this function returns
+ * as soon as the pixels are copied to the PBO.
+ */
+int graphics_upload_image(const Image* image);
+
+/**
+ * Upload an image to the next free ring slot ahead of time. It becomes the
+ * current slide when graphics_swap_textures is called.
+ *
+ * @return -1 if there is no free slot or the upload failed.
+ */
+int graphics_stage_image(const Image* image);
+#endif
+
 #endif /* SLIDESHOW_GRAPHICS_H */
@@ -0,0 +1,591 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2012 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "core/http.h"
+#include "core/buffer_pool.hpp"
+#include "core/log.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define MAX_PREFETCH 8
+#define MAX_HOST_CONNECTIONS 4
+#define MAX_VALIDATORS 4096
+
+typedef std::chrono::steady_clock clock_type;
+
+struct validator_t {
+	std::string etag;
+	std::string last_modified;
+	clock_type::time_point expires;  /* fresh until (no revalidation needed) */
+
+	const std::string& tag() const { return etag.empty() ? last_modified : etag; }
+};
+
+struct http_request {
+	CURL* handle;
+	std::string url;
+	buffer_ptr body;         /* allocated when the size is known or on first write */
+	long status;             /* -1 on transfer errors */
+	bool done;
+	bool cancelled;          /* released by the caller, owned by the worker */
+	char error[CURL_ERROR_SIZE];
+	struct curl_slist* headers;
+	std::string sent;        /* validator sent in the conditional request */
+	validator_t received;
+	long max_age;            /* -1 if not sent */
+	int notify_fd;           /* eventfd to signal when done, or -1 */
+};
+
+static std::thread worker;
+static std::mutex lock;                   /* protects everything below */
+static std::condition_variable cond;      /* signaled when a request is done */
+static CURLM* multi = NULL;
+static bool running = false;
+static std::vector<http_request_t*> pending;   /* not yet added to the multi handle */
+static std::list<http_request_t*> active;      /* only touched by worker */
+static std::list<http_request_t*> prefetched;  /* oldest first */
+static std::map<std::string, validator_t> validators;
+
+static size_t write_body(char* ptr, size_t size, size_t nmemb, void* data){
+	http_request_t* request = static_cast<http_request_t*>(data);
+	const size_t bytes = size * nmemb;
+	if ( !request->body ){
+		request->body = BufferPool::acquire();
+	}
+
+	/* called from libcurl, exceptions must not escape (returning less than
+	 * bytes aborts the transfer) */
+	const size_t needed = request->body->size() + bytes;
+	if ( needed > BUFFER_MAX_SIZE ){
+		return 0;
+	}
+
+	/* only grow when it doesn't fit (the buffer might be presized from
+	 * Content-Length), doubling to avoid reallocating on each chunk */
+	if ( needed > request->body->capacity() ){
+		const size_t grow = std::min(std::max(needed, request->body->capacity() * 2), static_cast<size_t>(BUFFER_MAX_SIZE));
+		if ( !request->body->try_reserve(grow) ){
+			return 0;
+		}
+	}
+
+	request->body->append(ptr, bytes);
+	return bytes;
+}
+
+static bool header_is(const char* line, size_t length, const char* name, const char** value, size_t* value_length){
+	const size_t n = strlen(name);
+	if ( length <= n || strncasecmp(line, name, n) != 0 || line[n] != ':' ){
+		return false;
+	}
+
+	/* trim whitespace and CRLF */
+	const char* begin = line + n + 1;
+	const char* end = line + length;
+	while ( begin < end && (*begin == ' ' || *begin == '\t') ) begin++;
+	while ( end > begin && (end[-1] == '\r' || end[-1] == '\n' || end[-1] == ' ') ) end--;
+
+	*value = begin;
+	*value_length = static_cast<size_t>(end - begin);
+	return true;
+}
+
+static size_t write_header(char* ptr, size_t size, size_t nmemb, void* data){
+	http_request_t* request = static_cast<http_request_t*>(data);
+	const size_t bytes = size * nmemb;
+	const char* value;
+	size_t length;
+
+	/* new response (e.g. after "100 Continue") */
+	if ( bytes > 5 && strncmp(ptr, "HTTP/", 5) == 0 ){
+		request->received = validator_t();
+		request->max_age = -1;
+		if ( request->body ){
+			request->body->clear();
+		}
+	} else if ( header_is(ptr, bytes, "Content-Length", &value, &length) ){
+		/* allocate the whole body up front, unless it is too large to accept
+		 * (which aborts the transfer) */
+		const size_t content_length = strtoul(std::string(value, length).c_str(), NULL, 10);
+		if ( content_length > BUFFER_MAX_SIZE ){
+			return 0;
+		}
+		if ( !request->body ){
+			request->body = BufferPool::acquire(content_length);
+		}
+		if ( !request->body->try_reserve(content_length) ){
+			return 0;
+		}
+	} else if ( header_is(ptr, bytes, "ETag", &value, &length) ){
+		request->received.etag.assign(value, length);
+	} else if ( header_is(ptr, bytes, "Last-Modified", &value, &length) ){
+		request->received.last_modified.assign(value, length);
+	} else if ( header_is(ptr, bytes, "Cache-Control", &value, &length) ){
+		const std::string directives(value, length);
+		const size_t pos = directives.find("max-age=");
+		if ( directives.find("no-cache") != std::string::npos ){
+			request->max_age = 0;
+		} else if ( pos != std::string::npos ){
+			request->max_age = strtol(directives.c_str() + pos + 8, NULL, 10);
+		}
+	}
+
+	return bytes;
+}
+
+/**
+ * Worker: remember validators of a finished request. Must hold lock.
+ */
+static void update_validator(http_request_t* request){
+	const clock_type::time_point expires = clock_type::now() + std::chrono::seconds(std::max(request->max_age, 0L));
+
+	if ( request->status == HTTP_NOT_MODIFIED ){
+		auto it = validators.find(request->url);
+		if ( it != validators.end() ){
+			it->second.expires = expires;
+		}
+		return;
+	}
+
+	if ( request->status != 200 ){
+		return;
+	}
+
+	if ( request->received.tag().empty() ){
+		validators.erase(request->url);
+		return;
+	}
+
+	if ( validators.size() >= MAX_VALIDATORS && validators.find(request->url) == validators.end() ){
+		validators.erase(validators.begin());
+	}
+
+	request->received.expires = expires;
+	validators[request->url] = request->received;
+}
+
+/**
+ * Worker: mark a request as finished (or release it if nobody is waiting).
+ * Must hold lock.
+ */
+static void finish(http_request_t* request, long status){
+	curl_multi_remove_handle(multi, request->handle);
+	curl_easy_cleanup(request->handle);
+	curl_slist_free_all(request->headers);
+	request->handle = NULL;
+	request->headers = NULL;
+	request->status = status;
+	request->done = true;
+	update_validator(request);
+
+	if ( request->notify_fd != -1 ){
+		const uint64_t value = 1;
+		if ( write(request->notify_fd, &value, sizeof(value)) != sizeof(value) ){
+			Log::warning("HTTP: failed to signal completion: %s\n", strerror(errno));
+		}
+	}
+
+	if ( request->cancelled ){
+		delete request;
+	}
+}
+
+static void run(){
+	std::unique_lock<std::mutex> guard(lock);
+	while ( running ){
+		for ( http_request_t* request: pending ){
+			curl_multi_add_handle(multi, request->handle);
+			active.push_back(request);
+		}
+		pending.clear();
+
+		/* abort cancelled transfers */
+		for ( auto it = active.begin(); it != active.end(); ){
+			if ( (*it)->cancelled ){
+				finish(*it, -1);
+				it = active.erase(it);
+			} else {
+				++it;
+			}
+		}
+
+		guard.unlock();
+
+		int still_running;
+		curl_multi_perform(multi, &still_running);
+
+		guard.lock();
+
+		CURLMsg* msg;
+		int left;
+		bool notify = false;
+		while ( (msg = curl_multi_info_read(multi, &left)) ){
+			if ( msg->msg != CURLMSG_DONE ) continue;
+
+			http_request_t* request = NULL;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &request);
+
+			long status = -1;
+			if ( msg->data.result == CURLE_OK ){
+				curl_easy_getinfo(request->handle, CURLINFO_RESPONSE_CODE, &status);
+			} else {
+				Log::warning("HTTP: %s: %s\n", request->url.c_str(), request->error[0] ? request->error : curl_easy_strerror(msg->data.result));
+			}
+
+			active.remove(request);
+			finish(request, status);
+			notify = true;
+		}
+
+		if ( notify ){
+			cond.notify_all();
+		}
+
+		if ( !pending.empty() || !running ){
+			continue;
+		}
+
+		guard.unlock();
+#if LIBCURL_VERSION_NUM >= 0x074400 /* 7.68.0 */
+		curl_multi_poll(multi, NULL, 0, 1000, NULL);
+#else
+		curl_multi_wait(multi, NULL, 0, 100, NULL);
+#endif
+		guard.lock();
+	}
+
+	/* abort remaining transfers */
+	for ( http_request_t* request: pending ){
+		curl_multi_add_handle(multi, request->handle);
+		active.push_back(request);
+	}
+	pending.clear();
+	for ( http_request_t* request: active ){
+		finish(request, -1);
+	}
+	active.clear();
+	cond.notify_all();
+}
+
+static void wakeup(){
+#if LIBCURL_VERSION_NUM >= 0x074400
+	curl_multi_wakeup(multi);
+#endif
+}
+
+/**
+ * Find and remove a prefetched request. Must hold lock.
+ */
+static http_request_t* take_prefetched(const char* url){
+	for ( auto it = prefetched.begin(); it != prefetched.end(); ++it ){
+		if ( (*it)->url == url ){
+			http_request_t* request = *it;
+			prefetched.erase(it);
+			return request;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Release a request. Must hold lock.
+ */
+static void release(http_request_t* request){
+	if ( request->done ){
+		delete request;
+	} else {
+		/* the caller might close the fd right after, the worker must not
+		 * signal it when the transfer is aborted */
+		request->notify_fd = -1;
+		request->cancelled = true;
+	}
+}
+
+int http_init(){
+	multi = curl_multi_init();
+	if ( !multi ){
+		Log::fatal("HTTP: Failed to initialize curl\n");
+		return -1;
+	}
+
+	curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+	curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, MAX_HOST_CONNECTIONS);
+
+	running = true;
+	worker = std::thread(run);
+	return 0;
+}
+
+void http_cleanup(){
+	if ( !multi ) return;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		running = false;
+		for ( http_request_t* request: prefetched ){
+			release(request);
+		}
+		prefetched.clear();
+	}
+
+	wakeup();
+	worker.join();
+
+	curl_multi_cleanup(multi);
+	multi = NULL;
+}
+
+/**
+ * Start a request, if conditional is set and there is a known validator for
+ * the url it is sent as a conditional request.
+ */
+static http_request_t* fetch(const char* url, struct curl_httppost* form, bool conditional, int notify_fd = -1){
+	if ( !multi ){
+		Log::warning("HTTP: Client not initialized, cannot fetch `%s'\n", url);
+		return NULL;
+	}
+
+	CURL* handle = curl_easy_init();
+	if ( !handle ){
+		return NULL;
+	}
+
+	http_request_t* request = new http_request_t;
+	request->handle = handle;
+	request->url = url;
+	request->status = -1;
+	request->done = false;
+	request->cancelled = false;
+	request->error[0] = 0;
+	request->headers = NULL;
+	request->max_age = -1;
+	request->notify_fd = notify_fd;
+
+	curl_easy_setopt(handle, CURLOPT_URL, url);
+	curl_easy_setopt(handle, CURLOPT_PRIVATE, request);
+	curl_easy_setopt(handle, CURLOPT_ERRORBUFFER, request->error);
+	curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, write_body);
+	curl_easy_setopt(handle, CURLOPT_WRITEDATA, request);
+	curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, write_header);
+	curl_easy_setopt(handle, CURLOPT_HEADERDATA, request);
+	curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+	curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L); /* prefer multiplexing over new connections */
+#ifdef CURL_HTTP_VERSION_2TLS
+	curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+#endif
+	if ( form ){
+		curl_easy_setopt(handle, CURLOPT_HTTPPOST, form);
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		auto it = validators.find(request->url);
+		if ( conditional && it != validators.end() ){
+			const validator_t& validator = it->second;
+			if ( !validator.etag.empty() ){
+				request->headers = curl_slist_append(request->headers, ("If-None-Match: " + validator.etag).c_str());
+			}
+			if ( !validator.last_modified.empty() ){
+				request->headers = curl_slist_append(request->headers, ("If-Modified-Since: " + validator.last_modified).c_str());
+			}
+			request->sent = validator.tag();
+			curl_easy_setopt(handle, CURLOPT_HTTPHEADER, request->headers);
+		}
+
+		pending.push_back(request);
+	}
+
+	wakeup();
+	return request;
+}
+
+http_request_t* http_fetch(const char* url, struct curl_httppost* form){
+	return fetch(url, form, false);
+}
+
+http_request_t* http_fetch_notify(const char* url, struct curl_httppost* form, int notify_fd){
+	return fetch(url, form, false, notify_fd);
+}
+
+int http_done(http_request_t* request){
+	std::lock_guard<std::mutex> guard(lock);
+	return request->done;
+}
+
+/**
+ * As http_wait but also returns the validator of the response.
+ */
+static long wait(http_request_t* request, buffer_ptr& body, std::string* validator){
+	std::unique_lock<std::mutex> guard(lock);
+	cond.wait(guard, [request]{ return request->done; });
+
+	const long status = request->status;
+	if ( validator ){
+		*validator = status == HTTP_NOT_MODIFIED ? request->sent : request->received.tag();
+	}
+
+	body = std::move(request->body);
+	if ( !body ){
+		body = BufferPool::acquire();
+	}
+
+	delete request;
+	return status;
+}
+
+/**
+ * Copy the body for the C api.
+ */
+static void copy_body(const Buffer& body, char** data, size_t* size){
+	if ( data ){
+		*data = static_cast<char*>(malloc(body.size() + 1));
+		memcpy(*data, body.data(), body.size());
+		(*data)[body.size()] = 0;
+	}
+	if ( size ){
+		*size = body.size();
+	}
+}
+
+long http_wait(http_request_t* request, char** data, size_t* size){
+	buffer_ptr body;
+	const long status = wait(request, body, NULL);
+	copy_body(*body, data, size);
+	return status;
+}
+
+void http_cancel(http_request_t* request){
+	if ( !request ) return;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		release(request);
+	}
+
+	wakeup();
+}
+
+void http_prefetch(const char* url){
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		for ( http_request_t* request: prefetched ){
+			if ( request->url == url ) return;
+		}
+	}
+
+	/* conditional as the caller might have a copy */
+	http_request_t* request = fetch(url, NULL, true);
+	if ( !request ) return;
+
+	std::lock_guard<std::mutex> guard(lock);
+	prefetched.push_back(request);
+	if ( prefetched.size() > MAX_PREFETCH ){
+		release(prefetched.front());
+		prefetched.pop_front();
+	}
+}
+
+void http_discard(const char* url){
+	std::lock_guard<std::mutex> guard(lock);
+	http_request_t* request = take_prefetched(url);
+	if ( request ){
+		release(request);
+	}
+}
+
+long http_get(const char* url, char** data, size_t* size){
+	buffer_ptr body;
+	const long status = http_get_conditional(url, NULL, body, NULL);
+	copy_body(*body, data, size);
+	return status;
+}
+
+char* http_validator(const char* url){
+	std::lock_guard<std::mutex> guard(lock);
+	auto it = validators.find(url);
+	if ( it == validators.end() ){
+		return NULL;
+	}
+	return strdup(it->second.tag().c_str());
+}
+
+long http_get_conditional(const char* url, const char* validator, buffer_ptr& data, char** new_validator){
+	data = BufferPool::acquire();
+	if ( new_validator ) *new_validator = NULL;
+
+	http_request_t* request;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		request = take_prefetched(url);
+
+		/* the copy is still fresh, no need to ask the server */
+		auto it = validators.find(url);
+		if ( validator && it != validators.end() && it->second.tag() == validator && clock_type::now() < it->second.expires ){
+			log_debug("HTTP: `%s' is fresh\n", url);
+			if ( request ){
+				release(request);
+			}
+			return HTTP_NOT_MODIFIED;
+		}
+	}
+
+	if ( request ){
+		log_debug("HTTP: Using prefetched `%s'\n", url);
+	} else if ( !(request = fetch(url, NULL, validator != NULL)) ){
+		return -1;
+	}
+
+	std::string tag;
+	long status = wait(request, data, &tag);
+
+	if ( status == HTTP_NOT_MODIFIED ){
+		if ( validator && tag == validator ){
+			return HTTP_NOT_MODIFIED;
+		}
+
+		/* revalidated a copy the caller doesn't have (e.g. prefetched) */
+		if ( !(request = fetch(url, NULL, false)) ){
+			return -1;
+		}
+		status = wait(request, data, &tag);
+	}
+
+	if ( new_validator && !tag.empty() ){
+		*new_validator = strdup(tag.c_str());
+	}
+
+	return status;
+}
@@ -0,0 +1,134 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2012 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SLIDESHOW_HTTP_H
+#define SLIDESHOW_HTTP_H
+
+#include <stddef.h>
+#include <curl/curl.h>
+
+/**
+ * Shared HTTP client. All transfers runs on a single curl multi handle in a
+ * background thread so connections are kept alive and reused (multiplexed
+ * using HTTP/2 when the server supports it) and callers never drive the
+ * transfer themselves. All functions are thread-safe.
+ *
+ * Validators (ETag and Last-Modified) and Cache-Control max-age of responses
+ * are remembered per url so callers keeping their own copy of a resource can
+ * revalidate it using http_get_conditional.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct http_request http_request_t;
+
+#define HTTP_NOT_MODIFIED 304
+
+int http_init();
+void http_cleanup();
+
+/**
+ * Start a transfer in the background and return immediately.
+ *
+ * @param form Optional form to POST, must remain valid until the request is
+ *             finished (i.e. http_wait or http_cancel returns).
+ * @return NULL on errors.
+ */
+http_request_t* http_fetch(const char* url, struct curl_httppost* form);
+
+/**
+ * As http_fetch but writes to the eventfd notify_fd when the transfer is
+ * finished, so completion can be handled by an event loop (using http_done
+ * and http_wait, which then won't block).
+ */
+http_request_t* http_fetch_notify(const char* url, struct curl_httppost* form, int notify_fd);
+
+/**
+ * @return Non-zero if the transfer is finished.
+ */
+int http_done(http_request_t* request);
+
+/**
+ * Block until the transfer is finished and release the request.
+ *
+ * @param data Set to a nul-terminated copy of the body which the caller must
+ *             free. May be NULL if the body isn't needed.
+ * @param size Body size (excluding the terminator), may be NULL.
+ * @return HTTP response code or -1 if the transfer failed.
+ */
+long http_wait(http_request_t* request, char** data, size_t* size);
+
+/**
+ * Release a request without waiting for it. Unfinished transfers is aborted.
+ */
+void http_cancel(http_request_t* request);
+
+/**
+ * Hint that url is about to be requested by http_get, so the transfer is
+ * started right away. Only a few prefetches is kept, the oldest is dropped.
+ */
+void http_prefetch(const char* url);
+
+/**
+ * Drop a prefetch which turned out not to be needed (e.g. the image was
+ * already cached).
+ */
+void http_discard(const char* url);
+
+/**
+ * Fetch url, using the prefetched transfer if there is one. Blocks until
+ * finished, see http_wait for parameters.
+ */
+long http_get(const char* url, char** data, size_t* size);
+
+/**
+ * Get the validator (ETag or, if the server sent none, Last-Modified) of the
+ * last response for url.
+ *
+ * @return Validator which the caller must free, or NULL if unknown.
+ */
+char* http_validator(const char* url);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef __cplusplus
+#include "core/buffer_pool.hpp"
+
+/**
+ * Fetch url unless the caller's copy is still valid. The copy is revalidated
+ * using If-None-Match/If-Modified-Since, or not at all if it is still fresh
+ * according to Cache-Control max-age.
+ *
+ * @param validator Validator (from http_validator) of the copy the caller
+ *                  has, or NULL if it has none.
+ * @param data Set to the body (empty if not modified), which goes back to
+ *             the buffer pool when released.
+ * @param new_validator Set to the validator of the returned body which the
+ *                      caller must free (NULL if the server sent none). May be
+ *                      NULL.
+ * @return HTTP_NOT_MODIFIED if the copy is still valid, otherwise as
+ *         http_wait.
+ */
+long http_get_conditional(const char* url, const char* validator, buffer_ptr& data, char** new_validator);
+#endif
+
+#endif /* SLIDESHOW_HTTP_H */
@@ -0,0 +1,49 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2014 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "core/image.hpp"
+#include <cstdlib>
+
+Image::Image(int width, int height, GLenum format, unsigned int bpp)
+	: width(width)
+	, height(height)
+	, format(format)
+	, bpp(bpp)
+	, size(static_cast<size_t>(width) * static_cast<size_t>(height) * bpp)
+	, pixels(NULL) {
+
+	pixels = static_cast<unsigned char*>(malloc(size));
+}
+
+Image::Image(int width, int height, GLenum format, unsigned int bpp, unsigned char* pixels)
+	: width(width)
+	, height(height)
+	, format(format)
+	, bpp(bpp)
+	, size(static_cast<size_t>(width) * static_cast<size_t>(height) * bpp)
+	, pixels(pixels) {
+
+}
+
+Image::~Image(){
+	free(pixels);
+}
@@ -0,0 +1,59 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2014 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SLIDESHOW_IMAGE_HPP
+#define SLIDESHOW_IMAGE_HPP
+
+#include "core/opengl.h"
+#include <cstddef>
+#include <memory>
+
+/**
+ * Decoded image in system memory, ready to be uploaded to a texture.
+ * Rows are tightly packed (no padding) and stored in the order GL expects.
+ */
+class Image {
+public:
+	/**
+	 * Allocate storage for a width x height image with bpp bytes per pixel.
+	 */
+	Image(int width, int height, GLenum format, unsigned int bpp);
+	virtual ~Image();
+
+	int width;
+	int height;
+	GLenum format;         /* pixel format as passed to glTexImage2D */
+	unsigned int bpp;      /* bytes per pixel */
+	size_t size;           /* size of pixels in bytes */
+	unsigned char* pixels;
+
+protected:
+	/**
+	 * Use existing storage. The subclass is responsible for releasing it and
+	 * must reset pixels to NULL in its destructor.
+	 */
+	Image(int width, int height, GLenum format, unsigned int bpp, unsigned char* pixels);
+
+private:
+	Image(const Image&);
+	Image& operator=(const Image&);
+};
+
+typedef std::shared_ptr<Image> image_ptr;
+
+#endif /* SLIDESHOW_IMAGE_HPP */
@@ -0,0 +1,116 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2014 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "core/image_cache.hpp"
+#include "core/log.hpp"
+#include <cstdio>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+typedef std::pair<std::string, image_ptr> entry_t;
+typedef std::list<entry_t> lru_t;
+
+static std::mutex lock;
+static lru_t lru;                                           /* most recently used first */
+static std::unordered_map<std::string, lru_t::iterator> index;
+static size_t budget = 64 * 1024 * 1024;
+static size_t used = 0;
+static unsigned int current_generation = 0;
+
+/**
+ * Evict least recently used images until the budget is satisfied. Caller
+ * must hold lock.
+ */
+static void evict(){
+	while ( used > budget && !lru.empty() ){
+		const entry_t& entry = lru.back();
+		used -= entry.second->size;
+		index.erase(entry.first);
+		lru.pop_back();
+	}
+}
+
+namespace ImageCache {
+
+	void set_budget(size_t bytes){
+		std::lock_guard<std::mutex> guard(lock);
+		budget = bytes;
+		evict();
+	}
+
+	std::string key(const char* filename, const char* tag, int width, int height, int letterbox){
+		char buf[64];
+		snprintf(buf, sizeof(buf), "|%dx%d|%d|", width, height, letterbox);
+		return std::string(filename) + buf + tag;
+	}
+
+	image_ptr get(const std::string& key){
+		std::lock_guard<std::mutex> guard(lock);
+
+		auto it = index.find(key);
+		if ( it == index.end() ){
+			return image_ptr();
+		}
+
+		/* move to front */
+		lru.splice(lru.begin(), lru, it->second);
+		return it->second->second;
+	}
+
+	void put(const std::string& key, image_ptr image, unsigned int generation){
+		std::lock_guard<std::mutex> guard(lock);
+
+		if ( generation != current_generation || image->size > budget ){
+			return;
+		}
+
+		auto it = index.find(key);
+		if ( it != index.end() ){
+			used -= it->second->second->size;
+			lru.erase(it->second);
+			index.erase(it);
+		}
+
+		lru.push_front(entry_t(key, image));
+		index[key] = lru.begin();
+		used += image->size;
+		evict();
+
+		log_debug("ImageCache: %zu images (%zu of %zu bytes)\n", lru.size(), used, budget);
+	}
+
+	unsigned int generation(){
+		std::lock_guard<std::mutex> guard(lock);
+		return current_generation;
+	}
+
+	void clear(){
+		std::lock_guard<std::mutex> guard(lock);
+		lru.clear();
+		index.clear();
+		used = 0;
+		current_generation++;
+	}
+
+}
@@ -0,0 +1,67 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2014 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SLIDESHOW_IMAGE_CACHE_HPP
+#define SLIDESHOW_IMAGE_CACHE_HPP
+
+#include "core/image.hpp"
+#include <string>
+
+/**
+ * Bounded LRU cache of decoded (and letterboxed) images so looping queues
+ * doesn't have to decode the same slides over and over. All functions are
+ * thread-safe.
+ */
+namespace ImageCache {
+
+	/**
+	 * Set the maximum number of bytes to keep cached (0 disables the cache).
+	 * Least recently used images are evicted if the new budget is smaller.
+	 */
+	void set_budget(size_t bytes);
+
+	/**
+	 * Create a cache key. The tag should change whenever the source changes
+	 * (e.g. mtime for local files).
+	 */
+	std::string key(const char* filename, const char* tag, int width, int height, int letterbox);
+
+	/**
+	 * Get a cached image.
+	 * @return NULL if not cached.
+	 */
+	image_ptr get(const std::string& key);
+
+	/**
+	 * Store an image. It is silently ignored if the cache has been cleared
+	 * since generation() was read, as the image might be stale.
+	 */
+	void put(const std::string& key, image_ptr image, unsigned int generation);
+
+	/**
+	 * Current generation, incremented each time the cache is cleared.
+	 */
+	unsigned int generation();
+
+	/**
+	 * Release all cached images.
+	 */
+	void clear();
+}
+
+#endif /* SLIDESHOW_IMAGE_CACHE_HPP */
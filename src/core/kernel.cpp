@@ -25,7 +25,15 @@
 #include "IPC/IPC.hpp"
 #include "core/module.h"
 #include "core/module_loader.h"
+#include "core/event_loop.hpp"
+#include "core/frame_scheduler.hpp"
 #include "core/graphics.h"
+#include "core/image_cache.hpp"
+#include "core/loader.hpp"
+#include "core/metrics.hpp"
+#include "core/raster_cache.hpp"
+#include "core/shader_cache.hpp"
+#include "core/scheduler.hpp"
 #include "path.h"
 #include "core/log.hpp"
 #include "core/exception.hpp"
@@ -47,11 +55,12 @@
 #include <cstdio>
 #include <cstring>
 #include <cassert>
+#include <algorithm>
 
 // Loading settings
 #include <curl/curl.h>
 #include <json.h>
-#include "curl_local.h"
+#include "core/http.h"
 
 // Platform
 #ifdef __GNUC__
@@ -70,16 +79,22 @@
 #endif
 
 static char* pidfile = NULL;
-static CURL* curl_handle_settings = NULL;
+static char* settings_url = NULL;
 static struct curl_httppost* settings_formpost = NULL;
 
+/* how often event sources without a fd is polled (in seconds) */
+static const double periodic_poll_interval = 0.1;
+
 Kernel::Kernel(const argument_set_t& arg, PlatformBackend* backend)
 	: _arg(arg)
 	, _password(NULL)
 	, _state(NULL)
 	, _browser(NULL)
 	, _backend(backend)
-	, _running(false) {
+	, _log_server(NULL)
+	, _queue_id(-1)
+	, _running(false)
+	, _periodic_poll(false) {
 
 	verify(_backend);
 
@@ -92,12 +107,20 @@ Kernel::~Kernel(){
 
 	free( _arg.connection_string );
 	free( _arg.transition_string );
+	free( _arg.raster_cache );
+	free( _arg.shader_cache );
+	free( _arg.metrics_socket );
+	free( _arg.schedule );
 	free( _arg.url );
 }
 
 void Kernel::init(){
 	Log::info("Kernel: Starting slideshow\n");
 
+	EventLoop::init();
+	init_log_server();
+	Metrics::listen(_arg.metrics_socket);
+	http_init();
 	init_backend();
 	init_graphics();
 	init_IPC();
@@ -108,14 +131,26 @@ void Kernel::init(){
 
 void Kernel::cleanup(){
 	VideoState::cleanup();
+	Loader::cleanup();
+	Scheduler::cleanup();
 	delete _state;
+	if ( _browser && _browser->change_fd != -1 ){
+		EventLoop::remove(_browser->change_fd);
+	}
 	module_close(&_browser->module);
 	graphics_cleanup();
+	RasterCache::cleanup();
+	ShaderCache::cleanup();
 	free(pidfile);
 	free(_password);
 
 	cleanup_IPC();
 	cleanup_backend();
+	http_cleanup();
+	BufferPool::clear();
+	Metrics::close();
+	cleanup_log_server();
+	EventLoop::cleanup();
 
 	_state = NULL;
 	_browser = NULL;
@@ -124,14 +159,50 @@ void Kernel::cleanup(){
 
 void Kernel::init_backend(){
 	_backend->init(Vector2ui(_arg.width, _arg.height), _arg.fullscreen > 0);
+
+	/* events is handled by poll, it only has to wake the loop */
+	const int fd = _backend->event_fd();
+	if ( fd == -1 || EventLoop::add(fd, NULL) != 0 ){
+		_periodic_poll = true;
+	}
 }
 
 void Kernel::cleanup_backend(){
+	EventLoop::remove(_backend->event_fd());
 	_backend->cleanup();
 }
 
+void Kernel::init_log_server(){
+	if ( !_arg.log_domain ) return;
+
+	/* clients may connect (and disconnect) at any time */
+	_log_server = new SocketServerDestination(_arg.log_domain);
+	if ( _log_server->fd() == -1 || EventLoop::add(_log_server->fd(), [this](){ _log_server->accept(); }) != 0 ){
+		Log::warning("Kernel: failed to listen on `%s', socket log disabled\n", _arg.log_domain);
+		delete _log_server;
+		_log_server = NULL;
+		return;
+	}
+
+	Log::add_destination(_log_server);
+	log_verbose("Kernel: Log clients accepted on `%s'\n", _arg.log_domain);
+}
+
+void Kernel::cleanup_log_server(){
+	/* Log releases the destination, connected clients gets the remaining
+	 * messages */
+	if ( _log_server ){
+		EventLoop::remove(_log_server->fd());
+		_log_server = NULL;
+	}
+}
+
 void Kernel::init_graphics(){
-	graphics_init(_arg.width, _arg.height);
+	ImageCache::set_budget(static_cast<size_t>(_arg.image_cache) * 1024 * 1024);
+	RasterCache::init(_arg.raster_cache, static_cast<size_t>(_arg.raster_cache_size) * 1024 * 1024);
+	ShaderCache::init(_arg.shader_cache);
+	FrameScheduler::init(_arg.refresh_rate);
+	graphics_init(_arg.width, _arg.height, static_cast<unsigned int>(std::max(_arg.texture_ring, 2)));
 	graphics_set_transition(_arg.transition_string ? _arg.transition_string : "fade", NULL);
 }
 
@@ -145,29 +216,38 @@ void Kernel::init_IPC(){
 	if ( (ipc=IPC::factory("dbus")) ) _ipc.push_back(ipc);
 #endif /* HAVE_DBUS */
 
+	for ( std::vector<struct ipc_module_t*>::iterator it = _ipc.begin(); it != _ipc.end(); ++it ){
+		struct ipc_module_t* ipc = *it;
+		if ( !ipc->poll ) continue;
+
+		if ( ipc->fd == -1 || EventLoop::add(ipc->fd, [ipc]{ ipc->poll(ipc, 0); }) != 0 ){
+			ipc->fd = -1;
+			_periodic_poll = true;
+		}
+	}
+
 	if ( _arg.url ){
-		char* settings_url = asprintf2("%s/instance/settings", _arg.url);
+		settings_url = asprintf2("%s/instance/settings", _arg.url);
 
-		/* get json data */
-		curl_handle_settings = curl_easy_init();
 		struct curl_httppost *lastptr = NULL;
 		curl_formadd(&settings_formpost, &lastptr, CURLFORM_COPYNAME, "name", CURLFORM_COPYCONTENTS, _arg.instance, CURLFORM_END);
-		curl_easy_setopt(curl_handle_settings, CURLOPT_URL, settings_url);
-		curl_easy_setopt(curl_handle_settings, CURLOPT_HTTPPOST, settings_formpost);
-		curl_easy_setopt(curl_handle_settings, CURLOPT_WRITEFUNCTION, curl_local_resize);
-		free(settings_url);
 	}
 }
 
 void Kernel::cleanup_IPC(){
 	for ( std::vector<struct ipc_module_t*>::iterator it = _ipc.begin(); it != _ipc.end(); ++it ){
 		struct ipc_module_t* ipc = *it;
+		if ( ipc->poll && ipc->fd != -1 ){
+			EventLoop::remove(ipc->fd);
+		}
 		module_close((module_t*)ipc);
 	}
 	_ipc.clear();
 
-	curl_easy_cleanup(curl_handle_settings);
+	free(settings_url);
 	curl_formfree(settings_formpost);
+	settings_url = NULL;
+	settings_formpost = NULL;
 }
 
 void Kernel::init_browser(){
@@ -206,6 +286,10 @@ void Kernel::init_browser(){
 	_browser->queue_reload = browser_default_queue_reload;
 	_browser->queue_dump = browser_default_queue_dump;
 	_browser->queue_set = browser_default_queue_set;
+	_browser->change_fd = -1;
+	_browser->queue_changed = NULL;
+	_browser->queue_list = NULL;
+	_browser->next_intermediate = NULL;
 
 	/* initialize browser */
 	if ( _browser->module.init ){
@@ -230,6 +314,22 @@ void Kernel::init_browser(){
 
 	/* make initial reload */
 	reload_browser();
+
+	/* reload whenever the browser signals a change */
+	if ( _browser->change_fd != -1 && _browser->queue_changed ){
+		EventLoop::add(_browser->change_fd, [this](){
+			bool changed;
+			{
+				std::lock_guard<std::mutex> lock(Loader::browser_lock());
+				changed = _browser->queue_changed(_browser) != 0;
+			}
+
+			if ( changed ){
+				log_verbose("Kernel: Queue changed, reloading browser\n");
+				browser_changed();
+			}
+		});
+	}
 }
 
 char* Kernel::get_password(){
@@ -247,6 +347,11 @@ void Kernel::init_fsm(){
 	TransitionState::set_transition_time(_arg.transition_time);
 	ViewState::set_view_time(_arg.switch_time);
 	_state = new InitialState(_browser);
+
+	if ( _browser ){
+		Scheduler::init(_arg.schedule);
+		Loader::init(_browser, _arg.prefetch, _arg.decode_threads);
+	}
 }
 
 void Kernel::load_transition(const char* name){
@@ -259,6 +364,7 @@ void Kernel::run(){
 	while ( running() ){
 		poll();
 		action();
+		wait();
 	}
 }
 
@@ -268,12 +374,29 @@ void Kernel::poll(){
 
 	for ( std::vector<struct ipc_module_t*>::iterator it = _ipc.begin(); it != _ipc.end(); ++it ){
 		struct ipc_module_t* ipc = *it;
-		if ( ipc->poll ){
-			ipc->poll(ipc, 5);
+		/* modules with a fd is polled by the event loop */
+		if ( ipc->poll && ipc->fd == -1 ){
+			ipc->poll(ipc, 0);
 		}
 	}
 }
 
+void Kernel::wait(){
+	if ( !running() ){
+		return;
+	}
+
+	/* without a state nothing happens until an event arrives */
+	double timeout = _state ? _state->timeout() : -1.0;
+
+	/* some event sources can only be polled */
+	if ( _periodic_poll && (timeout < 0.0 || timeout > periodic_poll_interval) ){
+		timeout = periodic_poll_interval;
+	}
+
+	EventLoop::wait(timeout);
+}
+
 void Kernel::action(){
 	if ( !_state ){
 		return;
@@ -289,7 +412,9 @@ void Kernel::action(){
 	}
 
 	if ( flip ){
+		Metrics::Timer timer(Metrics::Swap);
 		_backend->swap_buffers();
+		FrameScheduler::presented();
 	}
 }
 
@@ -305,6 +430,16 @@ void Kernel::print_config() const {
 	Log::info("  resolution: %dx%d (%s)\n", _arg.width, _arg.height, _arg.fullscreen ? "fullscreen" : "windowed");
 	Log::info("  transition time: %0.3fs\n", _arg.transition_time);
 	Log::info("  switch time: %0.3fs\n", _arg.switch_time);
+	Log::info("  refresh rate: %0.2fHz\n", _arg.refresh_rate);
+	Log::info("  prefetch: %d slides\n", _arg.prefetch);
+	Log::info("  decode threads: %d\n", _arg.decode_threads);
+	Log::info("  texture ring: %d slides\n", _arg.texture_ring);
+	Log::info("  image cache: %dMiB\n", _arg.image_cache);
+	Log::info("  raster cache: %s (%dMiB)\n", _arg.raster_cache ? _arg.raster_cache : "disabled", _arg.raster_cache_size);
+	Log::info("  shader cache: %s\n", _arg.shader_cache ? _arg.shader_cache : "disabled");
+	Log::info("  metrics socket: %s\n", _arg.metrics_socket ? _arg.metrics_socket : "disabled");
+	Log::info("  schedule: %s\n", _arg.schedule ? _arg.schedule : "disabled");
+	Log::info("  log modules: %s\n", _arg.log_modules ? _arg.log_modules : "default");
 	Log::info("  connection string: %s\n", _arg.connection_string);
 	Log::info("  transition: %s\n", _arg.transition_string);
 	Log::info("\n");
@@ -349,13 +484,25 @@ bool Kernel::parse_arguments(argument_set_t& arg, int argc, const char* argv[]){
 	option_add_string(&options, "transition",       't', "Set slide transition plugin [fade]", &arg.transition_string);
 	option_add_int(&options,    "collection-id",    'c', "ID of the queue to display (deprecated, use `--queue-id')",  &arg.queue_id);
 	option_add_int(&options,    "queue-id",         'c', "ID of the queue to display", &arg.queue_id);
+	option_add_int(&options,    "prefetch",          0,  "Number of slides to decode ahead of time [3]", &arg.prefetch);
+	option_add_int(&options,    "decode-threads",    0,  "Number of threads decoding slides in parallel [2]", &arg.decode_threads);
+	option_add_int(&options,    "texture-ring",      0,  "Number of slide textures, slides beyond the current and previous is uploaded ahead of time [3]", &arg.texture_ring);
+	option_add_int(&options,    "image-cache",       0,  "Size of decoded image cache in MiB, 0 to disable [64]", &arg.image_cache);
+	option_add_string(&options, "raster-cache",      0,  "Directory to persist decoded slides in (disabled by default)", &arg.raster_cache);
+	option_add_int(&options,    "raster-cache-size", 0,  "Size of the raster cache directory in MiB, least recently used slides is removed [512]", &arg.raster_cache_size);
+	option_add_string(&options, "shader-cache",      0,  "Directory to persist linked shader programs in (disabled by default)", &arg.shader_cache);
+	option_add_string(&options, "metrics-socket",    0,  "Serve stage timing histograms (Prometheus format) on a unix domain socket", &arg.metrics_socket);
+	option_add_string(&options, "schedule",          0,  "Pick slides locally using weights and time windows from a rule file", &arg.schedule);
 	option_add_format(&options, "resolution",       'r', "Resolution", "WIDTHxHEIGHT", "%dx%d", &arg.width, &arg.height);
+	option_add_format(&options, "refresh-rate",      0,  "Display refresh rate used to pace transitions (refined at runtime) [60]", "HZ", "%f", &arg.refresh_rate);
 	option_add_string(&options, "name",             'n', "Instance name [machine hostname]", &arg.instance);
 
 	/* logging options */
 	option_add_string(&options, "file-log",          0,  "Log to regular file (appending)", &arg.log_file);
 	option_add_string(&options, "fifo-log",          0,  "Log to a named pipe", &arg.log_fifo);
-	option_add_string(&options, "uds-log",           0,  "Log to a unix domain socket", &arg.log_domain);
+	option_add_string(&options, "uds-log",           0,  "Log to a unix domain socket (clients may connect at any time)", &arg.log_domain);
+	option_add_string(&options, "binary-log",        0,  "Log to a binary file (appending), decode using slideshow-logdecode", &arg.log_binary);
+	option_add_string(&options, "log-modules",       0,  "Log level per source module, e.g. sqlite=debug,graphics=warning", &arg.log_modules);
 
 	int n = option_parse(&options);
 	option_finalize(&options);
@@ -391,7 +538,7 @@ bool Kernel::parse_arguments(argument_set_t& arg, int argc, const char* argv[]){
 
 void Kernel::play_video(const char* fullpath){
 #ifndef WIN32
-	Log::verbose("Kernel: Playing video \"%s\"\n", fullpath);
+	log_verbose("Kernel: Playing video \"%s\"\n", fullpath);
 
 	int status;
 
@@ -416,28 +563,30 @@ void Kernel::quit(){
 
 void Kernel::reload_browser(){
 	if ( _browser ){
+		std::lock_guard<std::mutex> lock(Loader::browser_lock());
 		_browser->queue_reload(_browser);
+		Scheduler::reset();
 	}
 
-	if ( curl_handle_settings ){
-		struct MemoryStruct chunk;
-		long response;
+	/* remote images without a validator is only fetched again when the
+	 * cache is cleared, prefetched slides is decoded again if changed */
+	ImageCache::clear();
+	Loader::revalidate();
 
-		chunk.memory = (char*)malloc(1);  /* will be grown as needed by the realloc above */
-		chunk.size = 0;    /* no data at this point */
-
-		/* get json data */
-		curl_easy_setopt(curl_handle_settings, CURLOPT_WRITEDATA, (void *)&chunk);
-		curl_easy_perform(curl_handle_settings);
-		curl_easy_getinfo(curl_handle_settings, CURLINFO_RESPONSE_CODE, &response);
+	if ( settings_url ){
+		char* body = NULL;
+		http_request_t* request = http_fetch(settings_url, settings_formpost);
+		const long response = request ? http_wait(request, &body, NULL) : -1;
 
 		if ( response != 200 ){ /* HTTP OK */
 			Log::warning("Server replied with code %ld\n", response);
+			free(body);
 			return;
 		}
 
 		/* parse */
-		json_object* settings = json_tokener_parse(chunk.memory);
+		json_object* settings = json_tokener_parse(body);
+		free(body);
 		if ( !settings ){
 			Log::warning("Failed to parse settings");
 			return;
@@ -446,7 +595,12 @@ void Kernel::reload_browser(){
 		json_object_object_foreach(settings, key, value) {
 			/* @todo map */
 			if ( strcasecmp(key, "queue") == 0 ){
-				queue_set(json_object_get_int(value));
+				/* the settings is sent on each reload, switching queue discards
+				 * prefetched slides so it is only done when it changes */
+				const int id = json_object_get_int(value);
+				if ( id != _queue_id ){
+					queue_set(static_cast<unsigned int>(id));
+				}
 				continue;
 			}
 
@@ -472,16 +626,35 @@ void Kernel::reload_browser(){
 	}
 }
 
+void Kernel::browser_changed(){
+	if ( _browser ){
+		std::lock_guard<std::mutex> lock(Loader::browser_lock());
+		_browser->queue_reload(_browser);
+		Scheduler::reset();
+	}
+
+	/* unlike reload_browser the settings is not fetched and the image cache is
+	 * kept (cached images is keyed by mtime or validator), only prefetched
+	 * slides whose source has changed is decoded again */
+	Loader::revalidate();
+}
+
 void Kernel::queue_set(unsigned int id){
-	Log::verbose("Kernel: Switching to queue %d\n", id);
+	log_verbose("Kernel: Switching to queue %d\n", id);
+	_queue_id = static_cast<int>(id);
 	if ( _browser ){
+		std::lock_guard<std::mutex> lock(Loader::browser_lock());
 		_browser->queue_set(_browser, id);
 		_browser->queue_reload(_browser);
+		Scheduler::reset();
 	}
+
+	Loader::flush();
 }
 
 void Kernel::debug_dumpqueue(){
 	if ( _browser ){
+		std::lock_guard<std::mutex> lock(Loader::browser_lock());
 		_browser->queue_dump(_browser);
 	}
 }
@@ -21,7 +21,7 @@
 
 class State;
 class PlatformBackend;
-class UDSServer;
+class SocketServerDestination;
 
 #include "browsers/browser.h"
 #include <vector>
@@ -38,11 +38,23 @@ public:
 		int height;
 		float transition_time;
 		float switch_time;
+		float refresh_rate; /* in Hz */
+		int prefetch;
+		int decode_threads;
+		int texture_ring;
+		int image_cache;    /* in MiB */
+		int raster_cache_size; /* in MiB */
 		char* connection_string;
 		char* transition_string;
 		char* log_file;     /* log: file */
 		char* log_fifo;     /* log: named pipe */
 		char* log_domain;   /* log: unix domain socket */
+		char* log_binary;   /* log: binary file */
+		char* log_modules;  /* log: per module levels */
+		char* raster_cache; /* directory for persistent raster cache */
+		char* shader_cache; /* directory for persistent shader programs */
+		char* metrics_socket; /* unix domain socket serving stage metrics */
+		char* schedule;       /* slide scheduling rules */
 
 		/* frontend settings */
 		char* url;
@@ -68,6 +80,11 @@ public:
 	virtual void poll();
 	virtual void action();
 
+	/**
+	 * Block until the state wants to run again or an event arrives.
+	 */
+	virtual void wait();
+
 	bool running(){ return _running; }
 
 	void start();
@@ -103,12 +120,19 @@ private:
 
 	void init_backend();
 	void cleanup_backend();
+	void init_log_server();
+	void cleanup_log_server();
 	void init_graphics();
 	void init_IPC();
 	void cleanup_IPC();
 	void init_browser();
 	void init_fsm();
 
+	/**
+	 * Called when the browser signals that the queue has changed.
+	 */
+	void browser_changed();
+
 
 
 	argument_set_t _arg;
@@ -120,8 +144,11 @@ private:
 	browser_module_t* _browser;
 	PlatformBackend* _backend;
 	std::vector<struct ipc_module_t*> _ipc;
+	SocketServerDestination* _log_server;  /* owned by Log */
+	int _queue_id;         /* last queue set, -1 if never set */
 
 	bool _running;
+	bool _periodic_poll;   /* set if any event source lacks a fd */
 };
 
 #endif /* KERNEL_HPP */
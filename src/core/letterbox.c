@@ -0,0 +1,321 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2014 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Bilinear letterboxing is done as two separable passes per output row:
+ *
+ *  1. Horizontal: the two source rows needed are resampled to the output
+ *     width into 16-bit intermediates (8.7 fixed point, swizzled to RGB).
+ *     The two most recent rows are cached so each source row is resampled
+ *     at most once when upscaling and rows that are skipped when
+ *     downscaling are never touched.
+ *  2. Vertical: the two intermediate rows are blended (Q15 weight) straight
+ *     into the destination row. This is where the vector paths are.
+ *
+ * All paths compute v = a + ((b - a) * w + 0x4000) >> 15 followed by
+ * (v + 64) >> 7 so they produce identical results.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "core/letterbox.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#	define LETTERBOX_X86 1
+#	include <emmintrin.h>
+#	include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#	define LETTERBOX_NEON 1
+#	include <arm_neon.h>
+#endif
+
+#define FRAC_BITS_X 7                  /* horizontal weight is [0, 128] */
+#define FRAC_ONE_X (1 << FRAC_BITS_X)
+#define FRAC_BITS_Y 15                 /* vertical weight is [0, 32767] */
+
+typedef void (*blend_func)(const int16_t* a, const int16_t* b, int16_t w, unsigned char* dst, size_t n);
+
+struct column_t {
+	size_t x0;     /* byte offset to left sample */
+	size_t x1;     /* byte offset to right sample */
+	int16_t fx;    /* weight of right sample */
+};
+
+struct row_cache_t {
+	int16_t* data;
+	int y;
+};
+
+static inline unsigned char blend_one(int16_t a, int16_t b, int16_t w){
+	const int32_t d = (int32_t)b - (int32_t)a;
+	const int32_t v = a + ((d * w + 0x4000) >> FRAC_BITS_Y);
+	return (unsigned char)((v + 64) >> FRAC_BITS_X);
+}
+
+static void blend_scalar(const int16_t* a, const int16_t* b, int16_t w, unsigned char* dst, size_t n){
+	for ( size_t i = 0; i < n; i++ ){
+		dst[i] = blend_one(a[i], b[i], w);
+	}
+}
+
+#ifdef LETTERBOX_X86
+static inline __m128i mulhrs_sse2(__m128i d, __m128i w){
+	/* SSE2 lacks pmulhrsw so the 32-bit product is formed from the low and
+	 * high halves */
+	const __m128i round = _mm_set1_epi32(0x4000);
+	const __m128i lo = _mm_mullo_epi16(d, w);
+	const __m128i hi = _mm_mulhi_epi16(d, w);
+	__m128i p0 = _mm_unpacklo_epi16(lo, hi);
+	__m128i p1 = _mm_unpackhi_epi16(lo, hi);
+	p0 = _mm_srai_epi32(_mm_add_epi32(p0, round), FRAC_BITS_Y);
+	p1 = _mm_srai_epi32(_mm_add_epi32(p1, round), FRAC_BITS_Y);
+	return _mm_packs_epi32(p0, p1);
+}
+
+static inline __m128i blend8_sse2(const int16_t* a, const int16_t* b, __m128i w){
+	const __m128i bias = _mm_set1_epi16(64);
+	const __m128i va = _mm_loadu_si128((const __m128i*)a);
+	const __m128i vb = _mm_loadu_si128((const __m128i*)b);
+	const __m128i v = _mm_add_epi16(va, mulhrs_sse2(_mm_sub_epi16(vb, va), w));
+	return _mm_srli_epi16(_mm_add_epi16(v, bias), FRAC_BITS_X);
+}
+
+static void blend_sse2(const int16_t* a, const int16_t* b, int16_t w, unsigned char* dst, size_t n){
+	const __m128i vw = _mm_set1_epi16(w);
+	size_t i = 0;
+
+	for ( ; i + 16 <= n; i += 16 ){
+		const __m128i lo = blend8_sse2(a + i, b + i, vw);
+		const __m128i hi = blend8_sse2(a + i + 8, b + i + 8, vw);
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+
+	blend_scalar(a + i, b + i, w, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void blend_avx2(const int16_t* a, const int16_t* b, int16_t w, unsigned char* dst, size_t n){
+	const __m256i vw = _mm256_set1_epi16(w);
+	const __m256i bias = _mm256_set1_epi16(64);
+	size_t i = 0;
+
+	for ( ; i + 32 <= n; i += 32 ){
+		const __m256i a0 = _mm256_loadu_si256((const __m256i*)(a + i));
+		const __m256i b0 = _mm256_loadu_si256((const __m256i*)(b + i));
+		const __m256i a1 = _mm256_loadu_si256((const __m256i*)(a + i + 16));
+		const __m256i b1 = _mm256_loadu_si256((const __m256i*)(b + i + 16));
+
+		/* pmulhrsw is exactly (d * w + 0x4000) >> 15 */
+		__m256i v0 = _mm256_add_epi16(a0, _mm256_mulhrs_epi16(_mm256_sub_epi16(b0, a0), vw));
+		__m256i v1 = _mm256_add_epi16(a1, _mm256_mulhrs_epi16(_mm256_sub_epi16(b1, a1), vw));
+		v0 = _mm256_srli_epi16(_mm256_add_epi16(v0, bias), FRAC_BITS_X);
+		v1 = _mm256_srli_epi16(_mm256_add_epi16(v1, bias), FRAC_BITS_X);
+
+		/* packus works per 128-bit lane so the quadwords must be reordered */
+		const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(v0, v1), 0xD8);
+		_mm256_storeu_si256((__m256i*)(dst + i), packed);
+	}
+
+	blend_sse2(a + i, b + i, w, dst + i, n - i);
+}
+#endif /* LETTERBOX_X86 */
+
+#ifdef LETTERBOX_NEON
+static void blend_neon(const int16_t* a, const int16_t* b, int16_t w, unsigned char* dst, size_t n){
+	const int16x8_t vw = vdupq_n_s16(w);
+	size_t i = 0;
+
+	for ( ; i + 8 <= n; i += 8 ){
+		const int16x8_t va = vld1q_s16(a + i);
+		const int16x8_t vb = vld1q_s16(b + i);
+
+		/* vqrdmulh is exactly (d * w + 0x4000) >> 15 */
+		const int16x8_t v = vaddq_s16(va, vqrdmulhq_s16(vsubq_s16(vb, va), vw));
+		const uint16x8_t r = vrshrq_n_u16(vreinterpretq_u16_s16(v), FRAC_BITS_X);
+		vst1_u8(dst + i, vqmovn_u16(r));
+	}
+
+	blend_scalar(a + i, b + i, w, dst + i, n - i);
+}
+#endif /* LETTERBOX_NEON */
+
+static blend_func select_blend(void){
+#if defined(LETTERBOX_X86)
+	if ( __builtin_cpu_supports("avx2") ) return blend_avx2;
+	return blend_sse2;
+#elif defined(LETTERBOX_NEON)
+	return blend_neon;
+#else
+	return blend_scalar;
+#endif
+}
+
+/* selected once, letterbox is called from several loader threads */
+static blend_func blend = NULL;
+static pthread_once_t blend_once = PTHREAD_ONCE_INIT;
+
+static void init_blend(void){
+	blend = select_blend();
+}
+
+/**
+ * Resample a source row horizontally into 8.7 fixed point RGB.
+ */
+static void resample_row(const unsigned char* src, const struct column_t* column, const int* channel, int16_t* dst, int width){
+	for ( int x = 0; x < width; x++ ){
+		const unsigned char* p0 = src + column[x].x0;
+		const unsigned char* p1 = src + column[x].x1;
+		const int fx = column[x].fx;
+
+		for ( int c = 0; c < 3; c++ ){
+			const int k = channel[c];
+			dst[c] = (int16_t)(p0[k] * (FRAC_ONE_X - fx) + p1[k] * fx);
+		}
+
+		dst += 3;
+	}
+}
+
+/**
+ * Get the resampled source row y. The row pointed to by keep is never
+ * evicted from the cache.
+ */
+static const int16_t* get_row(struct row_cache_t cache[2], int y, const int16_t* keep,
+                              const unsigned char* src, size_t stride, const struct column_t* column, const int* channel, int width){
+	if ( cache[0].y == y ) return cache[0].data;
+	if ( cache[1].y == y ) return cache[1].data;
+
+	struct row_cache_t* slot = cache[0].data == keep ? &cache[1] : &cache[0];
+	resample_row(src + (size_t)y * stride, column, channel, slot->data, width);
+	slot->y = y;
+	return slot->data;
+}
+
+void letterbox_size(int src_width, int src_height, int dst_width, int dst_height, int* width, int* height){
+	const float old_aspect = (float)src_width / (float)src_height;
+	const float new_aspect = (float)dst_width / (float)dst_height;
+	float new_width  = (float)dst_width;
+	float new_height = (float)dst_height;
+
+	if ( old_aspect > new_aspect ){
+		new_height = new_width * ((float)src_height / (float)src_width);
+	} else {
+		new_width = new_height * ((float)src_width / (float)src_height);
+	}
+
+	*width  = new_width  >= 1.0f ? (int)new_width  : 1;
+	*height = new_height >= 1.0f ? (int)new_height : 1;
+}
+
+int letterbox(const unsigned char* src, int src_width, int src_height, size_t stride, enum letterbox_format format,
+              unsigned char* dst, int dst_width, int dst_height, int flip){
+	static const int channels[][3] = {
+		[LETTERBOX_RGB]  = {0, 1, 2},
+		[LETTERBOX_RGBA] = {0, 1, 2},
+		[LETTERBOX_BGR]  = {2, 1, 0},
+		[LETTERBOX_BGRA] = {2, 1, 0},
+	};
+	static const size_t bpp[] = {
+		[LETTERBOX_RGB]  = 3,
+		[LETTERBOX_RGBA] = 4,
+		[LETTERBOX_BGR]  = 3,
+		[LETTERBOX_BGRA] = 4,
+	};
+	if ( src_width <= 0 || src_height <= 0 || dst_width <= 0 || dst_height <= 0 ){
+		return 1;
+	}
+
+	pthread_once(&blend_once, init_blend);
+
+	int width, height;
+	letterbox_size(src_width, src_height, dst_width, dst_height, &width, &height);
+	const int offset_x = (dst_width  - width ) / 2;
+	const int offset_y = (dst_height - height) / 2;
+	const size_t dst_stride = (size_t)dst_width * 3;
+	const size_t row_size = (size_t)width * 3;
+
+	struct column_t* column = malloc(sizeof(struct column_t) * (size_t)width);
+	int16_t* buffer = malloc(sizeof(int16_t) * row_size * 2);
+	if ( !(column && buffer) ){
+		free(column);
+		free(buffer);
+		return 1;
+	}
+
+	/* precalculate horizontal sample positions (pixel centers are aligned) */
+	const double scale_x = (double)src_width / (double)width;
+	for ( int x = 0; x < width; x++ ){
+		double sx = (x + 0.5) * scale_x - 0.5;
+		if ( sx < 0.0 ) sx = 0.0;
+
+		int x0 = (int)sx;
+		if ( x0 > src_width - 1 ) x0 = src_width - 1;
+		const int x1 = x0 < src_width - 1 ? x0 + 1 : x0;
+		int fx = (int)((sx - x0) * FRAC_ONE_X + 0.5);
+		if ( fx > FRAC_ONE_X ) fx = FRAC_ONE_X;
+
+		column[x].x0 = (size_t)x0 * bpp[format];
+		column[x].x1 = (size_t)x1 * bpp[format];
+		column[x].fx = (int16_t)fx;
+	}
+
+	struct row_cache_t cache[2] = {
+		{buffer, -1},
+		{buffer + row_size, -1},
+	};
+
+	/* top and bottom border */
+	memset(dst, 0, (size_t)offset_y * dst_stride);
+	memset(dst + (size_t)(offset_y + height) * dst_stride, 0, (size_t)(dst_height - offset_y - height) * dst_stride);
+
+	const double scale_y = (double)src_height / (double)height;
+	for ( int y = 0; y < height; y++ ){
+		unsigned char* row = dst + (size_t)(offset_y + y) * dst_stride;
+		const int sample_y = flip ? height - 1 - y : y;
+
+		double sy = (sample_y + 0.5) * scale_y - 0.5;
+		if ( sy < 0.0 ) sy = 0.0;
+
+		int y0 = (int)sy;
+		if ( y0 > src_height - 1 ) y0 = src_height - 1;
+		const int y1 = y0 < src_height - 1 ? y0 + 1 : y0;
+		int fy = (int)((sy - y0) * (1 << FRAC_BITS_Y) + 0.5);
+		if ( fy > (1 << FRAC_BITS_Y) - 1 ) fy = (1 << FRAC_BITS_Y) - 1;
+
+		const int16_t* a = get_row(cache, y0, NULL, src, stride, column, channels[format], width);
+		const int16_t* b = get_row(cache, y1, a, src, stride, column, channels[format], width);
+
+		/* left and right border */
+		memset(row, 0, (size_t)offset_x * 3);
+		memset(row + (size_t)(offset_x + width) * 3, 0, (size_t)(dst_width - offset_x - width) * 3);
+
+		blend(a, b, (int16_t)fy, row + (size_t)offset_x * 3, row_size);
+	}
+
+	free(column);
+	free(buffer);
+	return 0;
+}
@@ -0,0 +1,60 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2014 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SLIDESHOW_LETTERBOX_H
+#define SLIDESHOW_LETTERBOX_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum letterbox_format {
+	LETTERBOX_RGB = 0,
+	LETTERBOX_RGBA,
+	LETTERBOX_BGR,
+	LETTERBOX_BGRA,
+};
+
+/**
+ * Calculate the size of the image area when letterboxing a src_width x
+ * src_height image into dst_width x dst_height.
+ */
+void letterbox_size(int src_width, int src_height, int dst_width, int dst_height, int* width, int* height);
+
+/**
+ * Scale (bilinear) src to fit inside dst preserving the aspect ratio, center
+ * it and fill the borders with black, all in a single pass. The output is
+ * always tightly packed RGB.
+ *
+ * Uses SSE2, AVX2 or NEON when available. The vector paths are bit-exact with
+ * the scalar fallback.
+ *
+ * @param stride Bytes between rows in src.
+ * @param flip Non-zero to flip the image vertically.
+ * @return Non-zero on errors (invalid size or out of memory).
+ */
+int letterbox(const unsigned char* src, int src_width, int src_height, size_t stride, enum letterbox_format format,
+              unsigned char* dst, int dst_width, int dst_height, int flip);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SLIDESHOW_LETTERBOX_H */
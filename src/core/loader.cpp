@@ -0,0 +1,336 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2014 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "core/loader.hpp"
+#include "core/graphics.h"
+#include "core/event_loop.hpp"
+#include "core/log.hpp"
+#include "core/metrics.hpp"
+#include "core/scheduler.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct entry_t {
+	slide_context_t slide;
+	image_ptr image;
+	std::string tag;         /* source tag when decoded, see graphics_source_tag */
+	int status;
+	bool ready;              /* set when decoding has finished */
+	bool loading;            /* set while a worker is decoding it */
+	unsigned int generation;
+};
+
+typedef std::shared_ptr<entry_t> entry_ptr;
+
+static std::vector<std::thread> workers;
+static std::mutex lock;                 /* protects everything below */
+static std::mutex browser_mutex;        /* must be locked before lock if both is needed */
+static std::condition_variable cond;
+static std::deque<entry_ptr> queue;     /* in browser order, including slides being decoded */
+static std::deque<entry_ptr> staged;    /* slides popped from queue and uploaded to the texture ring */
+static browser_module_t* browser = NULL;
+static unsigned int depth = 1;
+static unsigned int generation = 0;     /* incremented each time the queue is flushed */
+static bool running = false;
+
+/**
+ * Find a queued entry which has to be decoded (again), see Loader::revalidate.
+ */
+static entry_ptr find_stale(){
+	for ( entry_ptr& entry: queue ){
+		if ( !entry->ready && !entry->loading ){
+			return entry;
+		}
+	}
+	return entry_ptr();
+}
+
+static bool is_image(const slide_context_t& slide){
+	return strcmp("image", slide.assembler) == 0 || strcmp("text", slide.assembler) == 0;
+}
+
+static void release(entry_t& entry){
+	free(entry.slide.filename);
+	free(entry.slide.assembler);
+}
+
+/**
+ * Test if there is no need to pull more slides, either because enough slides
+ * is prefetched or because the browser ran out of slides (in which case it
+ * should not be queried again until the blank slide has been shown).
+ */
+static bool saturated(){
+	if ( queue.size() >= depth ) return true;
+	return !queue.empty() && !queue.back()->slide.filename;
+}
+
+/**
+ * Pull the next slide from the browser and reserve its place in the queue.
+ * The browser lock is held until the entry is queued so the order is kept
+ * even when several threads pull at once.
+ *
+ * @return NULL if no slide should be pulled.
+ */
+static entry_ptr reserve(){
+	std::lock_guard<std::mutex> browser_guard(browser_mutex);
+
+	unsigned int current;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if ( !running || saturated() ) return entry_ptr();
+		current = generation;
+	}
+
+	entry_ptr entry = std::make_shared<entry_t>();
+	{
+		Metrics::Timer timer(Metrics::NextSlide);
+		entry->slide = Scheduler::next_slide(browser);
+	}
+	entry->status = 0;
+	entry->ready = false;
+	entry->loading = true;
+	entry->generation = current;
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	/* queue was flushed while the browser was queried */
+	if ( current != generation ){
+		release(*entry);
+		return entry_ptr();
+	}
+
+	queue.push_back(entry);
+	return entry;
+}
+
+static void run(){
+	std::unique_lock<std::mutex> guard(lock);
+
+	while ( true ){
+		cond.wait(guard, []{ return !running || !saturated() || find_stale(); });
+		if ( !running ) break;
+
+		/* slides already pulled from the browser which has to be decoded again
+		 * goes first */
+		entry_ptr entry = find_stale();
+		if ( entry ){
+			entry->loading = true;
+		}
+		guard.unlock();
+
+		if ( !entry ){
+			entry = reserve();
+		}
+
+		if ( entry && entry->slide.filename && entry->slide.assembler && is_image(entry->slide) ){
+			entry->tag = graphics_source_tag(entry->slide.filename);
+			image_ptr image = graphics_decode_image(entry->slide.filename, 1);
+			entry->image = image;
+			entry->status = image ? 0 : -1;
+		}
+
+		guard.lock();
+		if ( !entry ) continue;
+		entry->loading = false;
+
+		/* queue was flushed while the slide was loading, the entry is no longer
+		 * referenced by the queue so it is released here */
+		if ( entry->generation != generation ){
+			release(*entry);
+			continue;
+		}
+
+		entry->ready = true;
+		cond.notify_all();
+
+		/* the main thread might be waiting to stage it */
+		EventLoop::wakeup();
+	}
+}
+
+namespace Loader {
+
+	void init(browser_module_t* b, unsigned int d, unsigned int threads){
+		browser = b;
+		depth = d > 0 ? d : 1;
+		running = true;
+
+		/* more threads than slides in the queue would never be used */
+		threads = std::max(1U, std::min(threads, depth));
+
+		log_verbose("Loader: Prefetching %d slide(s) using %d thread(s)\n", depth, threads);
+		for ( unsigned int i = 0; i < threads; i++ ){
+			workers.push_back(std::thread(run));
+		}
+	}
+
+	void cleanup(){
+		if ( workers.empty() ){
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			running = false;
+			cond.notify_all();
+		}
+
+		for ( std::thread& worker: workers ){
+			worker.join();
+		}
+		workers.clear();
+
+		flush();
+		browser = NULL;
+	}
+
+	int pop(slide_context_t& slide, image_ptr& image, bool& is_staged){
+		std::unique_lock<std::mutex> guard(lock);
+
+		is_staged = !staged.empty();
+		if ( is_staged ){
+			entry_ptr entry = staged.front();
+			staged.pop_front();
+			slide = entry->slide;
+			image.reset();
+			return 0;
+		}
+
+		cond.wait(guard, []{ return !running || (!queue.empty() && queue.front()->ready); });
+
+		if ( queue.empty() || !queue.front()->ready ){
+			slide.filename = NULL;
+			slide.assembler = NULL;
+			image.reset();
+			return 0;
+		}
+
+		entry_ptr entry = queue.front();
+		queue.pop_front();
+		cond.notify_all();
+
+		slide = entry->slide;
+		image = entry->image;
+		return entry->status;
+	}
+
+	void stage(){
+		while ( graphics_staged() < graphics_stage_capacity() ){
+			entry_ptr entry;
+
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				if ( queue.empty() || !queue.front()->ready ) return;
+				entry = queue.front();
+			}
+
+			/* only successfully decoded images can be staged, anything else
+			 * stops staging until it has been popped. The front entry cannot
+			 * change meanwhile as only this thread removes entries. */
+			if ( entry->status != 0 || !entry->image ) return;
+			if ( graphics_stage_image(entry->image.get()) != 0 ) return;
+
+			/* the pixels is no longer needed (unless cached) */
+			entry->image.reset();
+
+			std::lock_guard<std::mutex> guard(lock);
+			queue.pop_front();
+			staged.push_back(entry);
+			cond.notify_all();
+		}
+	}
+
+	void flush(){
+		std::lock_guard<std::mutex> guard(lock);
+
+		for ( entry_ptr& entry: staged ){
+			release(*entry);
+		}
+		staged.clear();
+		graphics_discard_staged();
+
+		/* entries still being decoded is released by the worker */
+		for ( entry_ptr& entry: queue ){
+			if ( !entry->loading ){
+				release(*entry);
+			}
+		}
+		queue.clear();
+
+		generation++;
+		cond.notify_all();
+	}
+
+	void revalidate(){
+		std::lock_guard<std::mutex> guard(lock);
+
+		/* the browser ran out of slides last time, it might have some now */
+		while ( !queue.empty() && queue.back()->ready && !queue.back()->slide.filename ){
+			release(*queue.back());
+			queue.pop_back();
+		}
+
+		/* an image is stale if its source has changed since it was decoded
+		 * (entries being decoded is left alone) */
+		auto stale = [](const entry_ptr& entry){
+			if ( !entry->ready || !entry->slide.filename || !entry->slide.assembler || !is_image(entry->slide) ){
+				return false;
+			}
+			return entry->tag.empty() || entry->tag != graphics_source_tag(entry->slide.filename);
+		};
+		auto reload = [](const entry_ptr& entry){
+			entry->image.reset();
+			entry->status = 0;
+			entry->ready = false;
+		};
+
+		/* staged textures can only be discarded all at once, the slides is put
+		 * back in the queue and decoded again (usually from the image cache) */
+		if ( std::any_of(staged.begin(), staged.end(), stale) ){
+			graphics_discard_staged();
+			for ( entry_ptr& entry: staged ){
+				reload(entry);
+			}
+			queue.insert(queue.begin(), staged.begin(), staged.end());
+			staged.clear();
+		}
+
+		for ( entry_ptr& entry: queue ){
+			if ( stale(entry) ){
+				reload(entry);
+			}
+		}
+
+		cond.notify_all();
+	}
+
+	std::mutex& browser_lock(){
+		return browser_mutex;
+	}
+
+}
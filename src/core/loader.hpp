@@ -0,0 +1,84 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2014 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SLIDESHOW_LOADER_HPP
+#define SLIDESHOW_LOADER_HPP
+
+#include "browsers/browser.h"
+#include "core/image.hpp"
+#include <mutex>
+
+/**
+ * Background slide prefetching.
+ *
+ * Loader threads pull slides from the browser ahead of time and decode (and
+ * letterbox) them so the only work left when switching slide is the texture
+ * upload. With multiple threads several slides is decoded in parallel but
+ * they are always returned in the order the browser gave them.
+ */
+namespace Loader {
+
+	/**
+	 * Start the loader threads.
+	 * @param browser Browser to pull slides from.
+	 * @param depth Number of slides to keep decoded ahead of time.
+	 * @param threads Number of decoding threads (at most depth is used).
+	 */
+	void init(browser_module_t* browser, unsigned int depth, unsigned int threads);
+	void cleanup();
+
+	/**
+	 * Get the next slide, blocks until it is available. The slide strings
+	 * must be released by the caller using free.
+	 *
+	 * @param image Decoded image or NULL if the slide isn't an image, failed
+	 *              to load or is staged.
+	 * @param staged Set if the slide is already uploaded to the texture ring
+	 *               (use graphics_swap_textures instead of uploading).
+	 * @return Non-zero if the slide failed to load.
+	 */
+	int pop(slide_context_t& slide, image_ptr& image, bool& staged);
+
+	/**
+	 * Upload decoded slides to free texture ring slots ahead of time so
+	 * switching doesn't have to wait on the upload. Must be called from the
+	 * thread owning the GL context.
+	 */
+	void stage();
+
+	/**
+	 * Discard all prefetched (and staged) slides, e.g. when switching to
+	 * another queue.
+	 */
+	void flush();
+
+	/**
+	 * Decode prefetched (and staged) slides again if their source has changed,
+	 * e.g. when the queue has been reloaded. Unlike flush the slides already
+	 * pulled from the browser is kept (as the browser cannot rewind).
+	 */
+	void revalidate();
+
+	/**
+	 * All calls into the browser must hold this lock as the loader threads is
+	 * using it concurrently.
+	 */
+	std::mutex& browser_lock();
+}
+
+#endif /* SLIDESHOW_LOADER_HPP */
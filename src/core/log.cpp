@@ -21,13 +21,24 @@
 #endif
 
 #include "core/log.hpp"
+#include "core/log_format.hpp"
 #include "core/asprintf.h"
 #include "core/exception.hpp"
 #include <stdarg.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstdlib>
 #include <cstring>
 #include <memory> /* for auto_ptr */
+#include <mutex>
+#include <thread>
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <strings.h>
 #include <time.h>
 #include <sys/types.h>
 #include <sys/un.h>
@@ -53,15 +64,65 @@ int syslog_severity[5] = {
 };
 #endif /* HAVE_SYSLOG */
 
+#define LOG_RING_SIZE 1024    /* must be a power of two */
+#define LOG_RECORD_SIZE 512   /* format and packed arguments, larger messages is allocated separately */
+#define LOG_TEXT_SIZE 1024    /* initial size of the format buffer, grown for longer messages */
+#define LOG_CLIENT_QUEUE 65536 /* bytes queued per socket client before dropping messages */
+
 typedef std::vector<std::pair<Destination*, Severity>> vector;
 typedef vector::iterator iterator;
 
-static vector destinations;
-
-struct free_delete {
-	void operator()(void* x) { free(x); }
+/**
+ * Unformatted message waiting for the writer thread. The sequence tells
+ * whenever the slot is free for the producer at position n (sequence == n) or
+ * holds the message at position n (sequence == n + 1).
+ *
+ * The format string is copied (as the caller might be a plugin unloaded
+ * before the message is written) followed by the packed arguments. Messages
+ * which doesn't fit (e.g. shader logs) is formatted by the caller into a
+ * separate allocation instead, see pack_oversized.
+ */
+struct record_t {
+	std::atomic<size_t> sequence;
+	Severity severity;
+	int64_t timestamp;        /* CLOCK_MONOTONIC in ns */
+	size_t format_len;        /* excluding terminator */
+	size_t args_size;
+	char* heap;               /* if non-null used instead of data, freed by the writer */
+	char data[LOG_RECORD_SIZE];
 };
 
+static vector destinations;
+static std::mutex lock;                 /* protects destinations */
+
+/* messages is queued by any thread into a bounded lock-free ring and written
+ * by a background thread so a slow destination never blocks the caller */
+static record_t ring[LOG_RING_SIZE];
+static std::atomic<size_t> enqueue_pos(0);
+static size_t dequeue_pos = 0;          /* only used by the writer */
+static std::atomic<unsigned int> dropped(0);
+static std::thread* writer = NULL;
+static std::atomic<bool> writer_started(false);
+static std::atomic<bool> writer_idle(false);
+static bool writer_stop = false;        /* protected by wakeup_lock */
+static std::mutex wakeup_lock;
+static std::condition_variable wakeup;
+static int64_t clock_offset = 0;        /* realtime - monotonic */
+
+/* levels, see log_module_t */
+extern "C" { unsigned int log_generation = 1; }
+static std::mutex level_lock;           /* protects global_level and module_levels */
+static Severity global_level = Log_Debug;
+static std::vector<std::pair<std::string, Severity>> module_levels;
+static std::atomic<int> destination_level(Log_Debug);  /* lowest severity any destination accepts */
+static std::atomic<int> lowest_level(Log_Debug);       /* lowest severity any module writes */
+
+static int64_t clock_ns(clockid_t clock){
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
 FileDestination::FileDestination(const char* filename)
 	: _fp(fopen(filename, "a"))
 	, _autoclose(true) {
@@ -89,6 +150,9 @@ FileDestination::~FileDestination(){
 }
 void FileDestination::write(const char* content, const char* decorated) const {
 	fputs(decorated, _fp);
+}
+
+void FileDestination::flush() const {
 	fflush(_fp);
 }
 
@@ -99,8 +163,8 @@ FIFODestination::FIFODestination(const char* filename)
 	_filename = strdup(filename);
 	mkfifo(filename, 0600);
 
-	FILE* fp = fopen(filename, "w");
-	if ( !fp ){
+	_fp = fopen(filename, "w");
+	if ( !_fp ){
 		fprintf(stderr, "Failed to open logfile '%s' ! Fatal error!\n", filename);
 		exit(1);
 	}
@@ -113,20 +177,87 @@ FIFODestination::~FIFODestination(){
 }
 void FIFODestination::write(const char* content, const char* decorated) const {
 	fputs(decorated, _fp);
+}
+
+void FIFODestination::flush() const {
+	fflush(_fp);
+}
+
+BinaryDestination::BinaryDestination(const char* filename)
+	: _fp(fopen(filename, "a+b")) {
+
+	if ( !_fp ){
+		fprintf(stderr, "Failed to open `%s' for writing: %s!\n", filename, strerror(errno));
+		exit(1);
+	}
+
+	/* the previous session didn't end properly and might have left a partial
+	 * record, pad so the decoder can find the header below */
+	char tail[5] = {0,};
+	if ( fseek(_fp, 0, SEEK_END) == 0 && ftell(_fp) > 0 ){
+		const bool ended =
+			fseek(_fp, -static_cast<long>(sizeof(tail)), SEEK_END) == 0 &&
+			fread(tail, sizeof(tail), 1, _fp) == 1 &&
+			tail[0] == 'E' && memcmp(tail + 1, LOG_BINARY_MAGIC, 4) == 0;
+
+		if ( !ended ){
+			static const char padding[LOG_BINARY_SYNC_SIZE] = {0,};
+			fseek(_fp, 0, SEEK_END);
+			fwrite(padding, sizeof(padding), 1, _fp);
+		}
+	}
+
+	/* switching from reading to writing requires a seek */
+	fseek(_fp, 0, SEEK_END);
+
+	/* lets the decoder map monotonic timestamps to wall-clock time */
+	const uint32_t version = LOG_BINARY_VERSION;
+	const int64_t realtime = clock_ns(CLOCK_REALTIME);
+	const int64_t monotonic = clock_ns(CLOCK_MONOTONIC);
+	fputc('H', _fp);
+	fwrite(LOG_BINARY_MAGIC, 4, 1, _fp);
+	fwrite(&version, sizeof(version), 1, _fp);
+	fwrite(&realtime, sizeof(realtime), 1, _fp);
+	fwrite(&monotonic, sizeof(monotonic), 1, _fp);
 	fflush(_fp);
 }
 
-SocketDestination::SocketDestination(int socket)
-	: _socket(socket) {
+BinaryDestination::~BinaryDestination(){
+	fputc('E', _fp);
+	fwrite(LOG_BINARY_MAGIC, 4, 1, _fp);
+	fclose(_fp);
+}
 
+void BinaryDestination::write(const char* content, const char* decorated) const {
+	/* not used, see write_record */
 }
 
-SocketDestination::~SocketDestination(){
-	close(_socket);
+void BinaryDestination::write_record(const LogRecord& record) const {
+	/* each format string is only written the first time it is used */
+	auto it = _formats.find(record.format);
+	if ( it == _formats.end() ){
+		const uint32_t id = static_cast<uint32_t>(_formats.size());
+		const uint16_t len = static_cast<uint16_t>(std::min(strlen(record.format), static_cast<size_t>(UINT16_MAX)));
+		fputc('F', _fp);
+		fwrite(&id, sizeof(id), 1, _fp);
+		fwrite(&len, sizeof(len), 1, _fp);
+		fwrite(record.format, len, 1, _fp);
+		it = _formats.insert(std::make_pair(std::string(record.format), id)).first;
+	}
+
+	const uint32_t id = it->second;
+	const uint8_t severity = static_cast<uint8_t>(record.severity);
+	const uint16_t size = static_cast<uint16_t>(record.args_size);
+	fputc('M', _fp);
+	fwrite(&id, sizeof(id), 1, _fp);
+	fwrite(&severity, sizeof(severity), 1, _fp);
+	fwrite(&record.timestamp, sizeof(record.timestamp), 1, _fp);
+	fwrite(&size, sizeof(size), 1, _fp);
+	fwrite(record.args, size, 1, _fp);
 }
 
-void SocketDestination::write(const char* content, const char* decorated) const {
-	send(_socket, decorated, strlen(decorated), 0);
+void BinaryDestination::flush() const {
+	fflush(_fp);
 }
 
 #ifdef HAVE_SYSLOG
@@ -171,35 +302,396 @@ UDSServer::UDSServer(const char* filename)
 }
 
 UDSServer::~UDSServer(){
+	if ( _socket != -1 ){
+		close(_socket);
+	}
 	unlink(_filename);
 	free(_filename);
 }
 
-bool UDSServer::accept(struct timeval *timeout) const {
-	fd_set rfds;
-	FD_ZERO(&rfds);
-	FD_SET(_socket, &rfds);
+int UDSServer::accept_client() const {
+	return ::accept(_socket, NULL, NULL);
+}
+
+SocketServerDestination::SocketServerDestination(const char* filename)
+	: _server(filename) {
+
+	/* spurious wakeups must not block the event loop */
+	if ( _server.fd() != -1 ){
+		fcntl(_server.fd(), F_SETFL, fcntl(_server.fd(), F_GETFL) | O_NONBLOCK);
+	}
+}
+
+SocketServerDestination::~SocketServerDestination(){
+	for ( client_t& client: _clients ){
+		send_queue(client);
+		close(client.socket);
+	}
+}
+
+void SocketServerDestination::accept(){
+	int socket;
+	while ( (socket = _server.accept_client()) != -1 ){
+		fcntl(socket, F_SETFL, fcntl(socket, F_GETFL) | O_NONBLOCK);
+		fcntl(socket, F_SETFD, FD_CLOEXEC);
 
-	if ( select(_socket+1, &rfds, NULL, NULL, timeout) <= 0 ){
-		return false;
+		std::lock_guard<std::mutex> guard(_lock);
+		client_t client = {socket, std::string(), 0};
+		_clients.push_back(client);
 	}
+}
 
-	int client = ::accept(_socket, NULL, NULL);
-	Log::add_destination(new SocketDestination(client));
+bool SocketServerDestination::send_queue(client_t& client){
+	size_t sent = 0;
+	while ( sent < client.queue.size() ){
+		const ssize_t n = send(client.socket, client.queue.data() + sent, client.queue.size() - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if ( n > 0 ){
+			sent += static_cast<size_t>(n);
+		} else if ( n == -1 && errno == EINTR ){
+			continue;
+		} else if ( n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) ){
+			break;
+		} else {
+			return false;
+		}
+	}
 
+	client.queue.erase(0, sent);
 	return true;
 }
 
-namespace Log {
+void SocketServerDestination::write(const char* content, const char* decorated) const {
+	std::lock_guard<std::mutex> guard(_lock);
+	const size_t len = strlen(decorated);
+
+	for ( client_t& client: _clients ){
+		/* reserve room for the notice about dropped messages, the queue is
+		 * otherwise only sent when the batch is flushed */
+		if ( client.queue.size() + len + 64 > LOG_CLIENT_QUEUE ){
+			send_queue(client);
+		}
+		if ( client.queue.size() + len + 64 > LOG_CLIENT_QUEUE ){
+			client.dropped++;
+			continue;
+		}
 
-	static char *timestring(char *buffer, int bufferlen);
-	static const char* severity_string(Severity severity);
+		if ( client.dropped > 0 ){
+			char notice[64];
+			snprintf(notice, sizeof(notice), "(WW) Log: %u message(s) dropped (client too slow)\n", client.dropped);
+			client.queue += notice;
+			client.dropped = 0;
+		}
 
-	void initialize(){
+		client.queue.append(decorated, len);
+	}
+}
+
+void SocketServerDestination::flush() const {
+	std::lock_guard<std::mutex> guard(_lock);
+
+	for ( auto it = _clients.begin(); it != _clients.end(); ){
+		if ( send_queue(*it) ){
+			++it;
+			continue;
+		}
+
+		/* disconnected */
+		close(it->socket);
+		it = _clients.erase(it);
+	}
+}
+
+/**
+ * Write a message to all destinations accepting it. Only called by the
+ * writer thread.
+ */
+static void dispatch(vector& destinations, const LogRecord& record){
+	static char timestamp_buf[64];
+	static time_t last = 0;
+
+	/* binary destinations gets the unformatted message */
+	bool text = false;
+	for ( iterator it = destinations.begin(); it != destinations.end(); ++it ){
+		if ( record.severity < it->second ) continue;
+		if ( it->first->deferred() ){
+			it->first->write_record(record);
+		} else {
+			text = true;
+		}
+	}
+
+	if ( !text ){
+		return;
+	}
+
+	/* timestamp is formatted at most once per second */
+	const time_t timestamp = static_cast<time_t>((record.timestamp + clock_offset) / 1000000000);
+	if ( timestamp != last ){
+		struct tm tm;
+		localtime_r(&timestamp, &tm);
+		strftime(timestamp_buf, sizeof(timestamp_buf), "%Y-%m-%d %H:%M:%S", &tm);
+		last = timestamp;
+	}
+
+	/* the buffer is grown (and kept) when a message doesn't fit */
+	static std::vector<char> content(LOG_TEXT_SIZE);
+	static std::string decorated;
+	size_t len;
+	while ( true ){
+		len = LogFormat::format(content.data(), content.size(), record.format, record.args, record.args_size);
+		if ( len + 1 < content.size() || content.size() > LOG_MESSAGE_MAX ) break;
+		content.resize(content.size() * 4);
+	}
+
+	char prefix[96];
+	snprintf(prefix, sizeof(prefix), "(%s) [%s] ", LogFormat::severity_string(record.severity), timestamp_buf);
+	decorated.assign(prefix);
+	decorated.append(content.data(), len);
+
+	for ( iterator it = destinations.begin(); it != destinations.end(); ++it ){
+		if ( record.severity < it->second || it->first->deferred() ) continue;
+		it->first->write(content.data(), decorated.c_str());
+	}
+}
+
+/**
+ * Write a message from the writer thread itself.
+ */
+static void dispatch_message(vector& destinations, Severity severity, const char* fmt, ...){
+	char args[128];
+	va_list ap;
+	va_start(ap, fmt);
+	LogRecord record = {severity, clock_ns(CLOCK_MONOTONIC), fmt, args, LogFormat::pack(args, sizeof(args), fmt, ap)};
+	va_end(ap);
+	dispatch(destinations, record);
+}
+
+/**
+ * Write all queued messages.
+ * @return Number of messages written.
+ */
+static size_t drain(){
+	/* the destinations is written without holding lock so a stalled
+	 * destination (e.g. a FIFO without reader) cannot block fork (see
+	 * prepare_fork) or add_destination. Destinations is only released by
+	 * cleanup, after the writer has stopped. */
+	vector targets;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		targets = destinations;
+	}
+
+	size_t n = 0;
+
+	const unsigned int lost = dropped.exchange(0);
+	if ( lost > 0 ){
+		dispatch_message(targets, Log_Warning, "Log: %u message(s) dropped (queue full)\n", lost);
+	}
+
+	while ( true ){
+		record_t& record = ring[dequeue_pos & (LOG_RING_SIZE - 1)];
+		if ( record.sequence.load(std::memory_order_acquire) != dequeue_pos + 1 ){
+			break;
+		}
 
+		const char* data = record.heap ? record.heap : record.data;
+		const LogRecord message = {record.severity, record.timestamp, data, data + record.format_len + 1, record.args_size};
+		dispatch(targets, message);
+		free(record.heap);
+		record.heap = NULL;
+
+		/* free the slot for the producer one lap ahead */
+		record.sequence.store(dequeue_pos + LOG_RING_SIZE, std::memory_order_release);
+		dequeue_pos++;
+		n++;
+	}
+
+	/* one flush per batch instead of per message */
+	if ( n > 0 || lost > 0 ){
+		for ( iterator it = targets.begin(); it != targets.end(); ++it ){
+			it->first->flush();
+		}
+	}
+
+	return n;
+}
+
+static void run(){
+	std::unique_lock<std::mutex> guard(wakeup_lock);
+
+	while ( true ){
+		guard.unlock();
+		const size_t n = drain();
+		guard.lock();
+
+		if ( writer_stop ){
+			if ( n == 0 ) break;
+			continue;
+		}
+
+		/* producers only notify when the writer is idle, a notification lost
+		 * in between is picked up by the timeout */
+		if ( n == 0 ){
+			writer_idle = true;
+			wakeup.wait_for(guard, std::chrono::milliseconds(100));
+			writer_idle = false;
+		}
+	}
+}
+
+static size_t pack_args(char* dst, size_t size, const char* fmt, ...){
+	va_list ap;
+	va_start(ap, fmt);
+	const size_t n = LogFormat::pack(dst, size, fmt, ap);
+	va_end(ap);
+	return n;
+}
+
+/**
+ * Format a message too large for a record into a separate allocation, stored
+ * as "%s" with the text as argument. Messages longer than LOG_MESSAGE_MAX is
+ * truncated with a marker.
+ *
+ * @return NULL if out of memory.
+ */
+static char* pack_oversized(const char* fmt, va_list ap, size_t& args_size){
+	va_list copy;
+	va_copy(copy, ap);
+	const int n = vsnprintf(NULL, 0, fmt, copy);
+	va_end(copy);
+	if ( n < 0 ){
+		return NULL;
+	}
+
+	const size_t marker = sizeof(LOG_TRUNCATED_MARKER) - 1;
+	const bool truncated = static_cast<size_t>(n) > LOG_MESSAGE_MAX;
+	const size_t len = truncated ? LOG_MESSAGE_MAX + marker : static_cast<size_t>(n);
+
+	/* "%s\0", then the packed string (tag, uint16 length, text) */
+	const size_t header = 3 + 1 + sizeof(uint16_t);
+	char* heap = static_cast<char*>(malloc(header + len + 1));
+	if ( !heap ){
+		return NULL;
+	}
+
+	char* text = heap + header;
+	va_copy(copy, ap);
+	vsnprintf(text, LOG_MESSAGE_MAX + 1, fmt, copy);
+	va_end(copy);
+	if ( truncated ){
+		memcpy(text + LOG_MESSAGE_MAX, LOG_TRUNCATED_MARKER, marker);
+	}
+
+	const uint16_t len16 = static_cast<uint16_t>(len);
+	memcpy(heap, "%s", 3);
+	heap[3] = 's';
+	memcpy(heap + 4, &len16, sizeof(len16));
+	args_size = 1 + sizeof(uint16_t) + len;
+	return heap;
+}
+
+static void stop_writer(){
+	if ( !writer ){
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(wakeup_lock);
+		writer_stop = true;
+		wakeup.notify_one();
+	}
+
+	writer->join();
+	delete writer;
+	writer = NULL;
+	writer_stop = false;
+	writer_started = false;
+}
+
+/* the mutexes must not be held by another thread when forking (e.g. when
+ * daemonizing) and the writer thread doesn't exist in the child. They is only
+ * held briefly, never while writing to a destination, so forking (e.g. from
+ * the render thread) doesn't block on a slow destination. */
+static void prepare_fork(){
+	wakeup_lock.lock();
+	lock.lock();
+	level_lock.lock();
+}
+
+static void parent_fork(){
+	level_lock.unlock();
+	lock.unlock();
+	wakeup_lock.unlock();
+}
+
+static void child_fork(){
+	level_lock.unlock();
+	lock.unlock();
+	wakeup_lock.unlock();
+
+	/* the thread object belongs to the parent, leaked intentionally */
+	writer = NULL;
+	writer_started = false;
+}
+
+/**
+ * Recalculate the level shortcuts and invalidate the module caches. Caller must
+ * hold level_lock.
+ */
+static void update_levels(){
+	Severity lowest = global_level;
+	for ( auto& module: module_levels ){
+		lowest = std::min(lowest, module.second);
+	}
+
+	lowest_level = std::max(static_cast<int>(lowest), destination_level.load());
+	__atomic_add_fetch(&log_generation, 1, __ATOMIC_RELEASE);
+}
+
+static bool parse_severity(const char* str, Severity& severity){
+	static const char* names[] = {"debug", "verbose", "info", "warning", "fatal"};
+	for ( int i = 0; i <= Log_Fatal; i++ ){
+		if ( strcasecmp(str, names[i]) == 0 || (isdigit(str[0]) && atoi(str) == i && str[1] == 0) ){
+			severity = static_cast<Severity>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+static void start_writer(){
+	static std::mutex start_lock;
+	std::lock_guard<std::mutex> guard(start_lock);
+	if ( writer_started ) return;
+
+	static bool registered = false;
+	if ( !registered ){
+		for ( size_t i = 0; i < LOG_RING_SIZE; i++ ){
+			ring[i].sequence.store(i, std::memory_order_relaxed);
+		}
+
+		clock_offset = clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_MONOTONIC);
+
+		pthread_atfork(prepare_fork, parent_fork, child_fork);
+		atexit(stop_writer);
+		registered = true;
+	}
+
+	writer = new std::thread(run);
+	writer_started = true;
+}
+
+namespace Log {
+
+	void initialize(){
+		start_writer();
 	}
 
 	void cleanup(){
+		/* write everything still queued */
+		stop_writer();
+
+		std::lock_guard<std::mutex> guard(lock);
 		for ( iterator it = destinations.begin(); it != destinations.end(); ++it ){
 			delete it->first;
 		}
@@ -207,7 +699,52 @@ namespace Log {
 	}
 
 	void add_destination(Destination* dst, Severity severity){
+		std::lock_guard<std::mutex> guard(lock);
 		destinations.push_back(std::pair<Destination*, Severity>(dst, severity));
+
+		/* messages no destination accepts is discarded before formatting */
+		Severity min = Log_Fatal;
+		for ( iterator it = destinations.begin(); it != destinations.end(); ++it ){
+			min = std::min(min, it->second);
+		}
+
+		std::lock_guard<std::mutex> level_guard(level_lock);
+		destination_level = min;
+		update_levels();
+	}
+
+	void set_level(Severity severity){
+		std::lock_guard<std::mutex> guard(level_lock);
+		global_level = severity;
+		update_levels();
+	}
+
+	bool set_module_levels(const char* levels){
+		std::lock_guard<std::mutex> guard(level_lock);
+		std::vector<std::pair<std::string, Severity>> parsed;
+		char* tmp = strdup(levels);
+		char* saveptr = NULL;
+		bool valid = true;
+
+		for ( char* item = strtok_r(tmp, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr) ){
+			char* eq = strchr(item, '=');
+			Severity severity;
+			if ( !eq || eq == item || !parse_severity(eq + 1, severity) ){
+				valid = false;
+				break;
+			}
+			*eq = 0;
+			parsed.push_back(std::make_pair(std::string(item), severity));
+		}
+		free(tmp);
+
+		if ( !valid ){
+			return false;
+		}
+
+		module_levels.swap(parsed);
+		update_levels();
+		return true;
 	}
 
 	void message(Severity severity, const char* fmt, ...){
@@ -218,43 +755,74 @@ namespace Log {
 	}
 
 	void vmessage(Severity severity, const char* fmt, va_list ap){
-		static char buf[255]; /* this isn't thread-safe anyway, might as well make it static */
+		/* not written by any destination (or module) */
+		if ( severity < lowest_level.load(std::memory_order_relaxed) && severity < Log_Fatal ){
+			return;
+		}
 
-		std::unique_ptr<char, free_delete> content(vasprintf2(fmt, ap));
-		std::unique_ptr<char, free_delete> decorated(asprintf2("(%s) [%s] %s", severity_string(severity), timestring(buf, 255), content.get()));
+		if ( !writer_started ){
+			start_writer();
+		}
 
-		for ( iterator it = destinations.begin(); it != destinations.end(); ++it ){
-			if ( severity < it->second ) continue;
-			Destination* dst = it->first;
-			dst->write(content.get(), decorated.get());
+		/* reserve a slot (multi-producer, see record_t) */
+		record_t* record;
+		size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+		while ( true ){
+			record = &ring[pos & (LOG_RING_SIZE - 1)];
+			const size_t sequence = record->sequence.load(std::memory_order_acquire);
+
+			if ( sequence == pos ){
+				if ( enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed) ){
+					break;
+				}
+			} else if ( sequence < pos ){
+				/* full: fatal messages waits for the writer, everything else is
+				 * dropped rather than blocking the caller */
+				if ( severity < Log_Fatal ){
+					dropped++;
+					return;
+				}
+				std::this_thread::yield();
+				pos = enqueue_pos.load(std::memory_order_relaxed);
+			} else {
+				pos = enqueue_pos.load(std::memory_order_relaxed);
+			}
 		}
-	}
 
-	char* timestring(char *buffer, int bufferlen) {
-		time_t t = time(NULL);
-		struct tm* nt;
-#ifdef WIN32
-		nt = new struct tm;
-		localtime_s(nt, &t);
-#else
-		nt = localtime(&t);
-#endif
-		strftime(buffer, bufferlen, "%Y-%m-%d %H:%M:%S", nt);
-#ifdef WIN32
-		delete nt;
-#endif
-		return buffer;
-	}
+		record->severity = severity;
+		record->timestamp = clock_ns(CLOCK_MONOTONIC);
+
+		/* formatting is deferred to the writer (or the log decoder), only the
+		 * arguments is copied here */
+		const size_t format_len = strlen(fmt);
+		bool truncated = true;
+		record->heap = NULL;
+		if ( format_len < LOG_RECORD_SIZE / 2 ){
+			memcpy(record->data, fmt, format_len + 1);
+			record->format_len = format_len;
+			record->args_size = LogFormat::pack(record->data + format_len + 1, LOG_RECORD_SIZE - format_len - 1, fmt, ap, &truncated);
+		}
 
-	const char* severity_string(Severity severity){
-		switch ( severity ){
-		case Log_Debug: return "DD";
-		case Log_Verbose: return "--";
-		case Log_Info: return "  ";
-		case Log_Warning: return "WW";
-		case Log_Fatal: return "!!";
+		/* long format or arguments (e.g. shader logs), store it formatted instead */
+		if ( truncated ){
+			size_t args_size;
+			char* heap = pack_oversized(fmt, ap, args_size);
+			if ( heap ){
+				record->heap = heap;
+				record->format_len = 2;
+				record->args_size = args_size;
+			} else if ( format_len >= LOG_RECORD_SIZE / 2 ){
+				memcpy(record->data, "%s", 3);
+				record->format_len = 2;
+				record->args_size = pack_args(record->data + 3, LOG_RECORD_SIZE - 3, "%s", "(out of memory)\n");
+			}
+		}
+
+		record->sequence.store(pos + 1, std::memory_order_release);
+
+		if ( writer_idle ){
+			wakeup.notify_one();
 		}
-		return NULL;
 	}
 
 	void debug(const char* fmt, ...){
@@ -298,6 +866,33 @@ namespace Log {
 
 }
 
+extern "C" int log_module_resolve(struct log_module_t* module){
+	const unsigned int generation = __atomic_load_n(&log_generation, __ATOMIC_ACQUIRE);
+
+	/* module name is the basename without extension, e.g. "sqlite" */
+	const char* basename = strrchr(module->filename, '/');
+	std::string name(basename ? basename + 1 : module->filename);
+	name = name.substr(0, name.find('.'));
+
+	int level;
+	{
+		std::lock_guard<std::mutex> guard(level_lock);
+		level = global_level;
+		for ( auto& override: module_levels ){
+			if ( fnmatch(override.first.c_str(), name.c_str(), 0) == 0 ){
+				level = override.second;
+			}
+		}
+	}
+	level = std::max(level, destination_level.load());
+
+	/* if the levels changed meanwhile the older generation is stored and the
+	 * level is resolved again next time */
+	__atomic_store_n(&module->level, level, __ATOMIC_RELAXED);
+	__atomic_store_n(&module->generation, generation, __ATOMIC_RELEASE);
+	return level;
+}
+
 extern "C" void log_message(enum Severity severity, const char* fmt, ...){
 	va_list ap;
 	va_start(ap, fmt);
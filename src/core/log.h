@@ -40,6 +40,60 @@ enum Severity {
 void  log_message(enum Severity severity, const char* fmt, ...) __attribute__((format(printf,2,3)));
 void log_vmessage(enum Severity severity, const char* fmt, va_list ap);
 
+/**
+ * Lowest severity compiled in (configure --with-log-floor). Messages below it
+ * logged using the macros below compiles to nothing.
+ */
+#ifndef LOG_FLOOR
+#	define LOG_FLOOR Log_Debug
+#endif
+
+/**
+ * Level of a source module (the basename of the source file, e.g. "sqlite")
+ * cached for the macros below. The cache is refreshed when the levels or
+ * destinations change (log_generation).
+ */
+struct log_module_t {
+	const char* filename;
+	int level;
+	unsigned int generation;
+};
+
+extern unsigned int log_generation;
+
+/**
+ * Refresh the cached level of a module.
+ * @return The level, i.e. the lowest severity written.
+ */
+int log_module_resolve(struct log_module_t* module);
+
+/* each source file gets its own module */
+static struct log_module_t log_module __attribute__((unused)) = {__BASE_FILE__, 0, 0};
+
+static inline int log_module_level(struct log_module_t* module){
+	if ( __atomic_load_n(&module->generation, __ATOMIC_ACQUIRE) != __atomic_load_n(&log_generation, __ATOMIC_RELAXED) ){
+		return log_module_resolve(module);
+	}
+	return __atomic_load_n(&module->level, __ATOMIC_RELAXED);
+}
+
+/**
+ * Test if a message from the current source file would be written.
+ */
+#define log_enabled(severity) ((severity) >= LOG_FLOOR && (int)(severity) >= log_module_level(&log_module))
+
+/**
+ * Log a message if enabled, arguments is only evaluated (and the message only
+ * formatted) if it is.
+ */
+#define log_printf(severity, ...) \
+	do { if ( log_enabled(severity) ) log_message(severity, __VA_ARGS__); } while (0)
+
+#define log_debug(...)   log_printf(Log_Debug, __VA_ARGS__)
+#define log_verbose(...) log_printf(Log_Verbose, __VA_ARGS__)
+#define log_info(...)    log_printf(Log_Info, __VA_ARGS__)
+#define log_warning(...) log_printf(Log_Warning, __VA_ARGS__)
+
 #ifdef __cplusplus
 }
 #endif
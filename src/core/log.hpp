@@ -21,8 +21,23 @@
 
 #include "log.h"
 #include <cstdio>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
+/**
+ * A message before formatting, see LogFormat.
+ */
+struct LogRecord {
+	Severity severity;
+	int64_t timestamp;     /* CLOCK_MONOTONIC in ns */
+	const char* format;
+	const char* args;      /* packed arguments */
+	size_t args_size;
+};
+
 class Destination {
 	public:
 		virtual ~Destination(){}
@@ -33,6 +48,18 @@ class Destination {
 		 * @param decorated Decorated content (timestamp etc)
 		 */
 		virtual void write(const char* content, const char* decorated) const = 0;
+
+		/**
+		 * Called after a batch of messages has been written.
+		 */
+		virtual void flush() const {}
+
+		/**
+		 * Destinations returning true gets the unformatted message passed to
+		 * write_record instead of write.
+		 */
+		virtual bool deferred() const { return false; }
+		virtual void write_record(const LogRecord& record) const {}
 };
 
 class FileDestination: public Destination {
@@ -49,6 +76,7 @@ class FileDestination: public Destination {
 
 		virtual ~FileDestination();
 		virtual void write(const char* content, const char* decorated) const;
+		virtual void flush() const;
 
 	private:
 		FILE* _fp;
@@ -64,21 +92,31 @@ class FIFODestination: public Destination {
 
 		virtual ~FIFODestination();
 		virtual void write(const char* content, const char* decorated) const;
+		virtual void flush() const;
 
 	private:
 		char* _filename;
 		FILE* _fp;
 };
 
-class SocketDestination: public Destination {
+/**
+ * Binary log where messages is stored unformatted (format string id and
+ * packed arguments), use slideshow-logdecode to read it. See log_format.hpp
+ * for the file format.
+ */
+class BinaryDestination: public Destination {
 	public:
-		SocketDestination(int socket);
-		virtual ~SocketDestination();
+		BinaryDestination(const char* filename);
+		virtual ~BinaryDestination();
 
 		virtual void write(const char* content, const char* decorated) const;
+		virtual bool deferred() const { return true; }
+		virtual void write_record(const LogRecord& record) const;
+		virtual void flush() const;
 
 	private:
-		int _socket;
+		FILE* _fp;
+		mutable std::unordered_map<std::string, uint32_t> _formats;
 };
 
 /**
@@ -89,13 +127,59 @@ class UDSServer {
 		UDSServer(const char* filename);
 		~UDSServer();
 
-		bool accept(struct timeval *timeout) const;
+		/**
+		 * Accept a pending client.
+		 * @return Client socket or -1.
+		 */
+		int accept_client() const;
+
+		int fd() const { return _socket; }
 
 	private:
 		char* _filename;
 		int _socket;
 };
 
+/**
+ * Log to any number of clients connected to a unix domain socket. Clients is
+ * accepted by calling accept() when fd() is readable (i.e. from the event
+ * loop). Each client has a bounded queue which is written without blocking, a
+ * client not keeping up has messages dropped (and is told how many) instead
+ * of stalling the log writer.
+ */
+class SocketServerDestination: public Destination {
+	public:
+		SocketServerDestination(const char* filename);
+		virtual ~SocketServerDestination();
+
+		virtual void write(const char* content, const char* decorated) const;
+		virtual void flush() const;
+
+		/**
+		 * Accept all pending clients.
+		 */
+		void accept();
+
+		int fd() const { return _server.fd(); }
+
+	private:
+		struct client_t {
+			int socket;
+			std::string queue;      /* unsent data */
+			unsigned int dropped;   /* messages dropped since the last notice */
+		};
+
+		/**
+		 * Send as much as possible of the queue without blocking.
+		 * @return False if the client has disconnected.
+		 */
+		static bool send_queue(client_t& client);
+
+		UDSServer _server;
+		mutable std::mutex _lock;   /* protects _clients */
+		mutable std::vector<client_t> _clients;
+};
+
 #ifdef HAVE_SYSLOG
 class SyslogDestination: public Destination {
 	public:
@@ -105,9 +189,23 @@ class SyslogDestination: public Destination {
 };
 #endif /* HAVE_SYSLOG */
 
+/**
+ * The caller only packs the arguments (see LogFormat::pack) into a lock-free
+ * ring, formatting is deferred to a background thread writing to the
+ * destinations (or to slideshow-logdecode for binary logs), so logging never
+ * blocks on a slow destination. If the ring is full the message is dropped
+ * (and counted) except for fatal messages which waits for the writer.
+ */
 namespace Log {
 
+	/**
+	 * Start the writer thread (also started by the first message).
+	 */
 	void initialize();
+
+	/**
+	 * Write all queued messages and release all destinations.
+	 */
 	void cleanup();
 
 	/**
@@ -117,6 +215,18 @@ namespace Log {
 	 */
 	void add_destination(Destination* dst, Severity severity = Log_Debug);
 
+	/**
+	 * Set the lowest severity written.
+	 */
+	void set_level(Severity severity);
+
+	/**
+	 * Override the level of source modules (basename of the source file),
+	 * e.g. "sqlite=debug,graphics=warning". Module names may contain globs.
+	 * @return False if the string is malformed (levels is unchanged).
+	 */
+	bool set_module_levels(const char* levels);
+
 	void  message(Severity severity, const char* fmt, ...) __attribute__ ((format (printf, 2, 3)));
 	void vmessage(Severity severity, const char* fmt, va_list ap);
 
@@ -0,0 +1,399 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2014 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "core/log_format.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <stdarg.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+enum length_t {
+	LENGTH_NONE,
+	LENGTH_CHAR,       /* hh */
+	LENGTH_SHORT,      /* h */
+	LENGTH_LONG,       /* l */
+	LENGTH_LONGLONG,   /* ll, q */
+	LENGTH_SIZE,       /* z */
+	LENGTH_INTMAX,     /* j */
+	LENGTH_PTRDIFF,    /* t */
+	LENGTH_DOUBLE,     /* L */
+};
+
+/**
+ * A parsed conversion specification.
+ */
+struct spec_t {
+	const char* begin;    /* at '%' */
+	const char* end;      /* after the conversion */
+	const char* flags;    /* flags, width and precision (excluding length) */
+	size_t flags_len;
+	bool star_width;
+	bool star_precision;
+	enum length_t length;
+	char conversion;
+};
+
+/**
+ * Parse the conversion starting at fmt (pointing at '%').
+ * @return false if the conversion is unknown.
+ */
+static bool parse_spec(const char* fmt, spec_t& spec){
+	const char* ptr = fmt + 1;
+
+	spec.begin = fmt;
+	spec.flags = ptr;
+	spec.star_width = false;
+	spec.star_precision = false;
+	spec.length = LENGTH_NONE;
+
+	ptr += strspn(ptr, "-+ #0'");
+	if ( *ptr == '*' ){
+		spec.star_width = true;
+		ptr++;
+	} else {
+		ptr += strspn(ptr, "0123456789");
+	}
+
+	if ( *ptr == '.' ){
+		ptr++;
+		if ( *ptr == '*' ){
+			spec.star_precision = true;
+			ptr++;
+		} else {
+			ptr += strspn(ptr, "0123456789");
+		}
+	}
+	spec.flags_len = static_cast<size_t>(ptr - spec.flags);
+
+	switch ( *ptr ){
+	case 'h':
+		ptr++;
+		spec.length = LENGTH_SHORT;
+		if ( *ptr == 'h' ){ ptr++; spec.length = LENGTH_CHAR; }
+		break;
+	case 'l':
+		ptr++;
+		spec.length = LENGTH_LONG;
+		if ( *ptr == 'l' ){ ptr++; spec.length = LENGTH_LONGLONG; }
+		break;
+	case 'q': ptr++; spec.length = LENGTH_LONGLONG; break;
+	case 'z': ptr++; spec.length = LENGTH_SIZE; break;
+	case 'j': ptr++; spec.length = LENGTH_INTMAX; break;
+	case 't': ptr++; spec.length = LENGTH_PTRDIFF; break;
+	case 'L': ptr++; spec.length = LENGTH_DOUBLE; break;
+	}
+
+	spec.conversion = *ptr;
+	spec.end = ptr + 1;
+	return *ptr && strchr("diouxXcsfFeEgGaApn", *ptr) != NULL;
+}
+
+static bool put(char*& dst, const char* end, char tag, const void* value, size_t size){
+	if ( static_cast<size_t>(end - dst) < size + 1 ){
+		return false;
+	}
+
+	*dst++ = tag;
+	memcpy(dst, value, size);
+	dst += size;
+	return true;
+}
+
+static bool put_int(char*& dst, const char* end, int64_t value){
+	return put(dst, end, 'i', &value, sizeof(value));
+}
+
+static int64_t signed_arg(const spec_t& spec, va_list& ap){
+	switch ( spec.length ){
+	case LENGTH_LONG:     return va_arg(ap, long);
+	case LENGTH_LONGLONG: return va_arg(ap, long long);
+	case LENGTH_SIZE:     return va_arg(ap, ssize_t);
+	case LENGTH_INTMAX:   return va_arg(ap, intmax_t);
+	case LENGTH_PTRDIFF:  return va_arg(ap, ptrdiff_t);
+	case LENGTH_CHAR:     return static_cast<signed char>(va_arg(ap, int));
+	case LENGTH_SHORT:    return static_cast<short>(va_arg(ap, int));
+	default:              return va_arg(ap, int);
+	}
+}
+
+static int64_t unsigned_arg(const spec_t& spec, va_list& ap){
+	switch ( spec.length ){
+	case LENGTH_LONG:     return static_cast<int64_t>(va_arg(ap, unsigned long));
+	case LENGTH_LONGLONG: return static_cast<int64_t>(va_arg(ap, unsigned long long));
+	case LENGTH_SIZE:     return static_cast<int64_t>(va_arg(ap, size_t));
+	case LENGTH_INTMAX:   return static_cast<int64_t>(va_arg(ap, uintmax_t));
+	case LENGTH_PTRDIFF:  return static_cast<int64_t>(va_arg(ap, ptrdiff_t));
+	case LENGTH_CHAR:     return static_cast<unsigned char>(va_arg(ap, unsigned int));
+	case LENGTH_SHORT:    return static_cast<unsigned short>(va_arg(ap, unsigned int));
+	default:              return va_arg(ap, unsigned int);
+	}
+}
+
+namespace LogFormat {
+
+	size_t pack(char* dst, size_t size, const char* fmt, va_list ap_in, bool* truncated){
+		char* ptr = dst;
+		const char* end = dst + size;
+		bool full = false;
+
+		va_list ap;
+		va_copy(ap, ap_in);
+
+		for ( const char* c = strchr(fmt, '%'); c; c = strchr(c, '%') ){
+			if ( c[1] == '%' ){
+				c += 2;
+				continue;
+			}
+
+			spec_t spec;
+			if ( !parse_spec(c, spec) ){
+				break;
+			}
+			c = spec.end;
+
+			/* the arguments must be consumed even when they doesn't fit */
+			if ( spec.star_width ){
+				const int64_t value = va_arg(ap, int);
+				full = full || !put_int(ptr, end, value);
+			}
+			if ( spec.star_precision ){
+				const int64_t value = va_arg(ap, int);
+				full = full || !put_int(ptr, end, value);
+			}
+
+			switch ( spec.conversion ){
+			case 'd': case 'i':
+			{
+				const int64_t value = signed_arg(spec, ap);
+				full = full || !put_int(ptr, end, value);
+				break;
+			}
+
+			case 'o': case 'u': case 'x': case 'X': case 'c':
+			{
+				const int64_t value = unsigned_arg(spec, ap);
+				full = full || !put_int(ptr, end, value);
+				break;
+			}
+
+			case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+			{
+				const double value = spec.length == LENGTH_DOUBLE ? static_cast<double>(va_arg(ap, long double)) : va_arg(ap, double);
+				full = full || !put(ptr, end, 'd', &value, sizeof(value));
+				break;
+			}
+
+			case 'p':
+			{
+				const uint64_t value = reinterpret_cast<uintptr_t>(va_arg(ap, void*));
+				full = full || !put(ptr, end, 'p', &value, sizeof(value));
+				break;
+			}
+
+			case 's':
+			{
+				const char* value;
+				if ( spec.length == LENGTH_LONG ){
+					(void)va_arg(ap, void*);
+					value = "(wide)";
+				} else {
+					value = va_arg(ap, const char*);
+				}
+				if ( !value ) value = "(null)";
+
+				/* truncate to what fits */
+				const size_t avail = static_cast<size_t>(end - ptr);
+				if ( full || avail < 1 + sizeof(uint16_t) ){
+					full = true;
+					break;
+				}
+
+				const size_t full_len = strlen(value);
+				const size_t len = std::min(full_len, std::min(avail - 1 - sizeof(uint16_t), static_cast<size_t>(UINT16_MAX)));
+				full = full || len < full_len;
+				const uint16_t len16 = static_cast<uint16_t>(len);
+				*ptr++ = 's';
+				memcpy(ptr, &len16, sizeof(len16));
+				memcpy(ptr + sizeof(len16), value, len);
+				ptr += sizeof(len16) + len;
+				break;
+			}
+
+			case 'n':
+				(void)va_arg(ap, void*);
+				break;
+			}
+		}
+
+		va_end(ap);
+		if ( truncated ){
+			*truncated = full;
+		}
+		return static_cast<size_t>(ptr - dst);
+	}
+
+	size_t format(char* dst, size_t size, const char* fmt, const char* args, size_t args_size){
+		const char* arg = args;
+		const char* args_end = args + args_size;
+		size_t pos = 0;
+
+		if ( size == 0 ){
+			return 0;
+		}
+
+		/* append to dst, keeping pos at the terminator if truncated */
+		auto advance = [&](int n){
+			if ( n > 0 ) pos = std::min(pos + static_cast<size_t>(n), size - 1);
+		};
+
+		auto next = [&](char tag, void* value, size_t value_size) -> bool {
+			if ( arg >= args_end || *arg != tag || static_cast<size_t>(args_end - arg) < 1 + value_size ){
+				return false;
+			}
+			memcpy(value, arg + 1, value_size);
+			arg += 1 + value_size;
+			return true;
+		};
+
+		const char* c = fmt;
+		while ( *c && pos < size - 1 ){
+			if ( *c != '%' ){
+				dst[pos++] = *c++;
+				continue;
+			}
+
+			if ( c[1] == '%' ){
+				dst[pos++] = '%';
+				c += 2;
+				continue;
+			}
+
+			spec_t spec;
+			if ( !parse_spec(c, spec) ){
+				/* copy the rest verbatim */
+				advance(snprintf(dst + pos, size - pos, "%s", c));
+				break;
+			}
+			c = spec.end;
+
+			/* rebuild the conversion with * replaced by the values */
+			char conversion[64];
+			size_t n = 0;
+			bool missing = false;
+			conversion[n++] = '%';
+			for ( size_t i = 0; i < spec.flags_len && n < 40; i++ ){
+				const char f = spec.flags[i];
+				if ( f != '*' ){
+					conversion[n++] = f;
+					continue;
+				}
+
+				int64_t value;
+				if ( !next('i', &value, sizeof(value)) ){
+					missing = true;
+					break;
+				}
+				n += static_cast<size_t>(snprintf(conversion + n, sizeof(conversion) - n, "%d", static_cast<int>(value)));
+			}
+
+			const char* length = "";
+			switch ( spec.conversion ){
+			case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+				length = "ll";
+				break;
+			}
+			n += static_cast<size_t>(snprintf(conversion + n, sizeof(conversion) - n, "%s%c", length, spec.conversion));
+
+			if ( missing ){
+				advance(snprintf(dst + pos, size - pos, "<?>"));
+				continue;
+			}
+
+			switch ( spec.conversion ){
+			case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+			{
+				int64_t value;
+				if ( !next('i', &value, sizeof(value)) ){ missing = true; break; }
+				if ( spec.conversion == 'c' ){
+					advance(snprintf(dst + pos, size - pos, conversion, static_cast<int>(value)));
+				} else {
+					advance(snprintf(dst + pos, size - pos, conversion, static_cast<long long>(value)));
+				}
+				break;
+			}
+
+			case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+			{
+				double value;
+				if ( !next('d', &value, sizeof(value)) ){ missing = true; break; }
+				advance(snprintf(dst + pos, size - pos, conversion, value));
+				break;
+			}
+
+			case 'p':
+			{
+				uint64_t value;
+				if ( !next('p', &value, sizeof(value)) ){ missing = true; break; }
+				advance(snprintf(dst + pos, size - pos, conversion, reinterpret_cast<void*>(static_cast<uintptr_t>(value))));
+				break;
+			}
+
+			case 's':
+			{
+				uint16_t len;
+				if ( !next('s', &len, sizeof(len)) || static_cast<size_t>(args_end - arg) < len ){ missing = true; break; }
+
+				/* the packed string isn't terminated so copy it */
+				const std::string value(arg, len);
+				arg += len;
+				advance(snprintf(dst + pos, size - pos, conversion, value.c_str()));
+				break;
+			}
+
+			case 'n':
+				break;
+			}
+
+			if ( missing ){
+				advance(snprintf(dst + pos, size - pos, "<?>"));
+			}
+		}
+
+		dst[pos] = 0;
+		return pos;
+	}
+
+	const char* severity_string(Severity severity){
+		switch ( severity ){
+		case Log_Debug: return "DD";
+		case Log_Verbose: return "--";
+		case Log_Info: return "  ";
+		case Log_Warning: return "WW";
+		case Log_Fatal: return "!!";
+		}
+		return "??";
+	}
+
+}
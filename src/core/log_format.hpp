@@ -0,0 +1,88 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2014 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SLIDESHOW_LOG_FORMAT_HPP
+#define SLIDESHOW_LOG_FORMAT_HPP
+
+#include "core/log.h"
+#include <cstddef>
+#include <stdint.h>
+
+/**
+ * Deferred log formatting.
+ *
+ * Instead of formatting a message when it is logged the printf arguments is
+ * packed (guided by the format string) into a buffer which can be formatted
+ * later, possibly by another process reading a binary log.
+ *
+ * Packed arguments is a sequence of a one byte tag followed by the value in
+ * native byte order:
+ *   'i' int64_t   (all integer conversions, including * width/precision)
+ *   'd' double    (long double is narrowed)
+ *   'p' uint64_t  (pointers)
+ *   's' uint16_t length followed by the string (without terminator)
+ */
+namespace LogFormat {
+
+	/**
+	 * Pack the arguments referenced by fmt. Strings is truncated (and
+	 * arguments which doesn't fit is left out) if the buffer is too small.
+	 *
+	 * @param truncated If non-null set to whenever anything was truncated.
+	 * @return Number of bytes used.
+	 */
+	size_t pack(char* dst, size_t size, const char* fmt, va_list ap, bool* truncated = NULL);
+
+	/**
+	 * Format a message from packed arguments. Missing arguments is written as
+	 * "<?>".
+	 *
+	 * @return Length of the formatted message (truncated to size - 1).
+	 */
+	size_t format(char* dst, size_t size, const char* fmt, const char* args, size_t args_size);
+
+	const char* severity_string(Severity severity);
+}
+
+/**
+ * Binary log file, written by BinaryDestination and read by
+ * slideshow-logdecode. The file is a sequence of records, each starting with
+ * a one byte type. All integers is in native byte order.
+ *
+ * 'H' header: magic "SSLG", uint32 version, int64 realtime and int64
+ *     monotonic clock (ns) sampled at the same time. Written each time the
+ *     file is opened and resets the format table.
+ * 'F' format: uint32 id, uint16 length, format string.
+ * 'M' message: uint32 format id, uint8 severity, int64 monotonic timestamp
+ *     (ns), uint16 size, packed arguments.
+ * 'E' end: magic "SSLG". Written when the file is closed.
+ * 0   padding, ignored.
+ *
+ * A file not ending with 'E' (e.g. the player was killed or lost power) might
+ * end with a partial record. The next session then starts with
+ * LOG_BINARY_SYNC_SIZE bytes of padding, larger than any record, so the
+ * decoder can resynchronize at the following header.
+ */
+#define LOG_MESSAGE_MAX 32768    /* longer messages is truncated (with a marker) */
+#define LOG_TRUNCATED_MARKER "... (truncated)\n"
+
+#define LOG_BINARY_MAGIC "SSLG"
+#define LOG_BINARY_VERSION 2
+#define LOG_BINARY_SYNC_SIZE (UINT16_MAX + 64)
+
+#endif /* SLIDESHOW_LOG_FORMAT_HPP */
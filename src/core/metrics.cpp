@@ -0,0 +1,202 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2014 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "core/metrics.hpp"
+#include "core/event_loop.hpp"
+#include "core/frame_scheduler.hpp"
+#include "core/log.hpp"
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <set>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+/* upper bounds in seconds (+Inf is implicit) */
+static const double buckets[] = {
+	0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0,
+};
+static const size_t num_buckets = sizeof(buckets) / sizeof(double);
+
+static const char* stage_name[Metrics::StageCount] = {
+	"next_slide",
+	"fetch",
+	"decode",
+	"letterbox",
+	"upload",
+	"frame",
+	"swap",
+};
+
+struct histogram_t {
+	std::atomic<uint64_t> bucket[sizeof(buckets) / sizeof(double)]; /* non-cumulative */
+	std::atomic<uint64_t> count;
+	std::atomic<uint64_t> sum;      /* in nanoseconds */
+};
+
+static histogram_t histogram[Metrics::StageCount];
+static std::unique_ptr<UDSServer> server;
+static std::set<int> clients;
+
+static void respond(int client){
+	char request[1024];
+	const ssize_t bytes = recv(client, request, sizeof(request), 0);
+
+	if ( bytes > 0 ){
+		const std::string body = Metrics::render();
+		std::string response;
+
+		if ( bytes >= 4 && strncmp(request, "GET ", 4) == 0 ){
+			char header[128];
+			snprintf(header, sizeof(header),
+			         "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", body.size());
+			response = header;
+		}
+		response += body;
+
+		if ( send(client, response.data(), response.size(), MSG_NOSIGNAL) == -1 ){
+			log_debug("Metrics: send failed: %s\n", strerror(errno));
+		}
+	}
+
+	/* one response per connection */
+	EventLoop::remove(client);
+	clients.erase(client);
+	::close(client);
+}
+
+static void accept_client(){
+	const int client = server->accept_client();
+	if ( client == -1 ){
+		Log::warning("Metrics: accept failed: %s\n", strerror(errno));
+		return;
+	}
+
+	if ( EventLoop::add(client, [client]{ respond(client); }) != 0 ){
+		::close(client);
+		return;
+	}
+
+	clients.insert(client);
+}
+
+namespace Metrics {
+
+	void observe(Stage stage, double seconds){
+		histogram_t& h = histogram[stage];
+
+		size_t i = 0;
+		while ( i < num_buckets && seconds > buckets[i] ) i++;
+		if ( i < num_buckets ){
+			h.bucket[i].fetch_add(1, std::memory_order_relaxed);
+		}
+
+		h.count.fetch_add(1, std::memory_order_relaxed);
+		h.sum.fetch_add(static_cast<uint64_t>(seconds * 1e9), std::memory_order_relaxed);
+	}
+
+	Timer::Timer(Stage stage)
+		: _stage(stage)
+		, _begin(FrameScheduler::now()){
+
+	}
+
+	Timer::~Timer(){
+		observe(_stage, FrameScheduler::now() - _begin);
+	}
+
+	std::string render(){
+		std::string out;
+		char buf[256];
+
+		out += "# HELP slideshow_stage_seconds Time spent in each stage of the slide pipeline.\n";
+		out += "# TYPE slideshow_stage_seconds histogram\n";
+		for ( unsigned int stage = 0; stage < StageCount; stage++ ){
+			const histogram_t& h = histogram[stage];
+			const char* name = stage_name[stage];
+			const uint64_t count = h.count.load(std::memory_order_relaxed);
+
+			uint64_t cumulative = 0;
+			for ( size_t i = 0; i < num_buckets; i++ ){
+				cumulative += h.bucket[i].load(std::memory_order_relaxed);
+				snprintf(buf, sizeof(buf), "slideshow_stage_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n",
+				         name, buckets[i], static_cast<unsigned long long>(cumulative));
+				out += buf;
+			}
+
+			snprintf(buf, sizeof(buf), "slideshow_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n",
+			         name, static_cast<unsigned long long>(count));
+			out += buf;
+			snprintf(buf, sizeof(buf), "slideshow_stage_seconds_sum{stage=\"%s\"} %.9f\n",
+			         name, static_cast<double>(h.sum.load(std::memory_order_relaxed)) / 1e9);
+			out += buf;
+			snprintf(buf, sizeof(buf), "slideshow_stage_seconds_count{stage=\"%s\"} %llu\n",
+			         name, static_cast<unsigned long long>(count));
+			out += buf;
+		}
+
+		const FrameScheduler::stats_t frames = FrameScheduler::totals();
+		snprintf(buf, sizeof(buf),
+		         "# HELP slideshow_frames_total Transition frames.\n"
+		         "# TYPE slideshow_frames_total counter\n"
+		         "slideshow_frames_total{result=\"rendered\"} %u\n"
+		         "slideshow_frames_total{result=\"late\"} %u\n"
+		         "slideshow_frames_total{result=\"dropped\"} %u\n",
+		         frames.rendered, frames.late, frames.dropped);
+		out += buf;
+
+		return out;
+	}
+
+	void listen(const char* filename){
+		if ( !filename ) return;
+
+		server.reset(new UDSServer(filename));
+		if ( server->fd() == -1 || EventLoop::add(server->fd(), accept_client) != 0 ){
+			Log::warning("Metrics: failed to listen on `%s'\n", filename);
+			server.reset();
+			return;
+		}
+
+		log_verbose("Metrics: Listening on `%s'\n", filename);
+	}
+
+	void close(){
+		for ( const int client: clients ){
+			EventLoop::remove(client);
+			::close(client);
+		}
+		clients.clear();
+
+		if ( server ){
+			EventLoop::remove(server->fd());
+			server.reset();
+		}
+	}
+
+}
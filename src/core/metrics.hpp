@@ -0,0 +1,77 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2014 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SLIDESHOW_METRICS_HPP
+#define SLIDESHOW_METRICS_HPP
+
+#include <string>
+
+/**
+ * Timing histograms for each stage of the slide pipeline, exported in the
+ * Prometheus text format on a unix domain socket:
+ *
+ *   curl --unix-socket PATH http://localhost/metrics
+ *
+ * Clients not speaking HTTP get the plain metrics after sending anything
+ * (e.g. a newline). Observing is lock-free and safe from any thread.
+ */
+namespace Metrics {
+
+	enum Stage {
+		NextSlide = 0,  /* browser next_slide */
+		Fetch,          /* reading the encoded image (file or http) */
+		Decode,
+		Letterbox,
+		Upload,         /* texture upload (including staging) */
+		Frame,          /* time between presented transition frames */
+		Swap,           /* buffer swap */
+
+		StageCount
+	};
+
+	/**
+	 * Record a duration in seconds.
+	 */
+	void observe(Stage stage, double seconds);
+
+	/**
+	 * Observes the time from construction to destruction.
+	 */
+	class Timer {
+	public:
+		Timer(Stage stage);
+		~Timer();
+
+	private:
+		Stage _stage;
+		double _begin;
+	};
+
+	/**
+	 * Get all metrics in the Prometheus text format.
+	 */
+	std::string render();
+
+	/**
+	 * Start serving metrics on a unix domain socket (using the event loop).
+	 */
+	void listen(const char* filename);
+	void close();
+}
+
+#endif /* SLIDESHOW_METRICS_HPP */
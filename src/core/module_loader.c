@@ -105,13 +105,13 @@ static int callee_init(int flags){
 }
 
 module_handle module_open(const char* name, enum module_type_t type, int flags){
-	log_message(Log_Debug, "Loading plugin '%s'\n", name);
+	log_debug("Loading plugin '%s'\n", name);
 
 	/* dlopenext tries all searchpaths and adds appropriate suffix */
 	lt_dlhandle handle = lt_dlopenext(name);
 
 	if ( !handle ){
-		log_message(Log_Debug, "Failed to load plugin '%s': %s\n", name, lt_dlerror());
+		log_debug("Failed to load plugin '%s': %s\n", name, lt_dlerror());
 		errnum = MODULE_NOT_FOUND;
 		return NULL;
 	}
@@ -120,13 +120,13 @@ module_handle module_open(const char* name, enum module_type_t type, int flags){
 	 * every module. */
 	void* sym = lt_dlsym(handle, "__module_type");
 	if ( !sym ){
-		log_message(Log_Debug, "Plugin '%s' found but is invalid\n", name);
+		log_debug("Plugin '%s' found but is invalid\n", name);
 		errnum = MODULE_INVALID;
 		return NULL;
 	}
 
 	if ( type != ANY_MODULE && *((enum module_type_t*)sym) != type ){
-		log_message(Log_Debug, "Plugin '%s' found but is invalid\n", name);
+		log_debug("Plugin '%s' found but is invalid\n", name);
 		errnum = MODULE_INVALID;
 		return NULL;
 	}
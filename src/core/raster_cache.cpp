@@ -0,0 +1,314 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2014 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "core/raster_cache.hpp"
+#include "core/log.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#define RASTER_MAGIC "SSRC"
+#define RASTER_VERSION 1
+#define RASTER_ALIGN 4096
+#define TOUCH_INTERVAL 3600   /* seconds, how often the mtime of a used file is updated */
+
+struct raster_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t format;
+	uint32_t bpp;
+	uint32_t key_length;
+	uint32_t pixel_offset;
+};
+
+/**
+ * Image backed by a read-only mapping of a cache file.
+ */
+class MappedImage: public Image {
+public:
+	MappedImage(const raster_header& header, void* base, size_t length)
+		: Image(header.width, header.height, header.format, header.bpp, static_cast<unsigned char*>(base) + header.pixel_offset)
+		, _base(base)
+		, _length(length){
+
+	}
+
+	virtual ~MappedImage(){
+		munmap(_base, _length);
+		pixels = NULL;
+	}
+
+private:
+	void* _base;
+	size_t _length;
+};
+
+static std::string directory;
+static std::mutex lock;        /* protects budget and used */
+static size_t budget = 0;
+static size_t used = 0;        /* bytes stored (approximately, corrected by sweep) */
+
+/**
+ * FNV-1a, only used to get a filename from the key (collisions is detected by
+ * comparing the stored key).
+ */
+static uint64_t hash(const std::string& key){
+	uint64_t h = 14695981039346656037ULL;
+	for ( const char c: key ){
+		h ^= static_cast<unsigned char>(c);
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+static std::string filename(const std::string& key){
+	char buf[32];
+	snprintf(buf, sizeof(buf), "/%016llx.raw", static_cast<unsigned long long>(hash(key)));
+	return directory + buf;
+}
+
+static bool write_all(int fd, const void* data, size_t size){
+	const char* ptr = static_cast<const char*>(data);
+	while ( size > 0 ){
+		const ssize_t n = write(fd, ptr, size);
+		if ( n < 0 ){
+			if ( errno == EINTR ) continue;
+			return false;
+		}
+		ptr += n;
+		size -= static_cast<size_t>(n);
+	}
+	return true;
+}
+
+struct cached_file_t {
+	time_t mtime;
+	size_t size;
+	std::string name;
+};
+
+/**
+ * Remove the least recently used files until the cache fits in the budget
+ * (with some slack so it doesn't have to run on each store). Caller must hold
+ * lock.
+ */
+static void sweep(){
+	DIR* dir = opendir(directory.c_str());
+	if ( !dir ){
+		return;
+	}
+
+	std::vector<cached_file_t> files;
+	size_t total = 0;
+	struct dirent* ent;
+	while ( (ent = readdir(dir)) ){
+		const size_t len = strlen(ent->d_name);
+		const bool partial = strstr(ent->d_name, ".raw.") != NULL;
+		if ( !partial && (len < 4 || strcmp(ent->d_name + len - 4, ".raw") != 0) ){
+			continue;
+		}
+
+		const std::string path = directory + "/" + ent->d_name;
+		struct stat st;
+		if ( stat(path.c_str(), &st) != 0 ){
+			continue;
+		}
+
+		/* leftover from an interrupted store */
+		if ( partial ){
+			if ( st.st_mtime + TOUCH_INTERVAL < time(NULL) ){
+				unlink(path.c_str());
+			}
+			continue;
+		}
+
+		cached_file_t file = {st.st_mtime, static_cast<size_t>(st.st_size), path};
+		files.push_back(file);
+		total += file.size;
+	}
+	closedir(dir);
+
+	const size_t target = budget / 10 * 9;
+	if ( total > budget ){
+		std::sort(files.begin(), files.end(), [](const cached_file_t& a, const cached_file_t& b){
+			return a.mtime < b.mtime;
+		});
+
+		size_t removed = 0;
+		for ( const cached_file_t& file: files ){
+			if ( total <= target ) break;
+			if ( unlink(file.name.c_str()) == 0 ){
+				total -= file.size;
+				removed++;
+			}
+		}
+
+		log_verbose("RasterCache: Removed %zu file(s), %zuMiB used\n", removed, total / (1024 * 1024));
+	}
+
+	used = total;
+}
+
+namespace RasterCache {
+
+	void init(const char* dir, size_t bytes){
+		if ( !dir ) return;
+
+		if ( mkdir(dir, 0755) != 0 && errno != EEXIST ){
+			Log::warning("RasterCache: failed to create `%s': %s (cache disabled)\n", dir, strerror(errno));
+			return;
+		}
+
+		directory = dir;
+		log_verbose("RasterCache: Using `%s'\n", dir);
+
+		/* the budget might have been lowered since the last run */
+		std::lock_guard<std::mutex> guard(lock);
+		budget = bytes;
+		sweep();
+	}
+
+	void cleanup(){
+		directory.clear();
+	}
+
+	image_ptr load(const std::string& key){
+		if ( directory.empty() ){
+			return image_ptr();
+		}
+
+		const std::string path = filename(key);
+		const int fd = open(path.c_str(), O_RDONLY);
+		if ( fd == -1 ){
+			return image_ptr();
+		}
+
+		struct stat st;
+		if ( fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(raster_header)) ){
+			close(fd);
+			return image_ptr();
+		}
+
+		/* mark as recently used for sweep */
+		if ( st.st_mtime + TOUCH_INTERVAL < time(NULL) ){
+			futimens(fd, NULL);
+		}
+
+		const size_t length = static_cast<size_t>(st.st_size);
+		void* base = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+
+		if ( base == MAP_FAILED ){
+			Log::warning("RasterCache: mmap `%s' failed: %s\n", path.c_str(), strerror(errno));
+			return image_ptr();
+		}
+
+		raster_header header;
+		memcpy(&header, base, sizeof(header));
+		const char* stored_key = static_cast<const char*>(base) + sizeof(header);
+
+		const bool valid =
+			memcmp(header.magic, RASTER_MAGIC, 4) == 0 &&
+			header.version == RASTER_VERSION &&
+			header.key_length == key.size() &&
+			sizeof(header) + header.key_length <= header.pixel_offset &&
+			header.pixel_offset + static_cast<size_t>(header.width) * header.height * header.bpp <= length &&
+			memcmp(stored_key, key.data(), key.size()) == 0;
+
+		if ( !valid ){
+			munmap(base, length);
+			return image_ptr();
+		}
+
+		return image_ptr(new MappedImage(header, base, length));
+	}
+
+	void store(const std::string& key, const Image& image){
+		if ( directory.empty() ){
+			return;
+		}
+
+		const std::string path = filename(key);
+		std::string tmp = path + ".XXXXXX";
+		const int fd = mkstemp(&tmp[0]);
+		if ( fd == -1 ){
+			Log::warning("RasterCache: failed to create `%s': %s\n", tmp.c_str(), strerror(errno));
+			return;
+		}
+
+		raster_header header;
+		memcpy(header.magic, RASTER_MAGIC, 4);
+		header.version = RASTER_VERSION;
+		header.width = static_cast<uint32_t>(image.width);
+		header.height = static_cast<uint32_t>(image.height);
+		header.format = image.format;
+		header.bpp = image.bpp;
+		header.key_length = static_cast<uint32_t>(key.size());
+		header.pixel_offset = static_cast<uint32_t>((sizeof(header) + key.size() + RASTER_ALIGN - 1) / RASTER_ALIGN * RASTER_ALIGN);
+
+		const size_t padding = header.pixel_offset - sizeof(header) - key.size();
+		static const char zero[RASTER_ALIGN] = {0,};
+
+		const bool ok =
+			write_all(fd, &header, sizeof(header)) &&
+			write_all(fd, key.data(), key.size()) &&
+			write_all(fd, zero, padding) &&
+			write_all(fd, image.pixels, image.size) &&
+			fsync(fd) == 0; /* data must be on disk before the rename publishes it */
+
+		if ( close(fd) != 0 || !ok ){
+			Log::warning("RasterCache: failed to write `%s': %s\n", tmp.c_str(), strerror(errno));
+			unlink(tmp.c_str());
+			return;
+		}
+
+		if ( rename(tmp.c_str(), path.c_str()) != 0 ){
+			Log::warning("RasterCache: failed to rename `%s': %s\n", tmp.c_str(), strerror(errno));
+			unlink(tmp.c_str());
+			return;
+		}
+
+		std::lock_guard<std::mutex> guard(lock);
+		used += header.pixel_offset + image.size;
+		if ( used > budget ){
+			sweep();
+		}
+	}
+
+}
@@ -0,0 +1,64 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2014 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SLIDESHOW_RASTER_CACHE_HPP
+#define SLIDESHOW_RASTER_CACHE_HPP
+
+#include "core/image.hpp"
+#include <string>
+
+/**
+ * Persistent on-disk cache of decoded (and letterboxed) images.
+ *
+ * Each image is stored uncompressed in a file named by a hash of the cache
+ * key, with the pixels page-aligned so it can be mapped and uploaded without
+ * any decoding. Files are written to a temporary name and renamed into place
+ * so concurrent readers never see partial files.
+ *
+ * The directory is kept within a byte budget by removing the least recently
+ * used files (the mtime of a file is updated when it is loaded, at most once
+ * an hour to spare the storage).
+ *
+ * File layout:
+ *   header (struct raster_header)
+ *   key    (key_length bytes, used to detect hash collisions)
+ *   pixels (at pixel_offset, width * height * bpp bytes)
+ */
+namespace RasterCache {
+
+	/**
+	 * Enable the cache.
+	 * @param directory Where to store images, created if missing.
+	 * @param budget Maximum number of bytes stored.
+	 */
+	void init(const char* directory, size_t budget);
+	void cleanup();
+
+	/**
+	 * Map a cached image.
+	 * @return NULL if not cached (or cache is disabled).
+	 */
+	image_ptr load(const std::string& key);
+
+	/**
+	 * Write an image to the cache. Errors is logged but otherwise ignored.
+	 */
+	void store(const std::string& key, const Image& image);
+}
+
+#endif /* SLIDESHOW_RASTER_CACHE_HPP */
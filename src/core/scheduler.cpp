@@ -0,0 +1,422 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2014 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "core/scheduler.hpp"
+#include "core/log.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fnmatch.h>
+#include <strings.h>
+
+#define MAX_CANDIDATES 16384
+#define REFRESH_INTERVAL 600     /* seconds before the candidate set is read again */
+#define ALL_DAYS 0x7f
+
+struct rule_t {
+	std::string glob;
+	double weight;
+	int start;               /* minutes since midnight, start == end is all day */
+	int end;
+	unsigned int days;       /* bit 0 is sunday */
+	time_t interval;
+};
+
+struct candidate_t {
+	std::string filename;
+	std::string assembler;
+	const rule_t* rule;      /* NULL if no rule matched */
+	double pass;
+	double stride;           /* 1 / weight */
+	time_t eligible;         /* when the candidate can be shown again */
+	size_t order;            /* browser order, used to break ties */
+};
+
+static bool enabled = false;
+static std::vector<rule_t> rules;
+static std::vector<candidate_t> candidates;
+static std::vector<size_t> ready;       /* min-heap by pass */
+static std::vector<size_t> waiting;     /* min-heap by eligible */
+static double vtime = 0.0;              /* pass of the last shown candidate */
+static bool valid = false;
+static time_t filled = 0;
+
+static const char* day_names[] = {"sun", "mon", "tue", "wed", "thu", "fri", "sat"};
+
+static int parse_day(const std::string& name){
+	for ( int i = 0; i < 7; i++ ){
+		if ( strcasecmp(name.c_str(), day_names[i]) == 0 ){
+			return i;
+		}
+	}
+	return -1;
+}
+
+static bool parse_days(const std::string& value, unsigned int& days){
+	std::istringstream ss(value);
+	std::string range;
+	days = 0;
+
+	while ( std::getline(ss, range, ',') ){
+		const size_t dash = range.find('-');
+		const int first = parse_day(range.substr(0, dash));
+		const int last = dash == std::string::npos ? first : parse_day(range.substr(dash + 1));
+		if ( first < 0 || last < 0 ){
+			return false;
+		}
+
+		/* ranges may wrap, e.g. fri-mon */
+		for ( int day = first; ; day = (day + 1) % 7 ){
+			days |= 1U << day;
+			if ( day == last ) break;
+		}
+	}
+
+	return true;
+}
+
+static bool parse_rule(const char* line, rule_t& rule){
+	std::istringstream ss(line);
+	std::string option;
+
+	if ( !(ss >> rule.glob >> rule.weight) || rule.weight < 0.0 ){
+		return false;
+	}
+
+	rule.start = 0;
+	rule.end = 0;
+	rule.days = ALL_DAYS;
+	rule.interval = 0;
+
+	while ( ss >> option ){
+		const size_t eq = option.find('=');
+		const std::string key = option.substr(0, eq);
+		const std::string value = eq == std::string::npos ? "" : option.substr(eq + 1);
+
+		if ( key == "hours" ){
+			int h1, m1, h2, m2;
+			if ( sscanf(value.c_str(), "%d:%d-%d:%d", &h1, &m1, &h2, &m2) != 4 ){
+				return false;
+			}
+			rule.start = h1 * 60 + m1;
+			rule.end = h2 * 60 + m2;
+		} else if ( key == "days" ){
+			if ( !parse_days(value, rule.days) ){
+				return false;
+			}
+		} else if ( key == "interval" ){
+			rule.interval = static_cast<time_t>(atol(value.c_str()));
+		} else {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void load_rules(const char* filename){
+	FILE* fp = fopen(filename, "r");
+	if ( !fp ){
+		Log::warning("Scheduler: Failed to open `%s', slides is shown in browser order\n", filename);
+		return;
+	}
+
+	char* line = NULL;
+	size_t size = 0;
+	unsigned int lineno = 0;
+	while ( getline(&line, &size, fp) != -1 ){
+		lineno++;
+
+		const char* ptr = line + strspn(line, " \t");
+		if ( *ptr == '#' || *ptr == '\n' || *ptr == 0 ){
+			continue;
+		}
+
+		rule_t rule;
+		if ( !parse_rule(ptr, rule) ){
+			Log::warning("Scheduler: %s:%u: invalid rule, ignored\n", filename, lineno);
+			continue;
+		}
+
+		rules.push_back(rule);
+	}
+
+	free(line);
+	fclose(fp);
+
+	log_verbose("Scheduler: Loaded %zu rule(s) from `%s'\n", rules.size(), filename);
+	enabled = true;
+}
+
+static const rule_t* find_rule(const char* filename){
+	for ( const rule_t& rule: rules ){
+		if ( fnmatch(rule.glob.c_str(), filename, 0) == 0 ){
+			return &rule;
+		}
+	}
+	return NULL;
+}
+
+static bool inside(const rule_t& rule, time_t t){
+	struct tm tm;
+	localtime_r(&t, &tm);
+
+	if ( !(rule.days & (1U << tm.tm_wday)) ) return false;
+	if ( rule.start == rule.end ) return true;
+
+	const int minute = tm.tm_hour * 60 + tm.tm_min;
+	if ( rule.start < rule.end ){
+		return minute >= rule.start && minute < rule.end;
+	}
+	return minute >= rule.start || minute < rule.end;
+}
+
+/**
+ * Find the first time not before t inside the time window of the rule.
+ * @return -1 if the window never opens.
+ */
+static time_t next_window(const rule_t* rule, time_t t){
+	if ( !rule || inside(*rule, t) ){
+		return t;
+	}
+
+	struct tm base;
+	localtime_r(&t, &base);
+
+	/* a window opens either at its start or at midnight (when it wraps
+	 * midnight or is allowed all day) */
+	const int starts[2] = {0, rule->start};
+	for ( int day = 0; day <= 7; day++ ){
+		for ( int start: starts ){
+			struct tm tm = base;
+			tm.tm_mday += day;
+			tm.tm_hour = start / 60;
+			tm.tm_min = start % 60;
+			tm.tm_sec = 0;
+			tm.tm_isdst = -1;
+
+			const time_t candidate = mktime(&tm);
+			if ( candidate > t && inside(*rule, candidate) ){
+				return candidate;
+			}
+		}
+	}
+
+	return -1;
+}
+
+static bool later_pass(size_t a, size_t b){
+	const candidate_t& x = candidates[a];
+	const candidate_t& y = candidates[b];
+	if ( x.pass < y.pass ) return false;
+	if ( y.pass < x.pass ) return true;
+	return x.order > y.order;
+}
+
+static bool later_eligible(size_t a, size_t b){
+	return candidates[a].eligible > candidates[b].eligible;
+}
+
+/**
+ * Put a candidate in the heap matching when it is eligible.
+ */
+static void schedule(size_t index, time_t now){
+	candidate_t& candidate = candidates[index];
+	if ( candidate.eligible == -1 ){
+		return;
+	}
+
+	if ( candidate.eligible > now ){
+		waiting.push_back(index);
+		std::push_heap(waiting.begin(), waiting.end(), later_eligible);
+		return;
+	}
+
+	/* don't let a candidate which has been waiting catch up by being shown
+	 * several times in a row */
+	candidate.pass = std::max(candidate.pass, vtime);
+	ready.push_back(index);
+	std::push_heap(ready.begin(), ready.end(), later_pass);
+}
+
+static void visit_slide(void* user, const char* filename, const char* assembler){
+	std::vector<candidate_t>& next = *static_cast<std::vector<candidate_t>*>(user);
+	if ( !filename || next.size() >= MAX_CANDIDATES ){
+		return;
+	}
+
+	candidate_t candidate;
+	candidate.filename = filename;
+	candidate.assembler = assembler ? assembler : "";
+	candidate.rule = find_rule(filename);
+	candidate.pass = 0.0;
+	candidate.stride = candidate.rule ? 1.0 / candidate.rule->weight : 1.0;
+	candidate.eligible = 0;
+	candidate.order = next.size();
+	next.push_back(candidate);
+}
+
+/**
+ * Read the browser queue into the candidate set.
+ */
+static void fill(browser_module_t* browser, time_t now){
+	std::vector<candidate_t> next;
+
+	filled = now;
+	valid = true;
+
+	/* keep the previous set if the browser is unavailable */
+	if ( browser->queue_list(browser, visit_slide, &next) != 0 ){
+		log_verbose("Scheduler: Failed to read the queue, keeping %zu candidates\n", candidates.size());
+		return;
+	}
+
+	/* carry over pass values (and frequency caps) of candidates still present,
+	 * a slide listed several times is matched by occurrence */
+	std::unordered_map<std::string, std::vector<size_t>> present;
+	for ( size_t i = next.size(); i > 0; i-- ){
+		present[next[i - 1].filename].push_back(i - 1);
+	}
+	for ( const candidate_t& old: candidates ){
+		auto it = present.find(old.filename);
+		if ( it == present.end() || it->second.empty() ) continue;
+
+		candidate_t& candidate = next[it->second.back()];
+		it->second.pop_back();
+		candidate.pass = std::max(old.pass - vtime, 0.0);
+		candidate.eligible = old.eligible;
+	}
+
+	candidates.swap(next);
+	ready.clear();
+	waiting.clear();
+	vtime = 0.0;
+
+	for ( size_t i = 0; i < candidates.size(); i++ ){
+		candidate_t& candidate = candidates[i];
+		const bool disabled = candidate.rule && !(candidate.rule->weight > 0.0);
+		candidate.eligible = disabled ? -1 : next_window(candidate.rule, std::max(candidate.eligible, now));
+		schedule(i, now);
+	}
+
+	log_verbose("Scheduler: %zu candidates (%zu eligible)\n", candidates.size(), ready.size());
+}
+
+namespace Scheduler {
+
+	void init(const char* filename){
+		if ( filename ){
+			load_rules(filename);
+		}
+	}
+
+	void cleanup(){
+		rules.clear();
+		candidates.clear();
+		ready.clear();
+		waiting.clear();
+		enabled = false;
+		valid = false;
+	}
+
+	slide_context_t next_slide(browser_module_t* browser){
+		if ( !enabled ){
+			return browser->next_slide(browser);
+		}
+
+		/* intermediate slides is shown once, right away */
+		if ( browser->next_intermediate ){
+			slide_context_t slide = browser->next_intermediate(browser);
+			if ( slide.filename ){
+				return slide;
+			}
+			free(slide.assembler);
+		}
+
+		const time_t now = time(NULL);
+		if ( browser->queue_list && (!valid || now - filled >= REFRESH_INTERVAL) ){
+			fill(browser, now);
+		}
+
+		/* checked after filling as the browser might only know once it has tried */
+		if ( !browser->queue_list ){
+			Log::warning("Scheduler: Browser cannot list its queue, slides is shown in browser order\n");
+			enabled = false;
+			return browser->next_slide(browser);
+		}
+
+		/* candidates whose window opened or cap expired */
+		while ( !waiting.empty() && candidates[waiting.front()].eligible <= now ){
+			std::pop_heap(waiting.begin(), waiting.end(), later_eligible);
+			const size_t index = waiting.back();
+			waiting.pop_back();
+			schedule(index, now);
+		}
+
+		slide_context_t slide;
+		slide.filename = NULL;
+		slide.assembler = NULL;
+
+		/* windows is only checked when a candidate enters the ready heap, one
+		 * which has closed since is parked until it opens again */
+		size_t index;
+		while ( true ){
+			/* nothing is eligible right now, a blank slide is shown */
+			if ( ready.empty() ){
+				return slide;
+			}
+
+			std::pop_heap(ready.begin(), ready.end(), later_pass);
+			index = ready.back();
+			ready.pop_back();
+
+			candidate_t& candidate = candidates[index];
+			if ( !candidate.rule || inside(*candidate.rule, now) ){
+				break;
+			}
+
+			candidate.eligible = next_window(candidate.rule, now);
+			schedule(index, now);
+		}
+
+		candidate_t& candidate = candidates[index];
+		vtime = candidate.pass;
+		candidate.pass += candidate.stride;
+		candidate.eligible = next_window(candidate.rule, now + (candidate.rule ? candidate.rule->interval : 0));
+		schedule(index, now);
+
+		slide.filename = strdup(candidate.filename.c_str());
+		slide.assembler = candidate.assembler.empty() ? NULL : strdup(candidate.assembler.c_str());
+		return slide;
+	}
+
+	void reset(){
+		valid = false;
+	}
+
+}
@@ -0,0 +1,78 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2014 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SLIDESHOW_SCHEDULER_HPP
+#define SLIDESHOW_SCHEDULER_HPP
+
+#include "browsers/browser.h"
+
+/**
+ * Local slide scheduling (weights, dayparting and frequency caps).
+ *
+ * When enabled the slides of the browser queue is listed (see queue_list in
+ * browser_module_t) into a candidate set and slides is then picked using stride
+ * scheduling: each candidate has a pass value advanced by 1/weight each time
+ * it is shown and the eligible candidate with the lowest pass is shown next.
+ * Candidates outside their time window (or within their minimum interval) is
+ * parked in a second heap ordered by when they become eligible again, so each
+ * pick is O(log n).
+ *
+ * Rules are read from a file, one rule per line where the first matching
+ * glob (matched against the filename) is used:
+ *
+ *   # glob          weight  options
+ *   *promo*         3       hours=08:00-12:00 days=mon-fri interval=600
+ *   *               1
+ *
+ *   hours=HH:MM-HH:MM  Time of day (may wrap past midnight).
+ *   days=D[-D],..      Days of week (mon, tue, ..).
+ *   interval=SEC       Minimum time between two showings.
+ *
+ * A weight of 0 disables the slide. Slides not matching any rule has weight
+ * 1 and is always eligible.
+ *
+ * Intermediate slides (see next_intermediate) is passed through, shown once
+ * before the next scheduled slide.
+ *
+ * The candidate set is read again when the queue changes and every 10
+ * minutes, keeping the previous set if the queue cannot be read (e.g. when the
+ * frontend is unreachable).
+ */
+namespace Scheduler {
+
+	/**
+	 * @param filename Rule file, the scheduler is disabled (slides is shown in
+	 *                 browser order) if NULL.
+	 */
+	void init(const char* filename);
+	void cleanup();
+
+	/**
+	 * Get the next slide to show. Must be called with the browser lock held.
+	 * @return Same as next_slide_callback.
+	 */
+	slide_context_t next_slide(browser_module_t* browser);
+
+	/**
+	 * Forget the candidate set, e.g. when the queue has changed. Must be called
+	 * with the browser lock held.
+	 */
+	void reset();
+}
+
+#endif /* SLIDESHOW_SCHEDULER_HPP */
@@ -0,0 +1,264 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2014 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "core/shader_cache.hpp"
+#include "core/log.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#define SHADER_MAGIC "SSSC"
+#define SHADER_VERSION 1
+
+struct shader_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t format;          /* binary format (driver specific) */
+	uint32_t key_length;
+	uint32_t binary_length;
+};
+
+static std::string directory;
+static std::unordered_map<std::string, GLuint> programs;
+
+/**
+ * FNV-1a, only used to get a filename from the key (collisions is detected by
+ * comparing the stored key).
+ */
+static uint64_t hash(const std::string& key){
+	uint64_t h = 14695981039346656037ULL;
+	for ( const char c: key ){
+		h ^= static_cast<unsigned char>(c);
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+static std::string filename(const std::string& key){
+	char buf[32];
+	snprintf(buf, sizeof(buf), "/%016llx.bin", static_cast<unsigned long long>(hash(key)));
+	return directory + buf;
+}
+
+static bool read_all(int fd, void* data, size_t size){
+	char* ptr = static_cast<char*>(data);
+	while ( size > 0 ){
+		const ssize_t n = read(fd, ptr, size);
+		if ( n <= 0 ){
+			if ( n < 0 && errno == EINTR ) continue;
+			return false;
+		}
+		ptr += n;
+		size -= static_cast<size_t>(n);
+	}
+	return true;
+}
+
+static bool write_all(int fd, const void* data, size_t size){
+	const char* ptr = static_cast<const char*>(data);
+	while ( size > 0 ){
+		const ssize_t n = write(fd, ptr, size);
+		if ( n < 0 ){
+			if ( errno == EINTR ) continue;
+			return false;
+		}
+		ptr += n;
+		size -= static_cast<size_t>(n);
+	}
+	return true;
+}
+
+/**
+ * Test if programs can be persisted, requires a context.
+ */
+static bool binary_supported(){
+	if ( directory.empty() || !(GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary) ){
+		return false;
+	}
+
+	/* some drivers has the extension without supporting any format */
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	return formats > 0;
+}
+
+static GLuint load_binary(const std::string& key){
+	const std::string path = filename(key);
+	const int fd = open(path.c_str(), O_RDONLY);
+	if ( fd == -1 ){
+		return 0;
+	}
+
+	shader_header header;
+	std::string stored_key;
+	std::vector<char> binary;
+
+	bool valid =
+		read_all(fd, &header, sizeof(header)) &&
+		memcmp(header.magic, SHADER_MAGIC, 4) == 0 &&
+		header.version == SHADER_VERSION &&
+		header.key_length == key.size();
+
+	if ( valid ){
+		stored_key.resize(header.key_length);
+		binary.resize(header.binary_length);
+		valid =
+			read_all(fd, &stored_key[0], stored_key.size()) &&
+			read_all(fd, binary.data(), binary.size()) &&
+			stored_key == key;
+	}
+	close(fd);
+
+	if ( !valid ){
+		return 0;
+	}
+
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, header.format, binary.data(), static_cast<GLsizei>(binary.size()));
+
+	GLint r;
+	glGetProgramiv(program, GL_LINK_STATUS, &r);
+	if ( r == GL_FALSE ){
+		/* the driver has changed, it is compiled and stored again */
+		log_verbose("ShaderCache: `%s' rejected by driver, removing\n", path.c_str());
+		glDeleteProgram(program);
+		unlink(path.c_str());
+		return 0;
+	}
+
+	return program;
+}
+
+static void store_binary(const std::string& key, GLuint program){
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if ( length <= 0 ){
+		return;
+	}
+
+	std::vector<char> binary(static_cast<size_t>(length));
+	GLenum format;
+	glGetProgramBinary(program, length, &length, &format, binary.data());
+
+	const std::string path = filename(key);
+	std::string tmp = path + ".XXXXXX";
+	const int fd = mkstemp(&tmp[0]);
+	if ( fd == -1 ){
+		Log::warning("ShaderCache: failed to create `%s': %s\n", tmp.c_str(), strerror(errno));
+		return;
+	}
+
+	shader_header header;
+	memcpy(header.magic, SHADER_MAGIC, 4);
+	header.version = SHADER_VERSION;
+	header.format = format;
+	header.key_length = static_cast<uint32_t>(key.size());
+	header.binary_length = static_cast<uint32_t>(length);
+
+	const bool ok =
+		write_all(fd, &header, sizeof(header)) &&
+		write_all(fd, key.data(), key.size()) &&
+		write_all(fd, binary.data(), static_cast<size_t>(length));
+
+	if ( close(fd) != 0 || !ok ){
+		Log::warning("ShaderCache: failed to write `%s': %s\n", tmp.c_str(), strerror(errno));
+		unlink(tmp.c_str());
+		return;
+	}
+
+	if ( rename(tmp.c_str(), path.c_str()) != 0 ){
+		Log::warning("ShaderCache: failed to rename `%s': %s\n", tmp.c_str(), strerror(errno));
+		unlink(tmp.c_str());
+	}
+}
+
+namespace ShaderCache {
+
+	void init(const char* dir){
+		if ( !dir ) return;
+
+		if ( mkdir(dir, 0755) != 0 && errno != EEXIST ){
+			Log::warning("ShaderCache: failed to create `%s': %s (only cached in memory)\n", dir, strerror(errno));
+			return;
+		}
+
+		directory = dir;
+		log_verbose("ShaderCache: Using `%s'\n", dir);
+	}
+
+	void cleanup(){
+		for ( auto& it: programs ){
+			glDeleteProgram(it.second);
+		}
+		programs.clear();
+		directory.clear();
+	}
+
+	GLuint load(const std::string& key){
+		auto it = programs.find(key);
+		if ( it != programs.end() ){
+			return it->second;
+		}
+
+		if ( !binary_supported() ){
+			return 0;
+		}
+
+		const GLuint program = load_binary(key);
+		if ( program ){
+			log_debug("ShaderCache: Loaded program binary %016llx\n", static_cast<unsigned long long>(hash(key)));
+			programs[key] = program;
+		}
+
+		return program;
+	}
+
+	void store(const std::string& key, GLuint program){
+		auto it = programs.find(key);
+		if ( it != programs.end() && it->second != program ){
+			glDeleteProgram(it->second);
+		}
+		programs[key] = program;
+
+		if ( binary_supported() ){
+			store_binary(key, program);
+		}
+	}
+
+	void prepare(GLuint program){
+		if ( binary_supported() ){
+			glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
+	}
+
+}
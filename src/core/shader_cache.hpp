@@ -0,0 +1,73 @@
+/**
+ * This file is part of Slideshow.
+ * Copyright (C) 2008-2014 David Sveningsson <ext@sidvind.com>
+ *
+ * Slideshow is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Slideshow is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Slideshow.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SLIDESHOW_SHADER_CACHE_HPP
+#define SLIDESHOW_SHADER_CACHE_HPP
+
+#include "core/opengl.h"
+#include <string>
+
+/**
+ * Cache of linked shader programs so switching transitions (or restarting)
+ * doesn't have to run the GLSL compiler again.
+ *
+ * Programs is kept in memory for the lifetime of the cache and, if a
+ * directory is given and the driver supports program binaries
+ * (ARB_get_program_binary), also persisted to disk. The key is the transition
+ * name, the renderer and the shader sources, so binaries from another driver
+ * or stale sources is never used. A binary rejected by the driver (e.g.
+ * after a driver upgrade) is removed and the program compiled again.
+ *
+ * File layout:
+ *   header (struct shader_header)
+ *   key    (key_length bytes, used to detect hash collisions)
+ *   binary (binary_length bytes)
+ */
+namespace ShaderCache {
+
+	/**
+	 * Enable persistent storage.
+	 * @param directory Where to store programs, created if missing. The cache
+	 *                  is memory only if NULL.
+	 */
+	void init(const char* directory);
+
+	/**
+	 * Delete all cached programs.
+	 */
+	void cleanup();
+
+	/**
+	 * Find a cached program, loading it from disk if needed.
+	 * @return 0 if not cached.
+	 */
+	GLuint load(const std::string& key);
+
+	/**
+	 * Cache a linked program (the cache takes ownership). Errors is logged but
+	 * otherwise ignored.
+	 */
+	void store(const std::string& key, GLuint program);
+
+	/**
+	 * Must be called before linking a program which is to be stored.
+	 */
+	void prepare(GLuint program);
+}
+
+#endif /* SLIDESHOW_SHADER_CACHE_HPP */
@@ -22,12 +22,12 @@
 
 #include "state/state.hpp"
 #include <time.h>
-#include <sys/time.h>
 
+/* monotonic so adjustments to the wall clock (e.g. NTP) doesn't affect timing */
 static unsigned long utime(){
-	struct timeval cur;
-	gettimeofday(&cur, NULL);
-	return (unsigned long)(cur.tv_sec * 1000000 + cur.tv_usec);
+	struct timespec cur;
+	clock_gettime(CLOCK_MONOTONIC, &cur);
+	return (unsigned long)(cur.tv_sec * 1000000 + cur.tv_nsec / 1000);
 }
 
 State::State(browser_module_t* browser)
@@ -53,6 +53,10 @@ browser_module_t* State::browser() const {
 	return _browser;
 }
 
+double State::timeout() const {
+	return 0.0;
+}
+
 float State::age() const {
 	return static_cast<float>(utime() - _created) / 1e6;
 }
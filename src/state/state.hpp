@@ -29,6 +29,12 @@ public:
 
 	virtual State* action(bool &flip) = 0;
 
+	/**
+	 * Time in seconds the kernel may wait for events before calling action
+	 * again, negative to wait indefinitely. Defaults to 0 (e.g. rendering).
+	 */
+	virtual double timeout() const;
+
 	slide_context_t next_slide() const;
 	browser_module_t* browser() const;
 
@@ -25,6 +25,7 @@
 #include "state/video.hpp"
 #include "state/view.hpp"
 #include "core/graphics.h"
+#include "core/loader.hpp"
 #include "core/log.hpp"
 #include <cstring>
 
@@ -33,8 +34,11 @@ State* SwitchState::action(bool &flip){
 		return new ViewState(this);
 	}
 
-	/* get next slide */
-	slide_context_t slide = next_slide();
+	/* get next slide (already decoded by the loader unless it is lagging behind) */
+	slide_context_t slide;
+	image_ptr image;
+	bool staged;
+	const int status = Loader::pop(slide, image, staged);
 
 	struct autofree_t {
 		autofree_t(slide_context_t& s): s(s){}
@@ -58,15 +62,21 @@ State* SwitchState::action(bool &flip){
 
 	/* @todo make something factory-like */
 	if ( strcmp("image", slide.assembler) == 0 || strcmp("text", slide.assembler) == 0 ){
-		Log::verbose("Kernel: Switching to image \"%s\"\n", slide.filename);
+		log_verbose("Kernel: Switching to image \"%s\"\n", slide.filename);
 
-		if ( graphics_load_image(slide.filename, 1) == -1 ){
+		/* already uploaded while the previous slide was shown */
+		if ( staged ){
+			graphics_swap_textures();
+			return new TransitionState(this);
+		}
+
+		if ( status != 0 || graphics_upload_image(image.get()) == -1 ){
 			return new ViewState(this);
 		}
 
 		return new TransitionState(this);
 	} else if ( strcmp("video", slide.assembler) == 0 ){
-		Log::debug("Kernel: Playing video \"%s\"\n", slide.filename);
+		log_debug("Kernel: Playing video \"%s\"\n", slide.filename);
 		return new VideoState(this, slide.filename);
 	} else {
 		Log::warning("Unhandled assembler \"%s\" for \"%s\"\n", slide.assembler, slide.filename);
@@ -23,18 +23,32 @@
 #include "state/transition.hpp"
 #include "state/view.hpp"
 #include "core/graphics.h"
+#include "core/frame_scheduler.hpp"
 
 float TransitionState::transition_time = 1.0f;
 
+TransitionState::TransitionState(State* state)
+	: State(state)
+	, _begin(FrameScheduler::now()) {
+
+	FrameScheduler::begin();
+}
+
 State* TransitionState::action(bool &flip){
-	float s = age() / transition_time;
+	/* evaluate at the time the frame will be shown rather than now */
+	const float s = static_cast<float>((FrameScheduler::predict() - _begin) / transition_time);
 
 	graphics_render(s);
 	flip = true;
 
 	if ( s > 1.0f ){
+		FrameScheduler::end();
 		return new ViewState(this);
 	}
 
 	return this;
 }
+
+double TransitionState::timeout() const {
+	return FrameScheduler::until_next_frame();
+}
@@ -23,15 +23,18 @@
 
 class TransitionState: public State {
 public:
-	TransitionState(State* state): State(state){}
+	TransitionState(State* state);
 	virtual ~TransitionState(){}
 
 	virtual State* action(bool &flip);
+	virtual double timeout() const;
 
 	static void set_transition_time(float t){ transition_time = t; }
 
 private:
 	static float transition_time;
+
+	double _begin;   /* monotonic time the transition started */
 };
 
 #endif /* STATE_TRANSITION_HPP */
@@ -44,7 +44,7 @@ static const char* read2(int fd){
 			return read_buffer;
 		}
 
-		Log::verbose("mplayer: %s", read_buffer);
+		log_verbose("mplayer: %s", read_buffer);
 	}
 
 	switch ( errno ){
@@ -109,6 +109,11 @@ State* VideoState::action(bool &flip){
 	}
 }
 
+double VideoState::timeout() const {
+	/* mplayer is polled for when the video has finished */
+	return 0.1;
+}
+
 int VideoState::init(){
 	/* Fork and get child std{in,out} */
 	/* http://lists.mplayerhq.hu/pipermail/mplayer-dev-eng/2007-August/053602.html */
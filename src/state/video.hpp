@@ -27,6 +27,7 @@ public:
 	virtual ~VideoState();
 
 	virtual State* action(bool &flip);
+	virtual double timeout() const;
 
 	static int init();
 	static int cleanup();
@@ -22,7 +22,7 @@
 
 #include "state/view.hpp"
 #include "state/switch.hpp"
-#include <unistd.h>
+#include "core/loader.hpp"
 
 double ViewState::view_time = 1.0;
 
@@ -31,8 +31,16 @@ State* ViewState::action(bool &flip){
 		return new SwitchState(this);
 	}
 
-	// Sleep for a while
-	usleep(100 /* ms */ * 1000);
+	/* use the idle time to upload upcoming slides */
+	if ( browser() ){
+		Loader::stage();
+	}
 
 	return this;
 }
+
+double ViewState::timeout() const {
+	/* the loader wakes the kernel when more slides can be staged */
+	const double left = view_time - age();
+	return left > 0.0 ? left : 0.0;
+}
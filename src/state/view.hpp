@@ -27,6 +27,7 @@ public:
 	virtual ~ViewState(){}
 
 	virtual State* action(bool &flip);
+	virtual double timeout() const;
 
 	static void set_view_time(double t){ view_time = t; }
 
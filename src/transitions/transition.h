@@ -33,6 +33,9 @@ struct transition_context {
 	unsigned int texture[2];
 	float state;                  /* [0,1] 0: current slide fully visible 1: new slide fully visible */
 	unsigned int counter;         /* an incrementing number which can be used to seed deterministic randomness (incremented each time a new slide is loaded) */
+	unsigned int previous;        /* texture of the previous slide (same as texture[1]) */
+	unsigned int current;         /* texture of the current slide (same as texture[0]) */
+	unsigned int next;            /* texture of the upcoming slide if it is already uploaded, otherwise 0 */
 };
 
 struct transition_module {